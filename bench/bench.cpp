@@ -0,0 +1,369 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// bench - microbenchmarks for the logging and protocol hot paths
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "../common/hexfmt.h"
+#include "../common/klog_format.h"
+#include "../common/lzblock.h"
+#include "../common/kline_frame.h"
+#include "../common/kmsg.h"
+#include "../common/uringlog.h"
+#include "../hd/honda.h"
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+
+#define BENCH_SECONDS 0.3
+#define OUTBUF_SIZE (256*1024)
+
+FILE *fpnull;
+PASSTHRU_MSG msg;
+KMSG_VIEW view;		// of msg
+char outbuf[OUTBUF_SIZE];
+size_t outlen;
+volatile size_t sink; // keeps results alive
+
+/**
+ * @brief run op repeatedly for BENCH_SECONDS and print ns/op and MB/s
+ * @param name - case name
+ * @param bytes - payload bytes handled by one op
+ * @param op - callable to measure
+ */
+template <typename F>
+void run_bench(const char *name, size_t bytes, F op)
+{
+	typedef std::chrono::steady_clock clk;
+	unsigned long iters = 0;
+	unsigned long batch = 64;
+	clk::time_point start = clk::now();
+	double elapsed;
+	do
+	{
+		for (unsigned long i = 0; i < batch; i++)
+			op();
+		iters += batch;
+		elapsed = std::chrono::duration<double>(clk::now() - start).count();
+	} while (elapsed < BENCH_SECONDS);
+
+	double ns = elapsed * 1e9 / iters;
+	printf("%-36s %5u B %10.1f ns/op %9.1f MB/s\n",name,(unsigned int)bytes,ns,bytes * 1e3 / ns);
+}
+
+/** old klogger dump_msg: one fprintf per byte */
+void dump_msg_fprintf(PASSTHRU_MSG *m)
+{
+	fprintf(fpnull,"[%u] ",(unsigned int)m->Timestamp);
+	for (unsigned int i = 0; i < m->DataSize; i++)
+		fprintf(fpnull,"%02X ",m->Data[i]);
+	fprintf(fpnull,"\n");
+}
+
+/** current klogger dump_msg: format into a large buffer, flush in bulk */
+void dump_msg_buffered(PASSTHRU_MSG *m)
+{
+	if (outlen + KLOG_MAX_TEXT_LINE > OUTBUF_SIZE)
+	{
+		fwrite(outbuf,1,outlen,fpnull);
+		outlen = 0;
+	}
+	KMSG_VIEW v = passthru_view(m);
+	outlen += klog_format_text(outbuf + outlen,&v);
+}
+
+// frames from the bundled captures
+const char *TESTER_PRESENT = "[456677780] 80 58 F1 01 3E 08";	// kwp200_kiaceed.txt
+const char *TESTER_PRESENT_REPLY = "[467573991] 80 58 F1 01 3E 08 80 F1 58 01 7E 48";
+const char *DTC_LIST_REPLY = "[466501861] 80 58 F1 04 18 00 80 00 65 80 F1 58 2F 58 0F 93 46 00 93 52 00 93 61 00 93 67 00 93 78 00 93 82 00 94 73 00 94 77 00 93 34 00 93 29 00 94 10 00 94 09 00 95 27 00 A5 05 00 A5 00 00 0C";
+const char *DTC_REPLY = "[3271126078] 60 05 08 02 91 00 05 00 00 FB";	// honda-crv-dtc.txt, request echo + reply
+const char *ECU_INFO_REPLY = "[3271069071] 60 05 70 0F 1C 00 12 03 C7 28 49 51 83 33 55 00 55 33 00 40 FF 30 60";
+const char *CRASH_DATA = "[1605909919] FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF 00 06 FF FF FF 1A FF FF FF FA FF FF FF 1A FF FF FF FA FF FF FF 0A FF FF FF 4A FF FF FF FF FF FF FF 6A FF FF FF 1A FF FF FF FA FF FF FF 1A FF FF FF FA FF FF FF 0A FF FF FF 6A FF FF FF FF FF FF FF 4A FF FF FF 1A FF FF FF FA FF FF FF 16 FF FF FF F6 FF FF FF 19 FF FF FF F9 FF FF FF FF FF FF FF F9 FF FF FF 1A FF FF FF FA FF FF FF 16 FF FF "
+	"FF F6 FF FF FF 99 FF FF FF F9 FF FF FF FF FF FF FF F9 FF FF FF 1A FF FF FF FA FF FF FF 1A FF FF FF FA FF FF FF 0A FF FF FF 8A FF FF FF FF FF FF FF 8A FF FF FF 9A FF FF FF FA FF FF FF 1A FF FF FF FA FF FF FF 0A FF FF FF 8A FF FF FF FF FF FF FF 8A FF FF FF FF FF FF FF FF FF C3 FF FF FF 0D FF FF FF F1 FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF FF 00 02 FF FF FF FF FF FF 6A FF";	// hondacrv2_clearcrash.txt
+
+void bench_hex(const char *frame)
+{
+	klog_parse_text(frame,&msg);
+	size_t size = msg.DataSize;
+
+	run_bench("dump_msg fprintf per byte",size,[] { dump_msg_fprintf(&msg); });
+	run_bench("dump_msg buffered",size,[] { dump_msg_buffered(&msg); });
+	run_bench("hex_encode_scalar",size,[] { sink += hex_encode_scalar(outbuf,msg.Data,msg.DataSize); });
+	run_bench("hex_encode",size,[] { sink += hex_encode(outbuf,msg.Data,msg.DataSize); });
+}
+
+PASSTHRU_MSG reply;
+HONDA_PACKET hp;
+
+/**
+ * @brief hd packet helpers on a Honda frame
+ * @param frame - capture line, a 5 byte request echo followed by the reply
+ */
+void bench_honda(const char *frame)
+{
+	klog_parse_text(frame,&reply);
+	reply.DataSize -= 5;
+	memmove(reply.Data,reply.Data + 5,reply.DataSize);
+	size_t size = reply.DataSize;
+	decode_packet(&reply,&hp);
+
+	run_bench("iso_checksum",size,[] { sink += iso_checksum(reply.Data,reply.DataSize - 1); });
+	run_bench("decode_packet",size,[] { sink += decode_packet(&reply,&hp); });
+	run_bench("make_packet",hp.cmd_len + 3,[] { make_packet(&hp,&msg); sink += msg.DataSize; });
+	run_bench("hextostr",hp.cmd_len,[] { sink += (size_t)hextostr(hp.cmd,hp.cmd_len); });
+}
+
+/**
+ * DTC lookup: first entry, the last (wildcard) entry, and a miss, through the
+ * index and by scanning the table. The index must give the scan's answer for
+ * every code.
+ */
+void bench_dtc()
+{
+	char code[8];
+	unsigned int mismatches = 0;
+	for (unsigned int c = 0; c < 0x10000; c++)
+	{
+		sprintf(code,"%02X-%02X",c >> 8,c & 0xFF);
+		if (get_dtc_descr(code) != get_dtc_descr_scan(code))
+			mismatches++;
+	}
+	if (mismatches)
+		printf("DTC INDEX DIFFERS FROM TABLE SCAN FOR %u CODES\n",mismatches);
+
+	run_bench("mask_compare",5,[] { sink += mask_compare("A1-1x","A1-12"); });
+	run_bench("get_dtc_descr first entry",5,[] { sink += (size_t)get_dtc_descr("A1-11"); });
+	run_bench("get_dtc_descr wildcard",5,[] { sink += (size_t)get_dtc_descr("91-25"); });
+	run_bench("get_dtc_descr unknown",5,[] { sink += (size_t)get_dtc_descr("00-00"); });
+	run_bench("get_dtc_descr_code wildcard",2,[] { sink += (size_t)get_dtc_descr_code(0x9125); });
+	run_bench("get_dtc_descr_scan wildcard",5,[] { sink += (size_t)get_dtc_descr_scan("91-25"); });
+	run_bench("get_dtc_descr_scan unknown",5,[] { sink += (size_t)get_dtc_descr_scan("00-00"); });
+}
+
+KFRAME_SPLITTER splitter;
+
+void count_frame(const KMSG_VIEW *frame, void *ctx)
+{
+	sink += frame->DataSize;
+}
+
+/**
+ * @brief klogger /s on a capture line, as one message per call
+ * @param name - case name
+ * @param protocols - KFRAME_ bits to split by
+ * @param frame - capture line holding several frames
+ */
+void bench_split(const char *name, int protocols, const char *frame)
+{
+	klog_parse_text(frame,&msg);
+	view = passthru_view(&msg);
+	kframe_init(&splitter,protocols,100000,count_frame,NULL);
+	kframe_feed(&splitter,&view);
+	printf("%s: %lu frames, %lu bad checksums\n",name,splitter.frames,splitter.badChecksums);
+	run_bench(name,msg.DataSize,[] { kframe_feed(&splitter,&view); });
+}
+
+#define RING_FRAMES 1024	// klogger's ring
+#define READ_BATCH 16		// frames of one PassThruReadMsgs call
+
+PASSTHRU_MSG wide[RING_FRAMES];
+PASSTHRU_MSG rxmsgs[READ_BATCH];
+KMSG compact[RING_FRAMES];
+KMsgPool pool(RING_FRAMES,true);
+size_t slot;
+
+/** what the J2534 library does for each frame it reads */
+static void read_frame(PASSTHRU_MSG *m)
+{
+	m->ProtocolID = msg.ProtocolID;
+	m->RxStatus = msg.RxStatus;
+	m->Timestamp = msg.Timestamp;
+	m->DataSize = msg.DataSize;
+	m->ExtraDataIndex = msg.DataSize;
+	memcpy(m->Data,msg.Data,msg.DataSize);
+}
+
+/**
+ * @brief one frame read, through a klogger sized ring and into a text line.
+ * PASSTHRU_MSG slots are read in place, the ring is 4 MB and walks through
+ * the cache. KMSG slots are compacted from a batch of PASSTHRU_MSGs the
+ * frames are read into, the ring is 64 KB, and formatted where they lie.
+ * @param frame - capture line
+ */
+void bench_ring(const char *frame)
+{
+	klog_parse_text(frame,&msg);
+	size_t size = msg.DataSize;
+	run_bench("ring PASSTHRU_MSG slots",size,[] {
+		PASSTHRU_MSG *m = &wide[slot++ % RING_FRAMES];
+		read_frame(m);
+		KMSG_VIEW v = passthru_view(m);
+		sink += klog_format_text(outbuf,&v);
+	});
+	static unsigned char gather[PASSTHRU_MSG_DATA_SIZE];
+	run_bench("ring KMSG slots",size,[] {
+		PASSTHRU_MSG *m = &rxmsgs[slot % READ_BATCH];
+		read_frame(m);
+		KMSG *km = &compact[slot++ % RING_FRAMES];
+		kmsg_from_passthru(km,m,&pool);
+		KMSG_VIEW v = kmsg_view(km,gather);
+		sink += klog_format_text(outbuf,&v);
+		kmsg_release(km,&pool);
+	});
+}
+
+unsigned char zbuf[LZ_BOUND(OUTBUF_SIZE)];
+size_t blockLen;
+
+/** a 64 KB text block of tester-present traffic, as the /z writer sees it */
+void bench_lz()
+{
+	static const unsigned char tp[] = {0x80,0x58,0xF1,0x01,0x3E,0x08,0x80,0xF1,0x58,0x01,0x7E,0x48};
+	msg.DataSize = sizeof(tp);
+	memcpy(msg.Data,tp,sizeof(tp));
+	blockLen = 0;
+	for (unsigned long ts = 467573991UL; blockLen + KLOG_MAX_TEXT_LINE < LZB_BLOCK_SIZE; ts += 1839204)
+	{
+		msg.Timestamp = ts;
+		view = passthru_view(&msg);
+		blockLen += klog_format_text(outbuf + blockLen,&view);
+	}
+
+	size_t packed = lz_compress((unsigned char*)outbuf,blockLen,zbuf);
+	printf("lz block ratio %.1f:1\n",(double)blockLen / packed);
+	run_bench("lz_compress",blockLen,[] { sink += lz_compress((unsigned char*)outbuf,blockLen,zbuf); });
+	static unsigned char raw[OUTBUF_SIZE];
+	run_bench("lz_decompress",blockLen,[packed] { sink += lz_decompress(zbuf,packed,raw,sizeof(raw)); });
+}
+
+#if defined(__linux__)
+#define DISK_STALL_EVERY_MS 500	// slow disk: the reader stops this often
+#define DISK_STALL_MS 100		// for this long
+#define WRITE_EVERY_MS 1		// klogger flushing a block this often
+#define WRITE_BLOCK (16*1024)
+#define WRITE_SECONDS 2
+
+/**
+ * @brief write a block every WRITE_EVERY_MS into a pipe whose reader stalls
+ * like a disk that hiccups, print how long the write calls took
+ * @param uring - writer to use, NULL for plain write()
+ */
+void bench_writer(const char *name, UringWriter *uring)
+{
+	int fds[2];
+	if (pipe(fds))
+		return;
+	std::atomic<bool> done(false);
+	std::thread reader([&] {
+		static char buf[64 * 1024];
+		typedef std::chrono::steady_clock clk;
+		clk::time_point stall = clk::now() + std::chrono::milliseconds(DISK_STALL_EVERY_MS);
+		while (read(fds[0],buf,sizeof(buf)) > 0)
+			if (!done && clk::now() >= stall)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(DISK_STALL_MS));
+				stall = clk::now() + std::chrono::milliseconds(DISK_STALL_EVERY_MS);
+			}
+	});
+	if (uring)
+		uring->attach(fds[1]);
+
+	typedef std::chrono::steady_clock clk;
+	static char block[WRITE_BLOCK];
+	std::vector<double> us;
+	clk::time_point start = clk::now();
+	clk::time_point next = start;
+	while (next - start < std::chrono::seconds(WRITE_SECONDS))
+	{
+		std::this_thread::sleep_until(next);
+		clk::time_point t = clk::now();
+		if (uring)
+			uring->write(block,sizeof(block));
+		else
+		{
+			for (size_t off = 0; off < sizeof(block);)
+			{
+				ssize_t n = write(fds[1],block + off,sizeof(block) - off);
+				if (n <= 0)
+					break;
+				off += n;
+			}
+		}
+		us.push_back(std::chrono::duration<double,std::micro>(clk::now() - t).count());
+		next += std::chrono::milliseconds(WRITE_EVERY_MS);
+		if (clk::now() > next)
+			next = clk::now(); // fell behind, the capture ring would have filled
+	}
+	done = true;
+	if (uring)
+		uring->drain();
+	double seconds = std::chrono::duration<double>(clk::now() - start).count();
+	close(fds[1]);
+	reader.join();
+	close(fds[0]);
+
+	std::sort(us.begin(),us.end());
+	printf("%-36s %5lu writes %8.1f us p99 %8.1f us max %6.1f MB/s\n",name,(unsigned long)us.size(),
+		us[us.size() * 99 / 100],us.back(),us.size() * (double)WRITE_BLOCK / seconds / 1e6);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+	if (NULL == (fpnull = fopen(NULL_DEVICE,"wb")))
+	{
+		printf("can't open %s.\n",NULL_DEVICE);
+		return 1;
+	}
+
+	const char *frames[] = {TESTER_PRESENT,DTC_REPLY,ECU_INFO_REPLY,CRASH_DATA};
+	for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+	{
+		bench_hex(frames[i]);
+		printf("\n");
+	}
+	bench_honda(DTC_REPLY);
+	bench_honda(ECU_INFO_REPLY);
+	printf("\n");
+	bench_dtc();
+	printf("\n");
+	bench_split("kframe_feed kwp request+reply",KFRAME_KWP,TESTER_PRESENT_REPLY);
+	bench_split("kframe_feed kwp long reply",KFRAME_KWP,DTC_LIST_REPLY);
+	bench_split("kframe_feed honda request+reply",KFRAME_HONDA,ECU_INFO_REPLY);
+	bench_split("kframe_feed auto honda",KFRAME_KWP | KFRAME_HONDA,ECU_INFO_REPLY);
+	printf("\n");
+	bench_ring(TESTER_PRESENT_REPLY);
+	bench_ring(DTC_LIST_REPLY);
+	printf("\n");
+	bench_lz();
+#if defined(__linux__)
+	printf("\n");
+	bench_writer("slow disk write()",NULL);
+	UringWriter uring;
+	if (uring.init(false))
+	{
+		bench_writer("slow disk io_uring",&uring);
+		printf("io_uring: %llu writes, %lu waits for a free buffer\n",uring.submits(),uring.waits());
+	}
+	else
+		printf("io_uring not available\n");
+#endif
+
+	fclose(fpnull);
+	return 0;
+}
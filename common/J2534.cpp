@@ -1,11 +1,14 @@
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
-#include "j2534.h"
+#include <stdlib.h>
+#include <chrono>
+#include "J2534.h"
 #if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
 #else
 #include <dlfcn.h>
+#if defined(__APPLE__)
 #include <CoreFoundation/CFBundle.h>
+#endif
 #include <unistd.h>
 #endif
 
@@ -14,12 +17,19 @@ J2534::J2534(void)
 	hDLL = NULL;
 	debugMode = false;
 	isLibraryInitialized = false;
+	traceFile[0] = 0;
 	// default to the Openport 2.0 J2534 DLL
 #if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
 	strcpy(dllName,"op20pt32.dll");
-#else
+#elif defined(__APPLE__)
 	strcpy(dllName,"op20pt32.dylib");
+#else
+	strcpy(dllName,"op20pt32.so");
 #endif
+	// J2534_DLL points to another J2534 library, e.g. the replay stand-in
+	const char* env = getenv("J2534_DLL");
+	if (env && strlen(env) < sizeof(dllName))
+		strcpy(dllName,env);
 }
 
 void J2534::setDllName(const char* name)
@@ -37,8 +47,29 @@ bool J2534::valid()
 	return hDLL != NULL;
 }
 
+/**
+ * @brief record all library calls and save them to path when the wrapper is destroyed
+ * @return false if tracing isn't compiled in (J2534_TRACE)
+ */
+bool J2534::trace(const char* path)
+{
+#if defined(J2534_TRACE)
+	strncpy(traceFile,path,sizeof(traceFile) - 1);
+	traceFile[sizeof(traceFile) - 1] = 0;
+	debugMode = true;
+	return true;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
 J2534::~J2534(void)
 {
+#if defined(J2534_TRACE)
+	if (traceFile[0])
+		trace_save(traceFile);
+#endif
 #if defined(OP20PT32_USE_LIB)
 	if (hDLL)
 		::OP20PT32_Stop();
@@ -68,7 +99,59 @@ J2534::~J2534(void)
 #endif
 #endif
 
-#define DBGPRINT_BUFSIZE 10240
+// J2534_TRACE builds record every call, see trace.h. Otherwise the macros
+// are empty and nothing is evaluated.
+#if defined(J2534_TRACE)
+#define TRACE_START uint64_t traceStart = trace_clock()
+#define TRACE_IF(...) \
+	{ \
+		if (debugMode) \
+			__VA_ARGS__; \
+	}
+#else
+#define TRACE_START
+#define TRACE_IF(...)
+#endif
+#define TRACE(...) TRACE_IF(trace_record(__VA_ARGS__))
+
+// time one call into the library, only the library: tracing stays outside
+#define TIMED_CALL(slot,...) \
+	{ \
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now(); \
+		__VA_ARGS__; \
+		latency[slot].record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count()); \
+	}
+
+static const char* latencyNames[LAT_COUNT] =
+{
+	"PassThruOpen",
+	"PassThruClose",
+	"PassThruConnect",
+	"PassThruDisconnect",
+	"PassThruReadMsgs",
+	"PassThruWriteMsgs",
+	"PassThruStartPeriodicMsg",
+	"PassThruStopPeriodicMsg",
+	"PassThruStartMsgFilter",
+	"PassThruStopMsgFilter",
+	"PassThruSetProgrammingVoltage",
+	"PassThruReadVersion",
+	"PassThruGetLastError",
+	"Ioctl(GET_CONFIG)",
+	"Ioctl(SET_CONFIG)",
+	"Ioctl(FIVE_BAUD_INIT)",
+	"Ioctl(FAST_INIT)",
+	"Ioctl(APP_SERVICE)",
+	"Ioctl(other)"
+};
+
+/** print the call latency table, functions never called are left out */
+void J2534::dumpLatency(FILE* fp)
+{
+	LatencyHistogram::printHeader(fp);
+	for (int i = 0; i < LAT_COUNT; i++)
+		latency[i].print(fp,latencyNames[i]);
+}
 
 bool J2534::getPTfns()
 {
@@ -93,73 +176,6 @@ bool J2534::getPTfns()
 	return true;
 }
 
-void J2534::dbgprint(const char* Format, ...)
-{
-	va_list arglist;
-	int cb;
-	char buffer[DBGPRINT_BUFSIZE];
-	char *pbuf = buffer;
-
-	va_start(arglist, Format);
-
-	cb = vsprintf(pbuf, Format, arglist);
-
-	if (cb == -1)
-	{
-		buffer[sizeof(buffer) - 2] = '\n';
-		buffer[sizeof(buffer) - 1] = '\0';
-	}
-
-#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
-    OutputDebugStringA(buffer);
-#else
-    printf("%s",buffer);
-#endif
-	va_end(arglist);
-}
-
-#define MSG_READ 1
-#define MSG_WRITE 2
-
-void J2534::dbgdump(const unsigned char *data,unsigned int datalen,int kind)
-{
-	unsigned int i;
-	char buf[DBGPRINT_BUFSIZE];
-	char *pbuf = buf;
-
-	if (kind == MSG_READ)
-	{
-		*pbuf++ = 'R';
-		*pbuf++ = ' ';
-	}
-	else if (kind == MSG_WRITE)
-	{
-		*pbuf++ = 'W';
-		*pbuf++ = ' ';
-	}
-
-	for (i = 0; i < datalen; i++)
-	{
-		if (i > 15 && (i & 0xF) == 0)
-			pbuf += sprintf(pbuf,"\n   ");
-		pbuf += sprintf(pbuf,"%02X ",data[i]);
-	}
-	pbuf += sprintf(pbuf,"\n");
-	dbgprint(buf);
-}
-
-
-void J2534::dbgprintptmsg(const PASSTHRU_MSG *pMsg,int kind)
-{
-	if (!pMsg)
-	{
-		dbgprint("(null message)\n");
-		return;
-	}
-	dbgprint("ProtocolID=%u,RxStatus=%u,TxFlags=%u,Timestamp=%u,DataSize=%u,ExtraDataIndex=%u\n",pMsg->ProtocolID,pMsg->RxStatus,pMsg->TxFlags,pMsg->Timestamp,pMsg->DataSize,pMsg->ExtraDataIndex);
-	dbgdump(pMsg->Data,pMsg->DataSize,kind);
-}
-
 long J2534::LoadJ2534DLL(const char* szDLL)
 {
 #if defined(OP20PT32_USE_LIB)
@@ -175,10 +191,7 @@ long J2534::LoadJ2534DLL(const char* szDLL)
 #else
 
     if (szDLL == NULL)
-    {
-		DBGPRINT(("NULL string pointer to J2534 DLL location.\n"));
         return(1);
-    }
 
 #if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
 	if (!(hDLL = LoadLibraryA(szDLL)))
@@ -194,7 +207,7 @@ long J2534::LoadJ2534DLL(const char* szDLL)
 		strcpy(lastError,"error loading J2534 DLL function pointers");
 		return false;
 	}
-#else
+#elif defined(__APPLE__)
 	CFURLRef appUrlRef = CFBundleCopyBundleURL(CFBundleGetMainBundle());
 	CFStringRef macPath = CFURLCopyFileSystemPath(appUrlRef,
 										kCFURLPOSIXPathStyle);
@@ -208,7 +221,7 @@ long J2534::LoadJ2534DLL(const char* szDLL)
 	strcpy(libPath,pathPtr);
 	strcat(libPath,"/Contents/Frameworks");
 	chdir(libPath); // change to this dir so J2534 .dylib can find any other needed dylibs in the same dir
-	strcat(libPath,"/"");
+	strcat(libPath,"/");
 	strcat(libPath,szDLL);
 
 	CFRelease(appUrlRef);
@@ -231,9 +244,22 @@ long J2534::LoadJ2534DLL(const char* szDLL)
 		return false;
 	}
 	chdir(oldPath);
+#else
+	// plain name is searched on LD_LIBRARY_PATH, a path is used as is
+	if (!(hDLL = dlopen(szDLL, RTLD_LOCAL|RTLD_NOW)))
+	{
+		strcpy(lastError,"error loading ");
+		strncat(lastError,szDLL,sizeof(lastError) - 16);
+		return false;
+	}
+	else if (!getPTfns())
+	{
+		dlclose(hDLL);
+		hDLL = NULL;
+		strcpy(lastError,"error loading J2534 .so function pointers");
+		return false;
+	}
 #endif
-
-	DBGPRINT(("DLL loaded successfully\n"));
 #endif
 	return true;
 }
@@ -245,16 +271,19 @@ bool J2534::checkDLL()
 	return (hDLL != NULL);
 }
 
+// message size and bytes for a trace event, NULL safe
+#define MSG_SIZE(pMsg) ((pMsg) ? (pMsg)->DataSize : 0)
+#define MSG_DATA(pMsg) ((pMsg) ? (pMsg)->Data : NULL),MSG_SIZE(pMsg)
+#define OUT(p) ((p) ? *(p) : 0)
+
 long J2534::PassThruOpen(const void *pName, unsigned long *pDeviceID)
 {
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruOpen(name=%s,pDeviceID=@%08X)\n",(char*)pName,pDeviceID));
-
-	result = (*pfPassThruOpen)(pName,pDeviceID);
-	DBGPRINT(("PassThruOpen returned result %d and DeviceID %u\n",result,*pDeviceID));
-
+	TRACE_START;
+	TIMED_CALL(LAT_OPEN,result = (*pfPassThruOpen)(pName,pDeviceID));
+	TRACE(TRACE_OPEN,traceStart,result,OUT(pDeviceID),0,0,0,0,NULL,0);
 	return result;
 }
 
@@ -263,10 +292,9 @@ long J2534::PassThruClose(unsigned long DeviceID)
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruClose(%u)\n",DeviceID));
-	result = (*pfPassThruClose)(DeviceID);
-	DBGPRINT(("PassThruClose returned result %d\n",result));
-
+	TRACE_START;
+	TIMED_CALL(LAT_CLOSE,result = (*pfPassThruClose)(DeviceID));
+	TRACE(TRACE_CLOSE,traceStart,result,DeviceID,0,0,0,0,NULL,0);
 	return result;
 }
 
@@ -275,9 +303,9 @@ long J2534::PassThruConnect(unsigned long DeviceID, unsigned long ProtocolID, un
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruConnect(DeviceID=%u,ProtocolID=%u,Flags=%08X,Baudrate=%u,pChannelID=@%08X)\n",DeviceID,ProtocolID,Flags,Baudrate,pChannelID));
-	result = (*pfPassThruConnect)(DeviceID,ProtocolID,Flags,Baudrate,pChannelID);
-	DBGPRINT(("PassThruConnect returned result %d and ChannelID %u\n",result,*pChannelID));
+	TRACE_START;
+	TIMED_CALL(LAT_CONNECT,result = (*pfPassThruConnect)(DeviceID,ProtocolID,Flags,Baudrate,pChannelID));
+	TRACE(TRACE_CONNECT,traceStart,result,DeviceID,ProtocolID,Flags,Baudrate,OUT(pChannelID),NULL,0);
 	return result;
 }
 
@@ -286,9 +314,9 @@ long J2534::PassThruDisconnect(unsigned long ChannelID)
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruDisconnect(ChannelID=%u)\n",ChannelID));
-	result = (*pfPassThruDisconnect)(ChannelID);
-	DBGPRINT(("PassThruDisconnect returned result %d\n",result));
+	TRACE_START;
+	TIMED_CALL(LAT_DISCONNECT,result = (*pfPassThruDisconnect)(ChannelID));
+	TRACE(TRACE_DISCONNECT,traceStart,result,ChannelID,0,0,0,0,NULL,0);
 	return result;
 }
 
@@ -297,23 +325,29 @@ long J2534::PassThruReadMsgs(unsigned long ChannelID, PASSTHRU_MSG *pMsg, unsign
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruReadMsgs(ChannelID=%u,pMsg=@%08X,pNumMsgs=%u,Timeout=%u)\n",ChannelID,pMsg,*pNumMsgs,Timeout));
-	result = (*pfPassThruReadMsgs)(ChannelID,pMsg,pNumMsgs,Timeout);
-	DBGPRINT(("PassThruReadMsgs returned result %d\n",result));
+	TRACE_START;
+#if defined(J2534_TRACE)
+	unsigned long wanted = OUT(pNumMsgs);
+#endif
+	TIMED_CALL(LAT_READ_MSGS,result = (*pfPassThruReadMsgs)(ChannelID,pMsg,pNumMsgs,Timeout));
+#if defined(J2534_TRACE)
+	const PASSTHRU_MSG* first = OUT(pNumMsgs) ? pMsg : NULL; // nothing read, nothing to show
+	TRACE(TRACE_READ_MSGS,traceStart,result,ChannelID,wanted,Timeout,OUT(pNumMsgs),MSG_SIZE(first),MSG_DATA(first));
+#endif
 	return result;
 }
 
 long J2534::PassThruWriteMsgs(unsigned long ChannelID, const PASSTHRU_MSG *pMsg, unsigned long *pNumMsgs, unsigned long Timeout)
 {
-	unsigned int i;
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruWriteMsgs(ChannelID=%u,pMsg=@%08X,NumMsgs=%u,Timeout=%u)\n",ChannelID,pMsg,*pNumMsgs,Timeout));
-	result = (*pfPassThruWriteMsgs)(ChannelID,pMsg,pNumMsgs,Timeout);
-	for (i = 0; i < *pNumMsgs; i++)
-		DBGPRINTPT((&(pMsg[i]),MSG_WRITE));
-	DBGPRINT(("PassThruWriteMsgs returned result %d\n",result));
+	TRACE_START;
+#if defined(J2534_TRACE)
+	unsigned long wanted = OUT(pNumMsgs);
+#endif
+	TIMED_CALL(LAT_WRITE_MSGS,result = (*pfPassThruWriteMsgs)(ChannelID,pMsg,pNumMsgs,Timeout));
+	TRACE(TRACE_WRITE_MSGS,traceStart,result,ChannelID,wanted,Timeout,OUT(pNumMsgs),MSG_SIZE(pMsg),MSG_DATA(pMsg));
 	return result;
 }
 
@@ -322,10 +356,9 @@ long J2534::PassThruStartPeriodicMsg(unsigned long ChannelID, const PASSTHRU_MSG
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruStartPeriodicMsg(ChannelID=%u,pMsg=@%08X,pMsgID=@%08X,TimeInterval=%u)\n",ChannelID,pMsg,pMsgID,TimeInterval));
-	result = (*pfPassThruStartPeriodicMsg)(ChannelID,pMsg,pMsgID,TimeInterval);
-	DBGPRINTPT((pMsg,0));
-	DBGPRINT(("PassThruStartPeriodicMsg returned result %d and MsgID %u\n",result,*pMsgID));
+	TRACE_START;
+	TIMED_CALL(LAT_START_PERIODIC,result = (*pfPassThruStartPeriodicMsg)(ChannelID,pMsg,pMsgID,TimeInterval));
+	TRACE(TRACE_START_PERIODIC,traceStart,result,ChannelID,TimeInterval,OUT(pMsgID),MSG_SIZE(pMsg),0,MSG_DATA(pMsg));
 	return result;
 }
 
@@ -334,9 +367,9 @@ long J2534::PassThruStopPeriodicMsg(unsigned long ChannelID, unsigned long MsgID
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruStopPeriodicMsg(ChannelID=%u,MsgID=@%08X,TimeInterval=%u)\n",ChannelID,MsgID));
-	result = (*pfPassThruStopPeriodicMsg)(ChannelID,MsgID);
-	DBGPRINT(("PassThruStopPeriodicMsg returned result %d\n",result));
+	TRACE_START;
+	TIMED_CALL(LAT_STOP_PERIODIC,result = (*pfPassThruStopPeriodicMsg)(ChannelID,MsgID));
+	TRACE(TRACE_STOP_PERIODIC,traceStart,result,ChannelID,MsgID,0,0,0,NULL,0);
 	return result;
 }
 
@@ -347,16 +380,21 @@ long J2534::PassThruStartMsgFilter(unsigned long ChannelID,
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruStartMsgFilter(ChannelID=%u,FilterType=%u,pMaskMsg=@%08X,pPatternMsg=@%08X,pFlowControlMsg=@%08X,pMsgID=@%08X)\n",
-		ChannelID,FilterType,pMaskMsg,pPatternMsg,pFlowControlMsg,pMsgID));
-	DBGPRINT(("MaskMsg\n",result));
-	DBGPRINTPT((pMaskMsg,0));
-	DBGPRINT(("PatternMsg\n",result));
-	DBGPRINTPT((pPatternMsg,0));
-	DBGPRINT(("FlowControlMsg\n",result));
-	DBGPRINTPT((pFlowControlMsg,0));
-	result = (*pfPassThruStartMsgFilter)(ChannelID,FilterType,pMaskMsg,pPatternMsg,pFlowControlMsg,pMsgID);
-	DBGPRINT(("PassThruStartMsgFilter returned result %d and MsgID %u\n",result,*pMsgID));
+	TRACE_START;
+	TIMED_CALL(LAT_START_FILTER,result = (*pfPassThruStartMsgFilter)(ChannelID,FilterType,pMaskMsg,pPatternMsg,pFlowControlMsg,pMsgID));
+#if defined(J2534_TRACE)
+	// mask and pattern side by side, 12 bytes each at most
+	unsigned char mp[TRACE_DATA];
+	unsigned long half = MSG_SIZE(pMaskMsg) < TRACE_DATA / 2 ? MSG_SIZE(pMaskMsg) : TRACE_DATA / 2;
+	if (pMaskMsg && pPatternMsg)
+	{
+		memcpy(mp,pMaskMsg->Data,half);
+		memcpy(mp + half,pPatternMsg->Data,half);
+	}
+	else
+		half = 0;
+	TRACE(TRACE_START_FILTER,traceStart,result,ChannelID,FilterType,OUT(pMsgID),MSG_SIZE(pMaskMsg),0,mp,half * 2);
+#endif
 	return result;
 }
 
@@ -365,9 +403,9 @@ long J2534::PassThruStopMsgFilter(unsigned long ChannelID, unsigned long MsgID)
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruStopMsgFilter(ChannelID=%u,MsgID=@%08X,TimeInterval=%u)\n",ChannelID,MsgID));
-	result = (*pfPassThruStopMsgFilter)(ChannelID,MsgID);
-	DBGPRINT(("PassThruStopMsgFilter returned result %d\n",result));
+	TRACE_START;
+	TIMED_CALL(LAT_STOP_FILTER,result = (*pfPassThruStopMsgFilter)(ChannelID,MsgID));
+	TRACE(TRACE_STOP_FILTER,traceStart,result,ChannelID,MsgID,0,0,0,NULL,0);
 	return result;
 }
 
@@ -376,9 +414,9 @@ long J2534::PassThruSetProgrammingVoltage(unsigned long DeviceID, unsigned long
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruSetProgrammingVoltage(DeviceID=%u,Pin=%u,Voltage=%u)\n",DeviceID,Pin,Voltage));
-	result = (*pfPassThruSetProgrammingVoltage)(DeviceID,Pin,Voltage);
-	DBGPRINT(("PassThruSetProgrammingVoltage returned result %d\n",result));
+	TRACE_START;
+	TIMED_CALL(LAT_SET_VOLTAGE,result = (*pfPassThruSetProgrammingVoltage)(DeviceID,Pin,Voltage));
+	TRACE(TRACE_SET_VOLTAGE,traceStart,result,DeviceID,Pin,Voltage,0,0,NULL,0);
 	return result;
 }
 
@@ -387,9 +425,9 @@ long J2534::PassThruReadVersion(char *pApiVersion,char *pDllVersion,char *pFirmw
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruReadVersion(DeviceID=%u,pFirmwareVersion=@%08X,pDllVersion=@%08X,pApiVersion=@%08X)\n",DeviceID,pFirmwareVersion,pDllVersion,pApiVersion));
-	result = (*pfPassThruReadVersion)(DeviceID,pFirmwareVersion,pDllVersion,pApiVersion);
-	DBGPRINT(("PassThruReadVersion returned result %d and FirmwareVersion [%s], DllVersion [%s], ApiVersion [%s]\n",result,pFirmwareVersion,pDllVersion,pApiVersion));
+	TRACE_START;
+	TIMED_CALL(LAT_READ_VERSION,result = (*pfPassThruReadVersion)(DeviceID,pFirmwareVersion,pDllVersion,pApiVersion));
+	TRACE(TRACE_READ_VERSION,traceStart,result,DeviceID,0,0,0,0,NULL,0);
 	return result;
 }
 
@@ -398,9 +436,9 @@ long J2534::PassThruGetLastError(char *pErrorDescription)
 	long result = STATUS_NOERROR;
 	if (!checkDLL())
 		return ERR_DEVICE_NOT_CONNECTED;
-	DBGPRINT(("PassThruGetLastError(pErrorDescription=@%08X\n",pErrorDescription));
-	result = (*pfPassThruGetLastError)(pErrorDescription);
-	DBGPRINT(("PassThruGetLastError returned result %d and ErrorDescription [%s]\n",result,pErrorDescription));
+	TRACE_START;
+	TIMED_CALL(LAT_GET_LAST_ERROR,result = (*pfPassThruGetLastError)(pErrorDescription));
+	TRACE(TRACE_GET_LAST_ERROR,traceStart,result,0,0,0,0,0,NULL,0);
 	return result;
 }
 
@@ -419,269 +457,106 @@ int J2534::is_valid_sconfig_param(SCONFIG s)
 	}
 }
 
-void J2534::dump_sbyte_array(const SBYTE_ARRAY* s)
+#if defined(J2534_TRACE)
+/** record an ioctl with what matters for its kind, names are only looked up by trace_print() */
+void J2534::traceIoctl(uint64_t start, long result, unsigned long ChannelID, unsigned long IoctlID, const void *pInput, const void *pOutput, bool faked)
 {
-	DBGPRINT(("SBYTE_ARRAY size=%u\n",s->NumOfBytes));
-	DBGDUMP((s->BytePtr,s->NumOfBytes,0));
-}
-
-void J2534::dump_sconfig_param(SCONFIG s)
-{
-	char paramName[128];
+	unsigned char data[TRACE_DATA];
+	size_t len = 0;
+	unsigned long a2 = 0, a3 = 0;
 
-	switch (s.Parameter)
+	switch (IoctlID)
 	{
-	case DATA_RATE:
-		strcpy(paramName,"DATA_RATE");
-		break;
-	case LOOPBACK:
-		strcpy(paramName,"LOOPBACK");
-		break;
-	case NODE_ADDRESS:
-		strcpy(paramName,"NODE_ADDRESS");
-		break;
-	case NETWORK_LINE:
-		strcpy(paramName,"NETWORK_LINE");
-		break;
-	case P1_MIN:
-		strcpy(paramName,"P1_MIN");
-		break;
-	case P1_MAX:
-		strcpy(paramName,"P1_MAX");
-		break;
-	case P2_MIN:
-		strcpy(paramName,"P2_MIN");
-		break;
-	case P2_MAX:
-		strcpy(paramName,"P2_MAX");
-		break;
-	case P3_MIN:
-		strcpy(paramName,"P3_MIN");
-		break;
-	case P3_MAX:
-		strcpy(paramName,"P3_MAX");
-		break;
-	case P4_MIN:
-		strcpy(paramName,"P4_MIN");
-		break;
-	case P4_MAX:
-		strcpy(paramName,"P4_MAX");
-		break;
-	case W1:
-		strcpy(paramName,"W1");
-		break;
-	case W2:
-		strcpy(paramName,"W2");
-		break;
-	case W3:
-		strcpy(paramName,"W3");
-		break;
-	case W4:
-		strcpy(paramName,"W4");
-		break;
-	case W5:
-		strcpy(paramName,"W5");
-		break;
-	case TIDLE:
-		strcpy(paramName,"TIDLE");
-		break;
-	case TINIL:
-		strcpy(paramName,"TINIL");
-		break;
-	case TWUP:
-		strcpy(paramName,"TWUP");
-		break;
-	case PARITY:
-		strcpy(paramName,"PARITY");
-		break;
-	case BIT_SAMPLE_POINT:
-		strcpy(paramName,"BIT_SAMPLE_POINT");
-		break;
-	case SYNC_JUMP_WIDTH:
-		strcpy(paramName,"SYNC_JUMP_WIDTH");
-		break;
-	case W0:
-		strcpy(paramName,"W0");
-		break;
-	case T1_MAX:
-		strcpy(paramName,"T1_MAX");
-		break;
-	case T2_MAX:
-		strcpy(paramName,"T2_MAX");
-		break;
-	case T4_MAX:
-		strcpy(paramName,"T4_MAX");
-		break;
-	case T5_MAX:
-		strcpy(paramName,"T5_MAX");
-		break;
-	case ISO15765_BS:
-		strcpy(paramName,"ISO15765_BS");
-		break;
-	case ISO15765_STMIN:
-		strcpy(paramName,"ISO15765_STMIN");
-		break;
-	case DATA_BITS:
-		strcpy(paramName,"DATA_BITS");
-		break;
-	case FIVE_BAUD_MOD:
-		strcpy(paramName,"FIVE_BAUD_MOD");
-		break;
-	case BS_TX:
-		strcpy(paramName,"BS_TX");
-		break;
-	case STMIN_TX:
-		strcpy(paramName,"STMIN_TX");
-		break;
-	case T3_MAX:
-		strcpy(paramName,"T3_MAX");
-		break;
-	case ISO15765_WFT_MAX:
-		strcpy(paramName,"ISO15765_WFT_MAX");
-		break;
-	case CAN_MIXED_FORMAT:
-		strcpy(paramName,"CAN_MIXED_FORMAT");
-		break;
-	case J1962_PINS:
-		strcpy(paramName,"J1962_PINS");
-		break;
-	case SW_CAN_HS_DATA_RATE:
-		strcpy(paramName,"W_CAN_HS_DATA_RATE");
-		break;
-	case SW_CAN_SPEEDCHANGE_ENABLE:
-		strcpy(paramName,"SW_CAN_SPEEDCHANGE_ENABLE");
-		break;
-	case SW_CAN_RES_SWITCH:
-		strcpy(paramName,"SW_CAN_RES_SWITCH");
-		break;
-	case ACTIVE_CHANNELS:
-		strcpy(paramName,"ACTIVE_CHANNELS");
-		break;
-	case SAMPLE_RATE:
-		strcpy(paramName,"SAMPLE_RATE");
-		break;
-	case SAMPLES_PER_READING:
-		strcpy(paramName,"SAMPLES_PER_READING");
-		break;
-	case READINGS_PER_MSG:
-		strcpy(paramName,"READINGS_PER_MSG");
-		break;
-	case AVERAGING_METHOD:
-		strcpy(paramName,"AVERAGING_METHOD");
-		break;
-	case SAMPLE_RESOLUTION:
-		strcpy(paramName,"SAMPLE_RESOLUTION");
+	case GET_CONFIG:
+	case SET_CONFIG:
+	{
+		const SCONFIG_LIST* scl = (const SCONFIG_LIST*)pInput;
+		a2 = scl ? scl->NumOfParams : 0;
+		a3 = faked;
+		for (unsigned long i = 0; i < a2 && len + 8 <= TRACE_DATA; i++, len += 8)
+		{
+			uint32_t p = (uint32_t)scl->ConfigPtr[i].Parameter;
+			uint32_t v = (uint32_t)scl->ConfigPtr[i].Value;
+			memcpy(data + len,&p,4);
+			memcpy(data + len + 4,&v,4);
+		}
 		break;
-	case INPUT_RANGE_LOW:
-		strcpy(paramName,"INPUT_RANGE_LOW");
+	}
+	case FAST_INIT:
+	{
+		const PASSTHRU_MSG* in = (const PASSTHRU_MSG*)pInput;
+		const PASSTHRU_MSG* out = (const PASSTHRU_MSG*)pOutput;
+		a2 = MSG_SIZE(in);
+		a3 = MSG_SIZE(out);
+		len = a2 < TRACE_DATA ? a2 : TRACE_DATA;
+		if (len)
+			memcpy(data,in->Data,len);
 		break;
-	case INPUT_RANGE_HIGH:
-		strcpy(paramName,"INPUT_RANGE_HIGH");
+	}
+	case FIVE_BAUD_INIT:
+	{
+		const SBYTE_ARRAY* in = (const SBYTE_ARRAY*)pInput;
+		const SBYTE_ARRAY* out = (const SBYTE_ARRAY*)pOutput;
+		a2 = in ? in->NumOfBytes : 0;
+		a3 = out ? out->NumOfBytes : 0;
+		len = a2 < TRACE_DATA ? a2 : TRACE_DATA;
+		if (len)
+			memcpy(data,in->BytePtr,len);
 		break;
-	default:
-        sprintf(paramName,"%lu(unknown)",s.Parameter);
+	}
+	case READ_VBATT:
+		a2 = pOutput ? *(const unsigned long*)pOutput : 0;
 		break;
 	}
-
-	DBGPRINT(("    %s : %u",paramName,s.Value));
+	trace_record(TRACE_IOCTL,start,result,ChannelID,IoctlID,a2,a3,0,data,len);
 }
+#endif
 
 long J2534::PassThruIoctl(unsigned long ChannelID, unsigned long IoctlID, const void *pInput, void *pOutput)
 {
-	int input_as_sa = 0;
-	int output_as_sa = 0;
 	unsigned int i;
 	SCONFIG_LIST* scl;
 	long result = STATUS_NOERROR;
-	char IoctlName[128];
+	int slot = LAT_IOCTL_OTHER;
 
-    if (!checkDLL())
-        return ERR_DEVICE_NOT_CONNECTED;
+	if (!checkDLL())
+		return ERR_DEVICE_NOT_CONNECTED;
+	TRACE_START;
 
 	switch (IoctlID)
 	{
 	case GET_CONFIG:
-		strcpy(IoctlName,"GET_CONFIG");
+		slot = LAT_IOCTL_GET_CONFIG;
 		break;
 	case SET_CONFIG:
-		strcpy(IoctlName,"SET_CONFIG");
-		break;
-	case READ_VBATT:
-		strcpy(IoctlName,"READ_VBATT");
+		slot = LAT_IOCTL_SET_CONFIG;
 		break;
 	case FIVE_BAUD_INIT:
-		strcpy(IoctlName,"FIVE_BAUD_INIT");
-		input_as_sa = 1;
-		output_as_sa = 1;
+		slot = LAT_IOCTL_FIVE_BAUD_INIT;
 		break;
 	case FAST_INIT:
-		strcpy(IoctlName,"FAST_INIT");
-		break;
-	case CLEAR_TX_BUFFER:
-		strcpy(IoctlName,"CLEAR_TX_BUFFER");
-		break;
-	case CLEAR_RX_BUFFER:
-		strcpy(IoctlName,"CLEAR_RX_BUFFER");
-		break;
-	case CLEAR_PERIODIC_MSGS:
-		strcpy(IoctlName,"CLEAR_PERIODIC_MSGS");
-		break;
-	case CLEAR_MSG_FILTERS:
-		strcpy(IoctlName,"CLEAR_MSG_FILTERS");
-		break;
-	case CLEAR_FUNCT_MSG_LOOKUP_TABLE:
-		strcpy(IoctlName,"CLEAR_FUNCT_MSG_LOOKUP_TABLE");
-		break;
-	case ADD_TO_FUNCT_MSG_LOOKUP_TABLE:
-		strcpy(IoctlName,"ADD_TO_FUNCT_MSG_LOOKUP_TABLE");
-		break;
-	case DELETE_FROM_FUNCT_MSG_LOOKUP_TABLE:
-		strcpy(IoctlName,"DELETE_FROM_FUNCT_MSG_LOOKUP_TABLE");
-		break;
-	case READ_PROG_VOLTAGE:
-		strcpy(IoctlName,"READ_PROG_VOLTAGE");
+		slot = LAT_IOCTL_FAST_INIT;
 		break;
 	case TX_IOCTL_APP_SERVICE:
-		strcpy(IoctlName,"APP_SERVICE");
-		break;
-	default:
-        sprintf(IoctlName,"%lu(unknown)",IoctlID);
+		slot = LAT_IOCTL_APP_SERVICE;
 		break;
 	}
 
-    DBGPRINT(("PassThruIoctl(ChannelID=%u,Ioctl=%s,pInput=@%08X,pOutputMsgID=@%08X)\n",ChannelID,IoctlName,pInput,pOutput));
-
 	if (IoctlID == SET_CONFIG)
 	{
 		pOutput = NULL; // make some DLLs happy
 
-		// dump params
 		scl = (SCONFIG_LIST*)pInput;
-		for (i = 0; i < scl->NumOfParams; i++)
-			dump_sconfig_param((scl->ConfigPtr)[i]);
-
 		for (i = 0; i < scl->NumOfParams; i++)
 			if (!is_valid_sconfig_param((scl->ConfigPtr)[i]))
 			{
-				DBGPRINT(("param not allowed - not passing through and instead faking success\n",result));
+				// param not allowed - not passing through and instead faking success
+				TRACE_IF(traceIoctl(traceStart,STATUS_NOERROR,ChannelID,IoctlID,pInput,pOutput,true));
 				return STATUS_NOERROR;
 			}
 	}
 
-	if (input_as_sa)
-	{
-		DBGPRINT(("Input\n"));
-		dump_sbyte_array((SBYTE_ARRAY*)pInput);
-	}
-
-	result = (*pfPassThruIoctl)(ChannelID,IoctlID,pInput,pOutput);
-
-	if (output_as_sa)
-	{
-		DBGPRINT(("Output\n"));
-		dump_sbyte_array((SBYTE_ARRAY*)pOutput);
-	}
-
-	DBGPRINT(("PassThruIoctl returned result %d\n",result));
+	TIMED_CALL(slot,result = (*pfPassThruIoctl)(ChannelID,IoctlID,pInput,pOutput));
+	TRACE_IF(traceIoctl(traceStart,result,ChannelID,IoctlID,pInput,pOutput,false));
 	return result;
 }
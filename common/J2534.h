@@ -13,28 +13,38 @@
 #include <windows.h>
 #endif
 
+#include <stdio.h>
 #include "j2534_tactrix.h"
+#include "latency.h"
+#include "trace.h"
 
 #define PTfn(name) PF_##name* pf##name
 #define PText(name) PT_API PF_##name name
 
-#define DBGPRINT(args_in_parens)                                \
-    {                                               \
-		if (debugMode)	\
-			dbgprint args_in_parens; \
-    }
-
-#define DBGDUMP(args_in_parens)                                \
-    {                                               \
-		if (debugMode)	\
-			dbgdump args_in_parens; \
-    }
-
-#define DBGPRINTPT(args_in_parens)                                \
-    {                                               \
-		if (debugMode)	\
-			dbgprintptmsg args_in_parens; \
-    }
+/** latency histogram per API function, ioctls that matter for timing get their own */
+enum
+{
+	LAT_OPEN,
+	LAT_CLOSE,
+	LAT_CONNECT,
+	LAT_DISCONNECT,
+	LAT_READ_MSGS,
+	LAT_WRITE_MSGS,
+	LAT_START_PERIODIC,
+	LAT_STOP_PERIODIC,
+	LAT_START_FILTER,
+	LAT_STOP_FILTER,
+	LAT_SET_VOLTAGE,
+	LAT_READ_VERSION,
+	LAT_GET_LAST_ERROR,
+	LAT_IOCTL_GET_CONFIG,
+	LAT_IOCTL_SET_CONFIG,
+	LAT_IOCTL_FIVE_BAUD_INIT,
+	LAT_IOCTL_FAST_INIT,
+	LAT_IOCTL_APP_SERVICE,
+	LAT_IOCTL_OTHER,
+	LAT_COUNT
+};
 
 class J2534
 {
@@ -45,7 +55,9 @@ public:
 	void setDllName(const char* name);
 	bool valid();
 	void debug(bool enable) { debugMode = enable; };
+	bool trace(const char* path);
 	char* getLastError();
+	void dumpLatency(FILE* fp);
 
     long PassThruOpen(const void *pName, unsigned long *pDeviceID);
 	long PassThruClose(unsigned long DeviceID);
@@ -69,15 +81,15 @@ private:
 	bool getPTfns();
     long LoadJ2534DLL(const char* szDLL);
 	bool checkDLL();
-    void dbgprint(const char* Format, ...);
-    void dbgdump(const unsigned char *data,unsigned int datalen,int kind);
-    void dbgprintptmsg(const PASSTHRU_MSG *pMsg,int kind);
 	int is_valid_sconfig_param(SCONFIG s);
-    void dump_sbyte_array(const SBYTE_ARRAY* s);
-	void dump_sconfig_param(SCONFIG s);
+#if defined(J2534_TRACE)
+	void traceIoctl(uint64_t start, long result, unsigned long ChannelID, unsigned long IoctlID, const void *pInput, const void *pOutput, bool faked);
+#endif
 
 	char lastError[256];
 	char dllName[256];
+	char traceFile[256];		// trace saved here on destruction, empty - not tracing
+	LatencyHistogram latency[LAT_COUNT];	// time spent inside the library, always on
 	bool debugMode;
 	bool isLibraryInitialized;
 
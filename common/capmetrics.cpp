@@ -0,0 +1,107 @@
+#include <math.h>
+#include <string.h>
+#include "capmetrics.h"
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#include <windows.h>
+
+static bool replace_file(const char* from, const char* to)
+{
+	return MoveFileExA(from,to,MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+static bool replace_file(const char* from, const char* to)
+{
+	return rename(from,to) == 0;
+}
+#endif
+
+/** count one silence between messages, any thread */
+void counters_gap(CAPTURE_COUNTERS* c, unsigned long long gapUs)
+{
+	int k = gap_bin(gapUs < GAP_IDLE_US * 4 ? (unsigned long)gapUs : GAP_IDLE_US * 4); // last bin
+	c->gaps[k].fetch_add(1,std::memory_order_relaxed);
+	c->gapCount.fetch_add(1,std::memory_order_relaxed);
+	c->gapSumUs.fetch_add(gapUs,std::memory_order_relaxed);
+}
+
+/**
+ * @brief take a snapshot and recompute the rates over the window
+ * @param seconds - time of the snapshot, from any fixed point
+ */
+void window_update(RATE_WINDOW* w, const CAPTURE_COUNTERS* c, double seconds)
+{
+	COUNTER_SNAPSHOT* now = &w->snaps[w->next];
+	now->seconds = seconds;
+	now->messages = c->messages.load(std::memory_order_relaxed);
+	now->bytes = c->bytes.load(std::memory_order_relaxed);
+	for (int k = 0; k < GAP_BINS; k++)
+		now->gaps[k] = c->gaps[k].load(std::memory_order_relaxed);
+	w->next = (w->next + 1) % (METRIC_WINDOW + 1);
+	if (w->count < METRIC_WINDOW + 1)
+		w->count++;
+
+	// the oldest snapshot is the one overwritten next
+	const COUNTER_SNAPSHOT* old = &w->snaps[w->count <= METRIC_WINDOW ? 0 : w->next];
+	double dt = now->seconds - old->seconds;
+	w->msgRate = dt > 0 ? (now->messages - old->messages) / dt : 0;
+	w->byteRate = dt > 0 ? (now->bytes - old->bytes) / dt : 0;
+	w->gapCount = 0;
+	for (int k = 0; k < GAP_BINS; k++)
+		w->gapCount += w->gaps[k] = now->gaps[k] - old->gaps[k];
+}
+
+/** @return upper edge of the bin percent of the window's silences fall below, s, NAN if none */
+double window_gap_percentile(const RATE_WINDOW* w, int percent)
+{
+	if (!w->gapCount)
+		return NAN;
+	return gap_percentile(w->gaps,w->gapCount,percent) / 1e6;
+}
+
+/**
+ * @brief start writing metrics to path.tmp
+ * @return false if it can't be created
+ */
+bool prom_begin(PROM_FILE* pf, const char* path)
+{
+	if (strlen(path) >= sizeof(pf->path))
+		return false;
+	strcpy(pf->path,path);
+	sprintf(pf->tmpPath,"%s.tmp",path);
+	pf->f = fopen(pf->tmpPath,"w");
+	return pf->f != NULL;
+}
+
+/** HELP and TYPE lines, before the values of a metric */
+void prom_family(PROM_FILE* pf, const char* name, const char* type, const char* help)
+{
+	fprintf(pf->f,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+
+/**
+ * @brief one value of a metric
+ * @param labels - e.g. channel="K", may be NULL
+ */
+void prom_value(PROM_FILE* pf, const char* name, const char* labels, double value)
+{
+	fprintf(pf->f,"%s",name);
+	if (labels && *labels)
+		fprintf(pf->f,"{%s}",labels);
+	if (isnan(value))
+		fprintf(pf->f," NaN\n");
+	else
+		fprintf(pf->f," %.15g\n",value);
+}
+
+/** @return false if the file couldn't be written or put in place */
+bool prom_end(PROM_FILE* pf)
+{
+	bool ok = !ferror(pf->f);
+	ok = fclose(pf->f) == 0 && ok;
+	pf->f = NULL;
+	if (ok && replace_file(pf->tmpPath,pf->path))
+		return true;
+	remove(pf->tmpPath);
+	return false;
+}
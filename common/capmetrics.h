@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include "gaplearn.h"
+
+/*
+CAPTURE METRICS
+
+    The capture and writer threads count into CAPTURE_COUNTERS with relaxed
+    atomic adds; nothing is locked or formatted on their side. Silences
+    between messages go into a histogram laid out like the timeout learner's
+    (GAP_BINS_PER_OCTAVE bins per octave from GAP_MIN_US).
+
+    Once a second the thread writing the metrics takes a snapshot of every
+    channel. Rates and gap percentiles are taken over the last METRIC_WINDOW
+    seconds of snapshots; the totals are exported as they are.
+
+    Metrics are written in the Prometheus text format, for node_exporter's
+    textfile collector. The file is written under a temporary name and
+    renamed over the old one, so the collector never reads half a file.
+*/
+
+#define METRIC_WINDOW 10	// seconds rates and percentiles are taken over
+
+/** counters of one channel, shared between threads */
+typedef struct
+{
+	std::atomic<unsigned long long> messages;
+	std::atomic<unsigned long long> bytes;
+	std::atomic<unsigned long long> frames;			// out of the /s splitter
+	std::atomic<unsigned long long> badChecksums;	// of those frames
+	std::atomic<unsigned long long> gapCount;
+	std::atomic<unsigned long long> gapSumUs;
+	std::atomic<unsigned long> gaps[GAP_BINS];
+} CAPTURE_COUNTERS;
+
+/** counters at one point in time */
+typedef struct
+{
+	double seconds;
+	unsigned long long messages;
+	unsigned long long bytes;
+	unsigned long gaps[GAP_BINS];
+} COUNTER_SNAPSHOT;
+
+/** last METRIC_WINDOW seconds of one channel, owned by the metrics thread */
+typedef struct
+{
+	COUNTER_SNAPSHOT snaps[METRIC_WINDOW + 1];
+	unsigned int count;		// snapshots taken, up to METRIC_WINDOW + 1
+	unsigned int next;		// slot of the next snapshot
+	double msgRate;			// per second over the window
+	double byteRate;
+	unsigned long gaps[GAP_BINS];	// silences within the window
+	unsigned long gapCount;
+} RATE_WINDOW;
+
+/** file being written in the Prometheus text format */
+typedef struct
+{
+	FILE* f;
+	char path[1024];
+	char tmpPath[1100];
+} PROM_FILE;
+
+void counters_gap(CAPTURE_COUNTERS* c, unsigned long long gapUs);
+void window_update(RATE_WINDOW* w, const CAPTURE_COUNTERS* c, double seconds);
+double window_gap_percentile(const RATE_WINDOW* w, int percent);
+
+bool prom_begin(PROM_FILE* pf, const char* path);
+void prom_family(PROM_FILE* pf, const char* name, const char* type, const char* help);
+void prom_value(PROM_FILE* pf, const char* name, const char* labels, double value);
+bool prom_end(PROM_FILE* pf);
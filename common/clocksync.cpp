@@ -0,0 +1,145 @@
+#include "clocksync.h"
+
+#define WRAP 0x100000000ULL
+
+ClockSync::ClockSync()
+{
+	started = false;
+	lastDevice = 0;
+	lastHost = 0;
+	numPoints = 0;
+	nextPoint = 0;
+	windowValid = false;
+	windowStart = 0;
+	a = 0;
+	b = 0;
+	ref = 0;
+}
+
+/**
+ * @brief unwrap a device timestamp
+ * @param timestamp - PASSTHRU_MSG Timestamp, us, wraps every 71 minutes
+ * @param hostUs - host time the message was read at
+ * @return device time in us, 64 bits; the first timestamp is taken as is
+ */
+unsigned long long ClockSync::extend(unsigned long timestamp, unsigned long long hostUs)
+{
+	std::lock_guard<std::mutex> lk(lock);
+	timestamp &= 0xFFFFFFFFUL;
+	if (!started)
+	{
+		started = true;
+		lastDevice = timestamp;
+		lastHost = hostUs;
+		return timestamp;
+	}
+	// the device clock runs along with the host clock, pick the wrap that
+	// puts the timestamp closest to where the device clock should be now
+	unsigned long long predicted = lastDevice + (hostUs > lastHost ? hostUs - lastHost : 0);
+	unsigned long long v = (predicted & ~(WRAP - 1)) | timestamp;
+	if (v + WRAP / 2 < predicted)
+		v += WRAP;
+	else if (v > predicted + WRAP / 2 && v >= WRAP)
+		v -= WRAP;
+	if (v > lastDevice)
+	{
+		lastDevice = v;
+		lastHost = hostUs;
+	}
+	return v;
+}
+
+/**
+ * @brief add one device / host time pair
+ * @param deviceUs - extended timestamp of a message
+ * @param hostUs - host time the read that returned it completed
+ */
+void ClockSync::sample(unsigned long long deviceUs, unsigned long long hostUs)
+{
+	std::lock_guard<std::mutex> lk(lock);
+	Point p = {(double)deviceUs,(double)hostUs - (double)deviceUs};
+	if (windowValid && hostUs - windowStart >= SYNC_WINDOW_US)
+	{
+		points[nextPoint] = windowMin;
+		nextPoint = (nextPoint + 1) % SYNC_POINTS;
+		if (numPoints < SYNC_POINTS)
+			numPoints++;
+		windowValid = false;
+	}
+	if (!windowValid)
+	{
+		windowMin = p;
+		windowStart = hostUs;
+		windowValid = true;
+	}
+	else if (p.offset < windowMin.offset)
+		windowMin = p;
+	fit();
+}
+
+/** least squares line through the window minima, offset only until they span a second */
+void ClockSync::fit()
+{
+	unsigned int n = numPoints;
+	Point pts[SYNC_POINTS + 1];
+	for (unsigned int i = 0; i < numPoints; i++)
+		pts[i] = points[i];
+	if (windowValid)
+		pts[n++] = windowMin;
+	if (!n)
+		return;
+
+	double sumDevice = 0, sumOffset = 0;
+	double minDevice = pts[0].device, maxDevice = pts[0].device;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		sumDevice += pts[i].device;
+		sumOffset += pts[i].offset;
+		if (pts[i].device < minDevice)
+			minDevice = pts[i].device;
+		if (pts[i].device > maxDevice)
+			maxDevice = pts[i].device;
+	}
+	ref = sumDevice / n;
+	if (n < 2 || maxDevice - minDevice < 1e6)
+	{
+		// too short for a drift, the smallest offset is the best guess
+		a = pts[0].offset;
+		for (unsigned int i = 1; i < n; i++)
+			if (pts[i].offset < a)
+				a = pts[i].offset;
+		b = 0;
+		return;
+	}
+	double sxx = 0, sxy = 0;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		double dx = pts[i].device - ref;
+		sxx += dx * dx;
+		sxy += dx * (pts[i].offset - sumOffset / n);
+	}
+	b = sxy / sxx;
+	a = sumOffset / n;
+}
+
+/** @return host time of a device time, us */
+long long ClockSync::toHost(unsigned long long deviceUs)
+{
+	std::lock_guard<std::mutex> lk(lock);
+	double d = (double)deviceUs;
+	return (long long)(d + a + b * (d - ref));
+}
+
+/** @return host - device at the youngest sample, us */
+double ClockSync::offset()
+{
+	std::lock_guard<std::mutex> lk(lock);
+	return a + b * ((double)lastDevice - ref);
+}
+
+/** @return how much faster the host clock runs than the device clock, ppm */
+double ClockSync::drift()
+{
+	std::lock_guard<std::mutex> lk(lock);
+	return b * 1e6;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <mutex>
+
+#define SYNC_WINDOW_US 2000000ULL	// host time covered by one offset minimum
+#define SYNC_POINTS 30				// window minima the drift is fitted over
+
+/**
+ * @brief maps a device's 32-bit microsecond timestamps onto the host clock
+ * @remark extend() unwraps device timestamps to 64 bits, guided by the host
+ * clock so that wraps are found even after a long quiet spell. sample()
+ * pairs a device timestamp with the host time it was read at; the smallest
+ * host - device difference in each window is the one with the least read
+ * latency, and a line fitted through the recent minima gives offset and
+ * drift. All members may be called from several threads.
+ */
+class ClockSync
+{
+public:
+	ClockSync();
+	unsigned long long extend(unsigned long timestamp, unsigned long long hostUs);
+	void sample(unsigned long long deviceUs, unsigned long long hostUs);
+	long long toHost(unsigned long long deviceUs);
+	double offset();
+	double drift();
+
+private:
+	ClockSync(const ClockSync&);
+	ClockSync& operator=(const ClockSync&);
+	void fit();
+
+	std::mutex lock;
+	bool started;
+	unsigned long long lastDevice;	// youngest extended timestamp
+	unsigned long long lastHost;	// host time it was read at
+
+	struct Point
+	{
+		double device;
+		double offset;	// host - device, us
+	};
+	Point points[SYNC_POINTS];		// minima of past windows, oldest overwritten
+	unsigned int numPoints;
+	unsigned int nextPoint;
+	Point windowMin;				// of the current window
+	bool windowValid;
+	unsigned long long windowStart;
+
+	// host = device + a + b * (device - ref)
+	double a;
+	double b;
+	double ref;
+};
@@ -0,0 +1,147 @@
+#include <math.h>
+#include <string.h>
+#include "gaplearn.h"
+
+#define SPARSE_PERCENT 1	// a bin holding at most this share of all silences is empty
+#define SIDE_PERCENT 3		// traffic needed on each side of a valley
+#define FRAME_PERCENT 5		// frame gaps the timeout stays below
+
+/** @return lower edge of bin k, us */
+static double bin_edge(double k)
+{
+	return GAP_MIN_US * pow(2.0,k / GAP_BINS_PER_OCTAVE);
+}
+
+/** @return bin of a silence, the last one takes everything longer */
+int gap_bin(unsigned long us)
+{
+	if (us < GAP_MIN_US)
+		return 0;
+	int k = (int)(GAP_BINS_PER_OCTAVE * log2((double)us / GAP_MIN_US));
+	return k < GAP_BINS ? k : GAP_BINS - 1;
+}
+
+/** first bin the cumulative count reaches percent of count in, GAP_BINS if count is 0 */
+static int percentile_bin(const unsigned long *hist, unsigned long count, int percent)
+{
+	unsigned long long need = (unsigned long long)count * percent;
+	unsigned long long sum = 0;
+	for (int k = 0; k < GAP_BINS; k++)
+	{
+		sum += hist[k] * 100ULL;
+		if (sum && sum >= need)
+			return k;
+	}
+	return GAP_BINS;
+}
+
+/**
+ * @brief set up a learner
+ * @param floorUs - the timeout never goes below this
+ * @param timeoutUs - timeout until the first choice
+ */
+void gap_init(GAP_LEARNER *gl, unsigned long floorUs, unsigned long timeoutUs)
+{
+	memset(gl,0,sizeof(*gl));
+	gl->floorUs = floorUs;
+	gl->timeoutUs = timeoutUs < floorUs ? floorUs : timeoutUs;
+}
+
+/** @return timeout for the distribution learned so far */
+static unsigned long choose(const GAP_LEARNER *gl)
+{
+	unsigned long total = gl->allCount;
+	int bestStart = 0;
+	int bestLen = 0;
+	unsigned long below = 0;
+	for (int k = 0; k < GAP_BINS;)
+	{
+		if (gl->all[k] * 100ULL > (unsigned long long)total * SPARSE_PERCENT)
+		{
+			below += gl->all[k++];
+			continue;
+		}
+		int start = k;
+		unsigned long run = 0;
+		while (k < GAP_BINS && gl->all[k] * 100ULL <= (unsigned long long)total * SPARSE_PERCENT)
+			run += gl->all[k++];
+		unsigned long above = total - below - run;
+		if (below * 100ULL >= (unsigned long long)total * SIDE_PERCENT &&
+			above * 100ULL >= (unsigned long long)total * SIDE_PERCENT && k - start > bestLen)
+		{
+			bestStart = start;
+			bestLen = k - start;
+		}
+		below += run;
+	}
+
+	double us;
+	if (bestLen >= 2)
+		us = bin_edge(bestStart + bestLen / 2.0);
+	else
+		us = bin_edge(percentile_bin(gl->all,total,2)) / sqrt(2.0);
+	if (gl->frameCount >= GAP_LEARN / 4)
+	{
+		double frameUs = bin_edge(percentile_bin(gl->frame,gl->frameCount,FRAME_PERCENT)) / sqrt(2.0);
+		if (us > frameUs)
+			us = frameUs;
+	}
+	if (us < gl->floorUs)
+		us = gl->floorUs;
+	if (us > GAP_MAX_US)
+		us = GAP_MAX_US;
+	return (unsigned long)us;
+}
+
+/**
+ * @brief learn from one silence between received bytes
+ * @param afterFrame - the bytes before it form a complete frame
+ * @return 1 if timeoutUs changed
+ */
+int gap_add(GAP_LEARNER *gl, unsigned long gapUs, int afterFrame)
+{
+	if (gapUs >= GAP_IDLE_US)
+		return 0;
+	int k = gap_bin(gapUs);
+	gl->all[k]++;
+	gl->allCount++;
+	if (afterFrame)
+	{
+		gl->frame[k]++;
+		gl->frameCount++;
+	}
+	if (gl->allCount >= GAP_DECAY)
+	{
+		gl->allCount = 0;
+		gl->frameCount = 0;
+		for (int i = 0; i < GAP_BINS; i++)
+		{
+			gl->allCount += gl->all[i] /= 2;
+			gl->frameCount += gl->frame[i] /= 2;
+		}
+	}
+	if (++gl->fresh < GAP_LEARN)
+		return 0;
+	gl->fresh = 0;
+
+	// small moves aren't worth a note in the log
+	unsigned long us = choose(gl);
+	unsigned long diff = us > gl->timeoutUs ? us - gl->timeoutUs : gl->timeoutUs - us;
+	if (diff * 8 <= gl->timeoutUs)
+		return 0;
+	gl->timeoutUs = us;
+	gl->changes++;
+	return 1;
+}
+
+/**
+ * @brief upper edge of the bin a share of the silences falls below
+ * @param hist - all or frame of a learner
+ * @param count - allCount or frameCount
+ * @return us, 0 if nothing was learned
+ */
+unsigned long gap_percentile(const unsigned long *hist, unsigned long count, int percent)
+{
+	int k = percentile_bin(hist,count,percent);
+	return k < GAP_BINS ? (unsigned long)bin_edge(k + 1) : 0;
+}
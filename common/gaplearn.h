@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+END OF MESSAGE TIMEOUT LEARNING
+
+    The silences on the bus fall into two groups: between the bytes of one
+    frame (at most P1max of the sender, usually far less) and between frames
+    (P2 and P3, tens of ms with KWP2000). A good end of message timeout lies
+    in the valley between the two.
+
+    Every silence is sorted into a histogram of GAP_BINS_PER_OCTAVE bins per
+    octave from GAP_MIN_US on. The timeout is put in the middle of the widest
+    run of (nearly) empty bins that has real traffic on both sides. Without
+    such a valley all silences are taken as frame gaps and the timeout goes
+    half an octave below the shortest of them. Silences after a frame
+    recognized by its length and checksum are frame gaps for sure; the
+    timeout stays below those as well. Old silences fade out, the histogram
+    halves every GAP_DECAY silences.
+*/
+
+#define GAP_MIN_US 500			// lower edge of the first bin
+#define GAP_BINS_PER_OCTAVE 4
+#define GAP_BINS 48				// up to 2 s
+#define GAP_IDLE_US 1000000UL	// longer silences are idle bus, not learned from
+#define GAP_LEARN 64			// silences before the first choice, and between choices
+#define GAP_DECAY 1024
+#define GAP_MAX_US 127500UL		// largest P1_MAX
+
+/** learned gap distribution and timeout of one channel */
+typedef struct
+{
+	unsigned long floorUs;			// shortest timeout, the interface cuts there already
+	unsigned long timeoutUs;		// current choice
+	unsigned long all[GAP_BINS];	// every silence
+	unsigned long frame[GAP_BINS];	// silences after a recognized frame
+	unsigned long allCount;
+	unsigned long frameCount;
+	unsigned long fresh;			// silences since the last choice
+	unsigned long changes;			// of timeoutUs
+} GAP_LEARNER;
+
+void gap_init(GAP_LEARNER *gl, unsigned long floorUs, unsigned long timeoutUs);
+int gap_add(GAP_LEARNER *gl, unsigned long gapUs, int afterFrame);
+int gap_bin(unsigned long us);
+unsigned long gap_percentile(const unsigned long *hist, unsigned long count, int percent);
@@ -0,0 +1,119 @@
+#include <string.h>
+#include "hexfmt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEXFMT_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/** "XX" for every byte value */
+static struct HexPairs
+{
+	char pair[256][2];
+	HexPairs()
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		for (int i = 0; i < 256; i++)
+		{
+			pair[i][0] = digits[i >> 4];
+			pair[i][1] = digits[i & 0xF];
+		}
+	}
+} hexPairs;
+
+/**
+ * @brief convert binary to "XX XX ... " without SIMD
+ * @param out - destination, 3 * len bytes, not zero terminated
+ * @param data - binary data
+ * @param len - size of the data
+ * @return characters written
+ */
+size_t hex_encode_scalar(char *out, const unsigned char *data, size_t len)
+{
+	char *p = out;
+	for (size_t i = 0; i < len; i++)
+	{
+		memcpy(p,hexPairs.pair[data[i]],2);
+		p[2] = ' ';
+		p += 3;
+	}
+	return p - out;
+} //..hex_encode_scalar
+
+#ifdef HEXFMT_SSSE3
+/**
+ * 16 input bytes become 48 output characters: both nibbles are looked up
+ * with pshufb, then three shuffles spread them into "HL " triples.
+ */
+__attribute__((target("ssse3")))
+static size_t hex_encode_ssse3(char *out, const unsigned char *data, size_t len)
+{
+	const __m128i digits = _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F');
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i hi0 = _mm_setr_epi8(0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5);
+	const __m128i lo0 = _mm_setr_epi8(-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1);
+	const __m128i sp0 = _mm_setr_epi8(0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0);
+	const __m128i hi1 = _mm_setr_epi8(-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10,-1);
+	const __m128i lo1 = _mm_setr_epi8(5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10);
+	const __m128i sp1 = _mm_setr_epi8(0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0);
+	const __m128i hi2 = _mm_setr_epi8(-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1);
+	const __m128i lo2 = _mm_setr_epi8(-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1);
+	const __m128i sp2 = _mm_setr_epi8(' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ',0,0,' ');
+
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i h = _mm_shuffle_epi8(digits,_mm_and_si128(_mm_srli_epi16(v,4),nibble));
+		__m128i l = _mm_shuffle_epi8(digits,_mm_and_si128(v,nibble));
+		char *p = out + 3 * i;
+		_mm_storeu_si128((__m128i*)p,_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(h,hi0),_mm_shuffle_epi8(l,lo0)),sp0));
+		_mm_storeu_si128((__m128i*)(p + 16),_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(h,hi1),_mm_shuffle_epi8(l,lo1)),sp1));
+		_mm_storeu_si128((__m128i*)(p + 32),_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(h,hi2),_mm_shuffle_epi8(l,lo2)),sp2));
+	}
+	return 3 * i + hex_encode_scalar(out + 3 * i,data + i,len - i);
+} //..hex_encode_ssse3
+
+static bool detect_ssse3()
+{
+	__builtin_cpu_init(); // needed before main()
+	return __builtin_cpu_supports("ssse3");
+}
+
+static bool has_ssse3 = detect_ssse3();
+#endif
+
+/**
+ * @brief convert binary to "XX XX ... ", fastest available kernel
+ * @param out - destination, 3 * len bytes, not zero terminated
+ * @param data - binary data
+ * @param len - size of the data
+ * @return characters written
+ */
+size_t hex_encode(char *out, const unsigned char *data, size_t len)
+{
+#ifdef HEXFMT_SSSE3
+	if (len >= 16 && has_ssse3)
+		return hex_encode_ssse3(out,data,len);
+#endif
+	return hex_encode_scalar(out,data,len);
+} //..hex_encode
+
+/**
+ * @brief unsigned decimal without printf
+ * @param out - destination, up to 20 bytes, not zero terminated
+ * @return characters written
+ */
+size_t dec_encode(char *out, unsigned long long v)
+{
+	char tmp[20];
+	size_t n = 0;
+	do
+	{
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	for (size_t i = 0; i < n; i++)
+		out[i] = tmp[n - 1 - i];
+	return n;
+} //..dec_encode
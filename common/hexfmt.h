@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+Hex formatting for log output, "XX " per byte as the logs always looked.
+hex_encode() uses a SSSE3 kernel when the CPU has it (checked once at run
+time) and a table-driven scalar loop otherwise.
+*/
+
+size_t hex_encode(char *out, const unsigned char *data, size_t len);
+size_t hex_encode_scalar(char *out, const unsigned char *data, size_t len);
+size_t dec_encode(char *out, unsigned long long v);
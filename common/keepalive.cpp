@@ -0,0 +1,86 @@
+#include <thread>
+#include "keepalive.h"
+
+KeepAlive::KeepAlive()
+{
+	j2534 = NULL;
+	chanID = 0;
+	interval = 0;
+	settle = 0;
+	enabled = false;
+	running = false;
+	msgID = 0;
+	holds = 0;
+}
+
+/**
+ * @brief start sending msg every intervalMs while the session is idle
+ * @param j2534 - interface library
+ * @param chanID - channel of the session
+ * @param msg - keep-alive message, complete with checksum
+ * @param intervalMs - time between two keep-alives
+ * @param settleMs - longest time the ECU takes to answer a keep-alive
+ * @return false if the device refused the periodic message
+ * @remark if called while held, the message starts at the last release()
+ */
+bool KeepAlive::start(J2534* j2534, unsigned long chanID, const PASSTHRU_MSG* msg, unsigned long intervalMs, unsigned long settleMs)
+{
+	disarm();
+	this->j2534 = j2534;
+	this->chanID = chanID;
+	this->msg = *msg;
+	interval = intervalMs;
+	settle = settleMs;
+	enabled = true;
+	return holds || arm();
+}
+
+/** take the keep-alive off the bus for a transaction */
+void KeepAlive::hold()
+{
+	if (holds++ == 0)
+		disarm();
+}
+
+/** the transaction is over, keep-alives go on one interval from now */
+void KeepAlive::release()
+{
+	if (holds > 0 && --holds == 0)
+		arm();
+}
+
+/** no more keep-alives, e.g. before the channel is closed */
+void KeepAlive::stop()
+{
+	disarm();
+	enabled = false;
+	holds = 0;
+}
+
+bool KeepAlive::arm()
+{
+	if (!enabled || running)
+		return running;
+	if (j2534->PassThruStartPeriodicMsg(chanID,&msg,&msgID,interval))
+		return false;
+	running = true;
+	armed = std::chrono::steady_clock::now();
+	return true;
+}
+
+void KeepAlive::disarm()
+{
+	if (!running)
+		return;
+	j2534->PassThruStopPeriodicMsg(chanID,msgID);
+	running = false;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	unsigned long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - armed).count();
+	if (elapsed < interval)
+		return; // none sent yet, the RX buffer holds no answer to one
+	unsigned long long since = elapsed % interval;
+	if (since < settle)
+		std::this_thread::sleep_for(std::chrono::milliseconds(settle - since));
+	j2534->PassThruIoctl(chanID,CLEAR_RX_BUFFER,NULL,NULL);
+}
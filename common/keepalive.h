@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include "J2534.h"
+
+/**
+ * @brief session keep-alive sent by the interface itself
+ * @remark the keep-alive message (KWP2000 tester present, the Honda hello)
+ * is registered with PassThruStartPeriodicMsg, so the host neither wakes up
+ * for it nor adds its scheduling jitter. It must not collide with a
+ * transaction, though: hold() takes it off the bus before one and
+ * release() puts it back after, so it only runs while the session is idle.
+ * Holds nest, a caller can hold across a whole burst of requests.
+ *
+ * The device is assumed to send the first message one interval after it
+ * was started. When a hold comes shortly after a keep-alive may have gone
+ * out, it waits out the ECU's answer and clears it from the RX buffer, so
+ * the next reply read is the one to the next request.
+ */
+class KeepAlive
+{
+public:
+	KeepAlive();
+	bool start(J2534* j2534, unsigned long chanID, const PASSTHRU_MSG* msg, unsigned long intervalMs, unsigned long settleMs);
+	void hold();
+	void release();
+	void stop();
+
+private:
+	KeepAlive(const KeepAlive&);
+	KeepAlive& operator=(const KeepAlive&);
+	bool arm();
+	void disarm();
+
+	J2534* j2534;
+	unsigned long chanID;
+	PASSTHRU_MSG msg;
+	unsigned long interval;	// ms between keep-alives
+	unsigned long settle;	// ms an answer to one may take
+	bool enabled;			// start() was called
+	bool running;			// registered with the device
+	unsigned long msgID;
+	int holds;
+	std::chrono::steady_clock::time_point armed;
+};
@@ -0,0 +1,255 @@
+#include <string.h>
+#include "kline_frame.h"
+
+/**
+ * @brief length of the frame starting at buf
+ * @param protocol - KFRAME_KWP or KFRAME_HONDA
+ * @param buf - first byte of the frame
+ * @param len - bytes available
+ * @return whole frame size in bytes, 0 if more bytes are needed to tell,
+ * -1 if buf doesn't start a frame of this protocol
+ */
+long kframe_size(int protocol, const unsigned char *buf, size_t len)
+{
+	if (!len)
+		return 0;
+	if (protocol == KFRAME_KWP)
+	{
+		unsigned char fmt = buf[0];
+		if ((fmt & 0xC0) == 0x40)
+			return -1; // CARB exception mode carries no length
+		size_t header = (fmt & 0xC0) ? 3 : 1;
+		size_t dataSize = fmt & 0x3F;
+		if (!dataSize)
+		{
+			if (len <= header)
+				return 0;
+			dataSize = buf[header++];
+			if (!dataSize)
+				return -1;
+		}
+		return (long)(header + dataSize + 1);
+	}
+	if (len < 2)
+		return 0;
+	if (buf[1] < 3)
+		return -1;
+	return buf[1];
+}
+
+/** @return 1 if the complete frame of protocol at buf has a good checksum */
+static int checksum_ok(int protocol, const unsigned char *buf, size_t size)
+{
+	unsigned char sum = 0;
+	for (size_t i = 0; i + 1 < size; i++)
+		sum += buf[i];
+	if (protocol == KFRAME_KWP)
+		return sum == buf[size - 1];
+	return (unsigned char)(sum + buf[size - 1]) == 0;
+}
+
+/** fill info for a complete frame */
+static void decode_fields(int protocol, const unsigned char *buf, size_t size, KFRAME_INFO *info)
+{
+	info->protocol = protocol;
+	info->size = size;
+	info->target = -1;
+	info->source = -1;
+	if (protocol == KFRAME_KWP)
+	{
+		size_t header = 1;
+		if (buf[0] & 0xC0)
+		{
+			info->target = buf[1];
+			info->source = buf[2];
+			header = 3;
+		}
+		if (!(buf[0] & 0x3F))
+			header++;
+		info->data = header;
+		info->dataSize = size - header - 1;
+	}
+	else
+	{
+		info->data = 2;
+		info->dataSize = size - 3;
+	}
+	info->checksumOk = checksum_ok(protocol,buf,size);
+}
+
+/**
+ * @brief decode the frame starting at buf
+ * @param protocols - KFRAME_KWP and/or KFRAME_HONDA; if both match, a good
+ * checksum decides, then KWP2000 wins
+ * @param buf - first byte of the frame
+ * @param len - bytes available
+ * @param info - filled for a complete frame
+ * @return 1 for a complete frame with a good checksum, 0 if more bytes are
+ * needed, -1 for a complete frame with a bad checksum, -2 if buf doesn't
+ * start a frame
+ */
+int kframe_decode(int protocols, const unsigned char *buf, size_t len, KFRAME_INFO *info)
+{
+	static const int order[] = {KFRAME_KWP,KFRAME_HONDA};
+	int result = -2;
+	for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+	{
+		if (!(protocols & order[i]))
+			continue;
+		long size = kframe_size(order[i],buf,len);
+		if (size < 0)
+			continue;
+		if (size == 0 || (size_t)size > len)
+		{
+			result = 0;
+			continue;
+		}
+		KFRAME_INFO fi;
+		decode_fields(order[i],buf,size,&fi);
+		if (fi.checksumOk)
+		{
+			*info = fi;
+			return 1;
+		}
+		if (result == -2)
+		{
+			*info = fi;
+			result = -1;
+		}
+	}
+	return result;
+}
+
+/**
+ * @brief set up a splitter
+ * @param protocols - KFRAME_KWP and/or KFRAME_HONDA
+ * @param holdUs - an incomplete frame is given up once the next message is
+ * this much younger
+ * @param emit - receives every message split out, Timestamp is that of the
+ * message that delivered the last byte, RxStatus holds the KFRAME_ bits
+ * @param ctx - passed to emit
+ */
+void kframe_init(KFRAME_SPLITTER *sp, int protocols, unsigned long holdUs, KFRAME_EMIT emit, void *ctx)
+{
+	memset(sp,0,sizeof(*sp));
+	sp->protocols = protocols;
+	sp->holdUs = holdUs;
+	sp->emit = emit;
+	sp->ctx = ctx;
+}
+
+static void emit_bytes(KFRAME_SPLITTER *sp, const unsigned char *data, size_t size, unsigned long status)
+{
+	if (!size)
+		return;
+	if (status & KFRAME_FRAMED)
+	{
+		sp->frames++;
+		if (!(status & KFRAME_CHECKSUM_OK))
+			sp->badChecksums++;
+	}
+	else
+		sp->unframed += size;
+	// the frame is emitted where it lies in pending, split() moves the
+	// rest only after this returns
+	KMSG_VIEW out;
+	out.ProtocolID = sp->protocol;
+	out.RxStatus = status;
+	out.Timestamp = sp->pendingTimestamp;
+	out.DataSize = size;
+	out.Data = data;
+	sp->emit(&out,sp->ctx);
+}
+
+/** @return offset of the first good frame in buf[from..to), 0 if there is none */
+static size_t find_frame(int protocols, const unsigned char *buf, size_t len, size_t from, size_t to)
+{
+	KFRAME_INFO info;
+	for (size_t i = from; i < to; i++)
+		if (kframe_decode(protocols,buf + i,len - i,&info) == 1)
+			return i;
+	return 0;
+}
+
+/**
+ * @brief emit the frames held in sp->pending
+ * @param final - no more bytes will follow, cut off incomplete frames too
+ */
+static void split(KFRAME_SPLITTER *sp, int final)
+{
+	const unsigned char *buf = sp->pending;
+	size_t len = sp->pendingSize;
+	size_t pos = 0;
+	size_t junk = 0; // start of bytes that don't form a frame
+	while (pos < len)
+	{
+		KFRAME_INFO info;
+		int r = kframe_decode(sp->protocols,buf + pos,len - pos,&info);
+		if (r == 1)
+		{
+			emit_bytes(sp,buf + junk,pos - junk,0);
+			emit_bytes(sp,buf + pos,info.size,KFRAME_FRAMED | KFRAME_CHECKSUM_OK);
+			pos += info.size;
+			junk = pos;
+			continue;
+		}
+		if (r == -2)
+		{
+			pos++;
+			continue;
+		}
+		if (r == 0 && !final)
+			break; // wait for the rest
+		// a broken or cut off frame; if a good one starts inside, the length
+		// byte was probably garbage and the good frame wins
+		size_t size = (r == 0) ? len - pos : info.size;
+		size_t next = find_frame(sp->protocols,buf,len,pos + 1,pos + size);
+		if (next)
+		{
+			pos = next;
+			continue;
+		}
+		emit_bytes(sp,buf + junk,pos - junk,0);
+		emit_bytes(sp,buf + pos,size,KFRAME_FRAMED);
+		pos += size;
+		junk = pos;
+	}
+	emit_bytes(sp,buf + junk,pos - junk,0);
+	sp->pendingSize = len - pos;
+	memmove(sp->pending,buf + pos,len - pos);
+}
+
+/**
+ * @brief split one received message into frames
+ * @remark bytes of an incomplete frame are held until the next message
+ * completes it; they are given up when that message comes more than holdUs
+ * later, starts with a good frame of its own or doesn't fit
+ * @param msg - received message, START_OF_MESSAGE indications are ignored
+ */
+void kframe_feed(KFRAME_SPLITTER *sp, const KMSG_VIEW *msg)
+{
+	if (msg->RxStatus & START_OF_MESSAGE)
+		return;
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+	if (sp->pendingSize)
+	{
+		unsigned long gap = (msg->Timestamp - sp->pendingTimestamp) & 0xFFFFFFFFUL;
+		KFRAME_INFO info;
+		if (gap > sp->holdUs || sp->pendingSize + size > PASSTHRU_MSG_DATA_SIZE ||
+			kframe_decode(sp->protocols,msg->Data,size,&info) == 1)
+			split(sp,1);
+	}
+	memcpy(sp->pending + sp->pendingSize,msg->Data,size);
+	sp->pendingSize += size;
+	sp->pendingTimestamp = msg->Timestamp;
+	sp->protocol = msg->ProtocolID;
+	split(sp,0);
+}
+
+/** emit whatever is held, e.g. at the end of a capture */
+void kframe_flush(KFRAME_SPLITTER *sp)
+{
+	split(sp,1);
+}
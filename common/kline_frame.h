@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include "j2534_tactrix.h"
+#include "kmsg.h"
+
+/*
+K-LINE FRAME FORMATS
+
+    KWP2000 (ISO 14230-2)
+        fmt  A1 A0 L5..L0, address mode 00 none, 10 physical, 11 functional;
+             L = data length, 0 if a length byte follows the header
+        tgt  target address, unless A1 A0 = 00
+        src  source address, unless A1 A0 = 00
+        len  data length, only if L = 0
+        data service ID and parameters
+        cs   sum of all previous bytes modulo 256
+
+    Honda
+        hdr  72 request, 60/61 diagnostic request, 00/02 response, ...
+        len  whole frame length, hdr and cs included
+        data
+        cs   makes the sum of all frame bytes 0 modulo 256
+
+    The interface splits messages only by the inter-byte timeout, so a
+    request and its answer often arrive as one message, e.g.
+        80 58 F1 01 3E 08 80 F1 58 01 7E 48
+    and a slow ECU can split a frame over two messages. The splitter below
+    cuts the stream at the frame lengths again and checks every checksum.
+*/
+
+#define KFRAME_KWP 1	// protocol bits for kframe_decode() and the splitter
+#define KFRAME_HONDA 2
+
+// RxStatus bits of split messages (tool specific range of the J2534 bits)
+#define KFRAME_FRAMED 0x01000000		// bytes form one frame by its header and length
+#define KFRAME_CHECKSUM_OK 0x02000000	// and its checksum is right
+
+/** fields of one decoded frame */
+typedef struct
+{
+	int protocol;		// KFRAME_KWP or KFRAME_HONDA
+	size_t size;		// whole frame
+	int target;			// KWP addresses, -1 if not present
+	int source;
+	size_t data;		// offset of the first data byte (service ID / Honda command)
+	size_t dataSize;
+	int checksumOk;
+} KFRAME_INFO;
+
+/** called for every message the splitter produces */
+typedef void (*KFRAME_EMIT)(const KMSG_VIEW *frame, void *ctx);
+
+/** incremental splitter of one channel */
+typedef struct
+{
+	int protocols;			// KFRAME_KWP and/or KFRAME_HONDA
+	unsigned long holdUs;	// how long an incomplete frame waits for the rest
+	KFRAME_EMIT emit;
+	void *ctx;
+	unsigned char pending[PASSTHRU_MSG_DATA_SIZE];	// received bytes not emitted yet
+	size_t pendingSize;
+	unsigned long pendingTimestamp;	// Timestamp of the last of them
+	unsigned long protocol;			// ProtocolID of the messages fed
+	unsigned long frames;		// frames emitted, good or not
+	unsigned long badChecksums;	// frames emitted with a wrong checksum or cut short
+	unsigned long unframed;		// bytes emitted that don't form a frame
+} KFRAME_SPLITTER;
+
+long kframe_size(int protocol, const unsigned char *buf, size_t len);
+int kframe_decode(int protocols, const unsigned char *buf, size_t len, KFRAME_INFO *info);
+void kframe_init(KFRAME_SPLITTER *sp, int protocols, unsigned long holdUs, KFRAME_EMIT emit, void *ctx);
+void kframe_feed(KFRAME_SPLITTER *sp, const KMSG_VIEW *msg);
+void kframe_flush(KFRAME_SPLITTER *sp);
@@ -0,0 +1,536 @@
+#include <string.h>
+#include <stdlib.h>
+#include "klog_format.h"
+#include "hexfmt.h"
+#include "kline_frame.h"
+
+static size_t put_varint(unsigned char *buf, unsigned long long v)
+{
+	size_t n = 0;
+	while (v >= 0x80)
+	{
+		buf[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (unsigned char)v;
+	return n;
+}
+
+/** @return 1 on success, 0 on EOF before the first byte, -1 on truncated/oversized value */
+static int get_varint(FILE *fp, unsigned long long *v)
+{
+	unsigned long long result = 0;
+	for (int shift = 0; shift < 70; shift += 7)
+	{
+		int c = fgetc(fp);
+		if (c == EOF)
+			return shift ? -1 : 0;
+		result |= (unsigned long long)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+		{
+			*v = result;
+			return 1;
+		}
+	}
+	return -1;
+}
+
+static void put_le32(unsigned char *buf, unsigned long v)
+{
+	buf[0] = (unsigned char)v;
+	buf[1] = (unsigned char)(v >> 8);
+	buf[2] = (unsigned char)(v >> 16);
+	buf[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned long get_le32(const unsigned char *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+/**
+ * @brief serialize binary file header
+ * @param buf - destination, at least KLOG_HEADER_SIZE bytes
+ * @param hdr - capture parameters
+ * @return bytes written
+ */
+size_t klog_encode_header(unsigned char *buf, const KLOG_HEADER *hdr)
+{
+	memcpy(buf,KLOG_MAGIC,4);
+	buf[4] = KLOG_VERSION;
+	buf[5] = KLOG_HEADER_SIZE;
+	put_le32(buf + 6,hdr->ProtocolID);
+	put_le32(buf + 10,hdr->Baudrate);
+	buf[14] = (unsigned char)hdr->Parity;
+	buf[15] = (unsigned char)(hdr->Timeout > 255 ? 255 : hdr->Timeout);
+	return KLOG_HEADER_SIZE;
+}
+
+/** record body after the kind byte(s): timestamp delta, RxStatus, length, data */
+static size_t encode_body(unsigned char *buf, KLOG_STATE *st, const KMSG_VIEW *msg)
+{
+	size_t n = 0;
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+
+	n += put_varint(buf + n,(msg->Timestamp - st->lastTimestamp) & 0xFFFFFFFFUL);
+	n += put_varint(buf + n,msg->RxStatus);
+	n += put_varint(buf + n,size);
+	memcpy(buf + n,msg->Data,size);
+	st->lastTimestamp = msg->Timestamp;
+	return n + size;
+}
+
+/**
+ * @brief encode one message as a binary record
+ * @param buf - destination, at least KLOG_MAX_RECORD bytes
+ * @param st - stream state, updated
+ * @param msg - received message
+ * @return bytes written
+ */
+size_t klog_encode_frame(unsigned char *buf, KLOG_STATE *st, const KMSG_VIEW *msg)
+{
+	buf[0] = KLOG_REC_FRAME;
+	return 1 + encode_body(buf + 1,st,msg);
+}
+
+/** end a text line, marking frames split out with a bad checksum */
+static char *end_line(char *p, const KMSG_VIEW *msg)
+{
+	if ((msg->RxStatus & (KFRAME_FRAMED | KFRAME_CHECKSUM_OK)) == KFRAME_FRAMED)
+		*p++ = '!';
+	*p++ = '\n';
+	return p;
+}
+
+/** rest of a text line after the tags: data bytes, or the timeout of a note */
+static char *put_data(char *p, const KMSG_VIEW *msg, unsigned long size)
+{
+	if (msg->RxStatus & KLOG_TIMEOUT_NOTE)
+	{
+		memcpy(p,"timeout ",8);
+		p += 8;
+		p += dec_encode(p,klog_note_timeout(msg));
+		memcpy(p,"us\n",3);
+		return p + 3;
+	}
+	p += hex_encode(p,msg->Data,size);
+	return end_line(p,msg);
+}
+
+/**
+ * @brief format one message as a text log line
+ * @param buf - destination, at least KLOG_MAX_TEXT_LINE bytes
+ * @param msg - received message
+ * @return characters written, no terminating zero
+ */
+
+size_t klog_format_text(char *buf, const KMSG_VIEW *msg)
+{
+	char *p = buf;
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+	*p++ = '[';
+	p += dec_encode(p,msg->Timestamp & 0xFFFFFFFFUL);
+	*p++ = ']';
+	*p++ = ' ';
+	p = put_data(p,msg,size);
+	return p - buf;
+}
+
+/** @return text tag of a capture channel, NULL for other protocols */
+const char *klog_channel_name(unsigned long protocol)
+{
+	switch (protocol)
+	{
+	case ISO9141_K:
+		return "K";
+	case ISO9141_L:
+		return "L";
+	case ISO9141_INNO:
+		return "AUX";
+	}
+	return NULL;
+}
+
+/**
+ * @brief encode one message with the channel it was read on
+ * @remark messages of other protocols than K, L and AUX are encoded as by
+ * klog_encode_frame()
+ * @param buf - destination, at least KLOG_MAX_RECORD bytes
+ * @param st - stream state, updated
+ * @param msg - received message, ProtocolID names the channel
+ * @return bytes written
+ */
+size_t klog_encode_tagged_frame(unsigned char *buf, KLOG_STATE *st, const KMSG_VIEW *msg)
+{
+	if (!klog_channel_name(msg->ProtocolID))
+		return klog_encode_frame(buf,st,msg);
+	buf[0] = KLOG_REC_CHANNEL_FRAME;
+	size_t n = 1 + put_varint(buf + 1,msg->ProtocolID);
+	return n + encode_body(buf + n,st,msg);
+}
+
+/**
+ * @brief format one message as a text log line tagged with its channel
+ * @remark messages of other protocols than K, L and AUX are formatted as by
+ * klog_format_text()
+ * @param buf - destination, at least KLOG_MAX_TEXT_LINE bytes
+ * @param msg - received message, ProtocolID names the channel
+ * @return characters written, no terminating zero
+ */
+size_t klog_format_tagged_text(char *buf, const KMSG_VIEW *msg)
+{
+	const char *tag = klog_channel_name(msg->ProtocolID);
+	if (!tag)
+		return klog_format_text(buf,msg);
+	char *p = buf;
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+	*p++ = '[';
+	p += dec_encode(p,msg->Timestamp & 0xFFFFFFFFUL);
+	*p++ = ']';
+	*p++ = ' ';
+	while (*tag)
+		*p++ = *tag++;
+	*p++ = ':';
+	*p++ = ' ';
+	p = put_data(p,msg,size);
+	return p - buf;
+}
+
+/**
+ * @brief encode one message of a multi-device capture
+ * @param buf - destination, at least KLOG_MAX_RECORD bytes
+ * @param msg - received message, ProtocolID names the channel
+ * @param device - device number, from 1
+ * @param time - aligned time of the message, us
+ * @return bytes written
+ */
+size_t klog_encode_device_frame(unsigned char *buf, const KMSG_VIEW *msg, unsigned int device, unsigned long long time)
+{
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+
+	size_t n = 0;
+	buf[n++] = KLOG_REC_DEVICE_FRAME;
+	n += put_varint(buf + n,device);
+	n += put_varint(buf + n,msg->ProtocolID);
+	n += put_varint(buf + n,time);
+	n += put_varint(buf + n,msg->RxStatus);
+	n += put_varint(buf + n,size);
+	memcpy(buf + n,msg->Data,size);
+	return n + size;
+}
+
+/**
+ * @brief format one message of a multi-device capture as a text log line
+ * @param buf - destination, at least KLOG_MAX_TEXT_LINE bytes
+ * @param msg - received message, ProtocolID names the channel
+ * @param device - device number, from 1
+ * @param time - aligned time of the message, us
+ * @return characters written, no terminating zero
+ */
+size_t klog_format_device_text(char *buf, const KMSG_VIEW *msg, unsigned int device, unsigned long long time)
+{
+	const char *tag = klog_channel_name(msg->ProtocolID);
+	char *p = buf;
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+	*p++ = '[';
+	p += dec_encode(p,time);
+	*p++ = ']';
+	*p++ = ' ';
+	while (tag && *tag)
+		*p++ = *tag++;
+	*p++ = '@';
+	p += dec_encode(p,device);
+	*p++ = ':';
+	*p++ = ' ';
+	p = put_data(p,msg,size);
+	return p - buf;
+}
+
+/**
+ * @brief check and parse binary file header held in memory
+ * @param buf - header bytes
+ * @param len - number of bytes available
+ * @param hdr - destination
+ * @return header size on success, 0 if the data isn't a binary capture header
+ */
+size_t klog_decode_header(const unsigned char *buf, size_t len, KLOG_HEADER *hdr)
+{
+	if (len < 6 || memcmp(buf,KLOG_MAGIC,4) || buf[4] != KLOG_VERSION || buf[5] < KLOG_HEADER_SIZE || len < buf[5])
+		return 0;
+	hdr->ProtocolID = get_le32(buf + 6);
+	hdr->Baudrate = get_le32(buf + 10);
+	hdr->Parity = buf[14];
+	hdr->Timeout = buf[15];
+	return buf[5];
+}
+
+/**
+ * @brief read and check binary file header
+ * @return 1 on success, 0 if the file isn't a binary capture
+ */
+int klog_read_header(FILE *fp, KLOG_HEADER *hdr)
+{
+	unsigned char buf[256];
+	if (fread(buf,1,6,fp) != 6 || memcmp(buf,KLOG_MAGIC,4) || buf[5] < 6)
+		return 0;
+	if (fread(buf + 6,1,buf[5] - 6,fp) != (size_t)(buf[5] - 6))
+		return 0;
+	return klog_decode_header(buf,buf[5],hdr) != 0;
+}
+
+static long decode_varint(const unsigned char *buf, size_t len, unsigned long long *v)
+{
+	unsigned long long result = 0;
+	for (size_t i = 0; i < len && i < 10; i++)
+	{
+		result |= (unsigned long long)(buf[i] & 0x7F) << (7 * i);
+		if (!(buf[i] & 0x80))
+		{
+			*v = result;
+			return (long)i + 1;
+		}
+	}
+	return len < 10 ? 0 : -1;
+}
+
+/** number of varints before RxStatus for each record kind */
+static int record_fields(int kind)
+{
+	switch (kind)
+	{
+	case KLOG_REC_FRAME:
+		return 1;			// timestamp delta
+	case KLOG_REC_CHANNEL_FRAME:
+		return 2;			// protocol, timestamp delta
+	case KLOG_REC_DEVICE_FRAME:
+		return 3;			// device, protocol, time
+	}
+	return 0;
+}
+
+/** apply the decoded varints of a record to the stream state and message */
+static void record_done(int kind, const unsigned long long *v, KLOG_STATE *st, PASSTHRU_MSG *msg)
+{
+	int f = record_fields(kind);
+	if (kind == KLOG_REC_DEVICE_FRAME)
+	{
+		st->device = (unsigned int)v[0];
+		st->time = v[2];
+		st->lastTimestamp = (unsigned long)(v[2] & 0xFFFFFFFFUL);
+	}
+	else
+	{
+		st->device = 0;
+		st->lastTimestamp = (unsigned long)((st->lastTimestamp + v[f - 1]) & 0xFFFFFFFFUL);
+	}
+	msg->ProtocolID = kind == KLOG_REC_FRAME ? 0 : (unsigned long)v[f - 2];
+	msg->Timestamp = st->lastTimestamp;
+	msg->RxStatus = (unsigned long)v[f];
+	msg->DataSize = (unsigned long)v[f + 1];
+}
+
+/**
+ * @brief decode next binary record held in memory
+ * @param buf - record bytes
+ * @param len - number of bytes available
+ * @param st - stream state, updated; device and time are set for records of
+ * a multi-device capture, device is 0 otherwise
+ * @param msg - destination, only ProtocolID (0 unless the record names its
+ * channel), RxStatus, Timestamp, DataSize and Data are filled
+ * @return record size, 0 if the record is incomplete, -1 if it's corrupt
+ */
+long klog_decode_frame(const unsigned char *buf, size_t len, KLOG_STATE *st, PASSTHRU_MSG *msg)
+{
+	unsigned long long v[5];
+	if (!len)
+		return 0;
+	int fields = record_fields(buf[0]);
+	if (!fields)
+		return -1;
+	size_t n = 1;
+	for (int i = 0; i < fields + 2; i++)
+	{
+		long r = decode_varint(buf + n,len - n,&v[i]);
+		if (r <= 0)
+			return r;
+		n += r;
+	}
+	unsigned long long size = v[fields + 1];
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		return -1;
+	if (len - n < size)
+		return 0;
+	memcpy(msg->Data,buf + n,(size_t)size);
+	record_done(buf[0],v,st,msg);
+	return (long)(n + size);
+}
+
+/**
+ * @brief read next binary record
+ * @param fp - file positioned after the header
+ * @param st - stream state, updated; device and time are set for records of
+ * a multi-device capture, device is 0 otherwise
+ * @param msg - destination, only ProtocolID (0 unless the record names its
+ * channel), RxStatus, Timestamp, DataSize and Data are filled
+ * @return 1 on success, 0 on end of file, -1 on corrupt record
+ */
+int klog_read_frame(FILE *fp, KLOG_STATE *st, PASSTHRU_MSG *msg)
+{
+	unsigned long long v[5];
+	int kind = fgetc(fp);
+	if (kind == EOF)
+		return 0;
+	int fields = record_fields(kind);
+	if (!fields)
+		return -1;
+	for (int i = 0; i < fields + 2; i++)
+		if (get_varint(fp,&v[i]) != 1)
+			return -1;
+	size_t size = (size_t)v[fields + 1];
+	if (v[fields + 1] > PASSTHRU_MSG_DATA_SIZE || fread(msg->Data,1,size,fp) != size)
+		return -1;
+	record_done(kind,v,st,msg);
+	return 1;
+}
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/**
+ * @brief parse one text log line
+ * @param line - `[timestamp] XX XX ...`, `[timestamp] K: XX XX ...` or
+ * `[time] K@2: XX XX ...`
+ * @param msg - destination, RxStatus is set to KFRAME_FRAMED for a frame
+ * marked with a bad checksum, KLOG_TIMEOUT_NOTE for a timeout note and 0
+ * otherwise, ProtocolID to the channel of a tagged line or 0
+ * @param st - device and time are set for a line of a multi-device capture,
+ * device is 0 otherwise
+ * @return 1 on success, 0 if the line isn't a message
+ */
+int klog_parse_line(const char *line, PASSTHRU_MSG *msg, KLOG_STATE *st)
+{
+	static const unsigned long protocols[] = {ISO9141_K,ISO9141_L,ISO9141_INNO};
+	unsigned long long ts;
+	int consumed;
+	if (sscanf(line,"[%llu]%n",&ts,&consumed) != 1)
+		return 0;
+
+	const char *p = line + consumed;
+	while (*p == ' ')
+		p++;
+	// optional tag: channel name, @device, then ':'
+	const char *q = p;
+	while (*q >= 'A' && *q <= 'Z')
+		q++;
+	size_t tagLen = q - p;
+	unsigned long device = 0;
+	if (*q == '@')
+		device = strtoul(q + 1,(char **)&q,10);
+	msg->ProtocolID = 0;
+	msg->RxStatus = 0;
+	st->device = 0;
+	if (*q == ':' && (tagLen || device))
+	{
+		for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++)
+		{
+			const char *tag = klog_channel_name(protocols[i]);
+			if (strlen(tag) == tagLen && strncmp(p,tag,tagLen) == 0)
+				msg->ProtocolID = protocols[i];
+		}
+		st->device = (unsigned int)device;
+		p = q + 1;
+	}
+
+	while (*p == ' ')
+		p++;
+	if (strncmp(p,"timeout ",8) == 0)
+	{
+		char *end;
+		unsigned long us = strtoul(p + 8,&end,10);
+		if (end == p + 8 || strncmp(end,"us",2))
+			return 0;
+		msg->RxStatus = KLOG_TIMEOUT_NOTE;
+		msg->DataSize = 4;
+		put_le32(msg->Data,us);
+	}
+
+	unsigned long size = 0;
+	while (!(msg->RxStatus & KLOG_TIMEOUT_NOTE))
+	{
+		while (*p == ' ')
+			p++;
+		int hi = hex_nibble(p[0]);
+		if (hi < 0)
+			break;
+		int lo = hex_nibble(p[1]);
+		if (lo < 0 || size >= PASSTHRU_MSG_DATA_SIZE)
+			return 0;
+		msg->Data[size++] = (unsigned char)(hi << 4 | lo);
+		p += 2;
+	}
+	if (st->device)
+	{
+		st->time = ts;
+		ts &= 0xFFFFFFFFUL;
+	}
+	msg->Timestamp = (unsigned long)ts;
+	if (msg->RxStatus & KLOG_TIMEOUT_NOTE)
+		return 1;
+	msg->RxStatus = (*p == '!') ? KFRAME_FRAMED : 0;
+	msg->DataSize = size;
+	return 1;
+}
+
+/**
+ * @brief parse one text log line
+ * @param line - `[timestamp] XX XX ...`, tagged lines are accepted as well
+ * @param msg - destination, RxStatus is set to KFRAME_FRAMED for a frame
+ * marked with a bad checksum and 0 otherwise, ProtocolID to the channel of a
+ * tagged line or 0
+ * @return 1 on success, 0 if the line isn't a message
+ */
+int klog_parse_text(const char *line, PASSTHRU_MSG *msg)
+{
+	KLOG_STATE st;
+	return klog_parse_line(line,msg,&st);
+}
+
+/**
+ * @brief make a timeout note record
+ * @param data - 4 bytes for the note's data
+ * @param timeoutUs - end of message timeout from timestamp on
+ */
+void klog_timeout_note(KMSG_VIEW *msg, unsigned char *data, unsigned long timestamp, unsigned long timeoutUs)
+{
+	msg->RxStatus = KLOG_TIMEOUT_NOTE;
+	msg->Timestamp = timestamp;
+	msg->DataSize = 4;
+	put_le32(data,timeoutUs);
+	msg->Data = data;
+}
+
+/** @return timeout of a timeout note, us, 0 for a message */
+unsigned long klog_note_timeout(const KMSG_VIEW *msg)
+{
+	if (!(msg->RxStatus & KLOG_TIMEOUT_NOTE) || msg->DataSize < 4)
+		return 0;
+	return get_le32(msg->Data);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include "j2534_tactrix.h"
+#include "kmsg.h"
+
+/*
+KLOGGER CAPTURE FORMATS
+
+    Text (default), one line per message:
+        [timestamp] XX XX XX ... \n
+    or, when several channels are captured into one log:
+        [timestamp] K: XX XX XX ... \n
+    with the channel tag K, L or AUX, or, when several devices are captured
+    into one log:
+        [time] K@2: XX XX XX ... \n
+    with the device number after the channel tag and the aligned 64-bit
+    time in us since the capture started instead of the device timestamp.
+    When klogger splits messages into frames (/s), a frame with a bad
+    checksum ends with "!" after the last byte.
+
+    Binary, selected with /f bin:
+        file header
+            4B   magic "KLOG"
+            1B   format version (KLOG_VERSION)
+            1B   header size in bytes, readers skip unknown trailing fields
+            4B   protocol ID (ISO9141_K, ISO9141_L, ISO9141_INNO), little endian
+            4B   baud rate, little endian
+            1B   parity (NO_PARITY, ODD_PARITY, EVEN_PARITY)
+            1B   end of message timeout, ms (saturated at 255)
+        records, back to back until EOF
+            1B   record kind (KLOG_REC_FRAME)
+            var  timestamp delta to the previous record, modulo 2^32
+            var  RxStatus
+            var  data length
+            ...  data bytes
+        or, when several channels are captured into one log
+            1B   record kind (KLOG_REC_CHANNEL_FRAME)
+            var  protocol ID of the channel
+            ...  as KLOG_REC_FRAME from the timestamp delta on
+        or, when several devices are captured into one log
+            1B   record kind (KLOG_REC_DEVICE_FRAME)
+            var  device number, from 1
+            var  protocol ID of the channel
+            var  aligned time, us since the capture started (not a delta)
+            var  RxStatus
+            var  data length
+            ...  data bytes
+
+    RxStatus keeps the KFRAME_ bits of split frames (kline_frame.h).
+
+    A record with KLOG_TIMEOUT_NOTE in RxStatus is no message: klogger /t
+    auto notes the end of message timeout it uses from that time on, as 4
+    data bytes, us, little endian. Its text line reads
+        [timestamp] timeout 12500us
+    with the channel and device tag in front of "timeout" as on the message
+    lines.
+
+    var = unsigned LEB128 varint, 7 bits per byte, low bits first, at most
+    64 bits.
+    The first record's delta is taken from timestamp 0.
+*/
+
+#define KLOG_MAGIC "KLOG"
+#define KLOG_VERSION 1
+#define KLOG_HEADER_SIZE 16
+
+#define KLOG_REC_FRAME 0
+#define KLOG_REC_CHANNEL_FRAME 1
+#define KLOG_REC_DEVICE_FRAME 2
+
+// RxStatus of a timeout note (tool specific range, next to the KFRAME_ bits)
+#define KLOG_TIMEOUT_NOTE 0x04000000
+
+// longest encoded record: kind + 5 varints + data
+#define KLOG_MAX_RECORD (1 + 5 * 10 + PASSTHRU_MSG_DATA_SIZE)
+// longest text line: "[18446744073709551615] " + "AUX@4294967295: " + "XX " per byte + "!\n"
+#define KLOG_MAX_TEXT_LINE (23 + 16 + 3 * PASSTHRU_MSG_DATA_SIZE + 3)
+
+/** capture parameters stored in the binary file header */
+typedef struct
+{
+	unsigned long ProtocolID;
+	unsigned long Baudrate;
+	unsigned long Parity;
+	unsigned long Timeout;
+} KLOG_HEADER;
+
+/** running state of a binary record stream (timestamp base) */
+typedef struct
+{
+	unsigned long lastTimestamp;
+	unsigned int device;		// of the last record, 0 unless a multi-device capture
+	unsigned long long time;	// aligned time of the last record if device is set
+} KLOG_STATE;
+
+size_t klog_encode_header(unsigned char *buf, const KLOG_HEADER *hdr);
+size_t klog_encode_frame(unsigned char *buf, KLOG_STATE *st, const KMSG_VIEW *msg);
+size_t klog_format_text(char *buf, const KMSG_VIEW *msg);
+size_t klog_encode_tagged_frame(unsigned char *buf, KLOG_STATE *st, const KMSG_VIEW *msg);
+size_t klog_format_tagged_text(char *buf, const KMSG_VIEW *msg);
+const char *klog_channel_name(unsigned long protocol);
+size_t klog_encode_device_frame(unsigned char *buf, const KMSG_VIEW *msg, unsigned int device, unsigned long long time);
+size_t klog_format_device_text(char *buf, const KMSG_VIEW *msg, unsigned int device, unsigned long long time);
+
+size_t klog_decode_header(const unsigned char *buf, size_t len, KLOG_HEADER *hdr);
+long klog_decode_frame(const unsigned char *buf, size_t len, KLOG_STATE *st, PASSTHRU_MSG *msg);
+int klog_read_header(FILE *fp, KLOG_HEADER *hdr);
+int klog_read_frame(FILE *fp, KLOG_STATE *st, PASSTHRU_MSG *msg);
+int klog_parse_text(const char *line, PASSTHRU_MSG *msg);
+int klog_parse_line(const char *line, PASSTHRU_MSG *msg, KLOG_STATE *st);
+void klog_timeout_note(KMSG_VIEW *msg, unsigned char *data, unsigned long timestamp, unsigned long timeoutUs);
+unsigned long klog_note_timeout(const KMSG_VIEW *msg);
@@ -0,0 +1,186 @@
+#include <string.h>
+#include "kmsg.h"
+
+static_assert(sizeof(KMSG) <= 64,"KMSG outgrew a cache line");
+static_assert(PASSTHRU_MSG_DATA_SIZE % 16 == 0 && KMSG_CHUNK_DATA % 16 == 0,"copy_data overruns Data");
+
+/**
+ * @brief copy data in 16 byte blocks
+ * @remark compilers turn a memcpy of unknown size into a string copy that is
+ * slow to start; the last block may copy up to 15 bytes too many. Copies
+ * start at multiples of KMSG_CHUNK_DATA and PASSTHRU_MSG Data and chunks are
+ * multiples of 16 long, so the extra bytes stay inside both.
+ */
+static void copy_data(unsigned char *dst, const unsigned char *src, size_t size)
+{
+	for (size_t i = 0; i < size; i += 16)
+		memcpy(dst + i,src + i,16);
+}
+
+/**
+ * @param chunks - overflow chunks allocated up front
+ * @param grow - take chunks from the heap once those are used up
+ */
+KMsgPool::KMsgPool(size_t chunks, bool grow) : freeList(chunks)
+{
+	count = chunks;
+	this->grow = grow;
+	store = new KMSG_CHUNK[count];
+	missCnt.store(0);
+	for (size_t i = 0; i < count; i++)
+		put(&store[i]);
+}
+
+KMsgPool::~KMsgPool()
+{
+	delete[] store;
+}
+
+/** @return a free chunk, NULL if there is none and the pool may not grow */
+KMSG_CHUNK *KMsgPool::get()
+{
+	KMSG_CHUNK **chunk = freeList.front();
+	if (!chunk)
+	{
+		missCnt.fetch_add(1,std::memory_order_relaxed);
+		return grow ? new KMSG_CHUNK : NULL;
+	}
+	KMSG_CHUNK *p = *chunk;
+	freeList.pop();
+	return p;
+}
+
+/** give back a chunk from get() */
+void KMsgPool::put(KMSG_CHUNK *chunk)
+{
+	if (chunk < store || chunk >= store + count)
+	{
+		delete chunk;
+		return;
+	}
+	// the ring has room for every pool chunk, so this never fails
+	unsigned long n = 1;
+	KMSG_CHUNK **slot = freeList.reserve(&n);
+	*slot = chunk;
+	freeList.commit(1);
+}
+
+/**
+ * @brief compact a message
+ * @param padded - Data may be read in whole 16 byte blocks and KMSG_INLINE
+ * bytes past DataSize, as that of a PASSTHRU_MSG
+ */
+static bool compact(KMSG *km, const KMSG_VIEW *msg, KMsgPool *pool, bool padded)
+{
+	unsigned long size = msg->DataSize;
+	if (size > PASSTHRU_MSG_DATA_SIZE)
+		size = PASSTHRU_MSG_DATA_SIZE;
+	km->ProtocolID = (uint32_t)msg->ProtocolID;
+	km->RxStatus = (uint32_t)msg->RxStatus;
+	km->Timestamp = (uint32_t)msg->Timestamp;
+	km->DataSize = (uint16_t)size;
+	km->overflow = NULL;
+	if (size <= KMSG_INLINE)
+	{
+		// a fixed size copy is a few moves, a variable one a string copy
+		if (padded)
+			memcpy(km->Data,msg->Data,KMSG_INLINE);
+		else
+			memcpy(km->Data,msg->Data,size);
+		return true;
+	}
+	KMSG_CHUNK **link = &km->overflow;
+	for (unsigned long done = 0; done < size; done += KMSG_CHUNK_DATA)
+	{
+		KMSG_CHUNK *c = *link = pool->get();
+		if (!c)
+		{
+			kmsg_release(km,pool);
+			km->DataSize = 0;
+			return false;
+		}
+		unsigned long n = size - done < KMSG_CHUNK_DATA ? size - done : KMSG_CHUNK_DATA;
+		if (padded)
+			copy_data(c->data,msg->Data + done,n);
+		else
+			memcpy(c->data,msg->Data + done,n);
+		link = &c->next;
+	}
+	*link = NULL;
+	return true;
+}
+
+/**
+ * @brief compact a received message
+ * @param pool - overflow chunk source for data longer than KMSG_INLINE
+ * @return false if the pool ran dry, km is left empty
+ */
+bool kmsg_from_passthru(KMSG *km, const PASSTHRU_MSG *msg, KMsgPool *pool)
+{
+	KMSG_VIEW v = passthru_view(msg);
+	return compact(km,&v,pool,true);
+}
+
+/**
+ * @brief compact a message seen through a view, e.g. a split frame
+ * @param pool - overflow chunk source for data longer than KMSG_INLINE
+ * @return false if the pool ran dry, km is left empty
+ */
+bool kmsg_from_view(KMSG *km, const KMSG_VIEW *msg, KMsgPool *pool)
+{
+	return compact(km,msg,pool,false);
+}
+
+/**
+ * @brief look at a compact message without expanding it
+ * @param gather - PASSTHRU_MSG_DATA_SIZE bytes for the data of a chain of
+ * chunks, data inline or in one chunk is used where it is
+ */
+KMSG_VIEW kmsg_view(const KMSG *km, unsigned char *gather)
+{
+	KMSG_VIEW v;
+	v.ProtocolID = km->ProtocolID;
+	v.RxStatus = km->RxStatus;
+	v.Timestamp = km->Timestamp;
+	v.DataSize = km->DataSize;
+	v.Data = km->Data;
+	if (!km->overflow)
+		return v;
+	v.Data = km->overflow->data;
+	if (!km->overflow->next)
+		return v;
+	unsigned long done = 0;
+	for (const KMSG_CHUNK *c = km->overflow; c; c = c->next, done += KMSG_CHUNK_DATA)
+		memcpy(gather + done,c->data,km->DataSize - done < KMSG_CHUNK_DATA ? km->DataSize - done : KMSG_CHUNK_DATA);
+	v.Data = gather;
+	return v;
+}
+
+/** return the overflow chunks of a message that is done with */
+void kmsg_release(KMSG *km, KMsgPool *pool)
+{
+	KMSG_CHUNK *c = km->overflow;
+	while (c)
+	{
+		KMSG_CHUNK *next = c->next;
+		pool->put(c);
+		c = next;
+	}
+	km->overflow = NULL;
+}
+
+/**
+ * @brief set every field of a message to be written or used as a filter,
+ * but not its Data
+ * @remark the J2534 API reads only DataSize bytes of Data, so there is no
+ * need to clear or copy the whole 4 KB
+ */
+void passthru_init(PASSTHRU_MSG *msg, unsigned long protocol, unsigned long dataSize)
+{
+	msg->ProtocolID = protocol;
+	msg->RxStatus = 0;
+	msg->TxFlags = 0;
+	msg->Timestamp = 0;
+	msg->DataSize = dataSize;
+	msg->ExtraDataIndex = 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "j2534_tactrix.h"
+#include "spsc_ring.h"
+
+/*
+COMPACT MESSAGES
+
+    PASSTHRU_MSG carries a fixed 4128 byte Data array, K-line frames are
+    rarely longer than a few dozen bytes. Messages held in memory (klogger's
+    rings) are KMSGs instead: the fields of a received message and
+    KMSG_INLINE data bytes, one 64 byte cache line in all. Longer messages
+    keep their data in overflow chunks from a KMsgPool. One chunk holds the
+    longest K-line frame (255 data bytes, header and checksum); longer runs
+    of bytes, e.g. sniffed without a timeout, take a chain of chunks.
+
+    Messages are converted only where they enter or leave the J2534 API;
+    only DataSize bytes are copied, Data is never cleared. The splitter, the
+    trigger and the log formats read a KMSG_VIEW: the fields and a pointer
+    to the data in one piece, inline, in the only chunk, or gathered from a
+    chain of them.
+*/
+
+#define KMSG_INLINE 40
+#define KMSG_CHUNK_DATA 272	// 260 byte K-line frame, rounded up to 16
+
+/** overflow data of a compact message */
+typedef struct KMSG_CHUNK
+{
+	unsigned char data[KMSG_CHUNK_DATA];
+	struct KMSG_CHUNK *next;	// rest of the data, NULL if none
+} KMSG_CHUNK;
+
+/** received message, compact */
+typedef struct
+{
+	uint32_t ProtocolID;
+	uint32_t RxStatus;
+	uint32_t Timestamp;
+	uint16_t DataSize;
+	KMSG_CHUNK *overflow;	// chunks holding the data, NULL if it fits in Data
+	unsigned char Data[KMSG_INLINE];
+} KMSG;
+
+/** fields of a message and its data, valid as long as what it was taken from */
+typedef struct
+{
+	unsigned long ProtocolID;
+	unsigned long RxStatus;
+	unsigned long Timestamp;
+	unsigned long DataSize;
+	const unsigned char *Data;
+} KMSG_VIEW;
+
+/**
+ * @brief preallocated overflow chunks
+ * @remark one thread may get() and another put(), the free list is a lock
+ * free ring. When the pool runs dry, get() counts a miss and, if the pool
+ * may grow, falls back to the heap; put() returns such a chunk to the heap.
+ */
+class KMsgPool
+{
+public:
+	KMsgPool(size_t chunks, bool grow);
+	~KMsgPool();
+	KMSG_CHUNK *get();
+	void put(KMSG_CHUNK *chunk);
+	unsigned long misses() const { return missCnt.load(std::memory_order_relaxed); }
+
+private:
+	KMsgPool(const KMsgPool&);
+	KMsgPool& operator=(const KMsgPool&);
+
+	KMSG_CHUNK *store;
+	size_t count;
+	bool grow;
+	SpscRing<KMSG_CHUNK*> freeList;
+	std::atomic<unsigned long> missCnt;
+};
+
+bool kmsg_from_passthru(KMSG *km, const PASSTHRU_MSG *msg, KMsgPool *pool);
+bool kmsg_from_view(KMSG *km, const KMSG_VIEW *msg, KMsgPool *pool);
+KMSG_VIEW kmsg_view(const KMSG *km, unsigned char *gather);
+void kmsg_release(KMSG *km, KMsgPool *pool);
+void passthru_init(PASSTHRU_MSG *msg, unsigned long protocol, unsigned long dataSize);
+
+/** look at a message from or for the J2534 API */
+inline KMSG_VIEW passthru_view(const PASSTHRU_MSG *msg)
+{
+	KMSG_VIEW v;
+	v.ProtocolID = msg->ProtocolID;
+	v.RxStatus = msg->RxStatus;
+	v.Timestamp = msg->Timestamp;
+	v.DataSize = msg->DataSize < PASSTHRU_MSG_DATA_SIZE ? msg->DataSize : PASSTHRU_MSG_DATA_SIZE;
+	v.Data = msg->Data;
+	return v;
+}
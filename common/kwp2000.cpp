@@ -0,0 +1,340 @@
+#include <string.h>
+#include "kwp2000.h"
+#include "kline_frame.h"
+#include "kmsg.h"
+
+typedef std::chrono::steady_clock clk;
+
+Kwp2000::Kwp2000(J2534* j2534)
+{
+	this->j2534 = j2534;
+	chanID = 0;
+	target = 0;
+	source = KWP_TESTER_ADDRESS;
+	keyBytes[0] = keyBytes[1] = 0;
+	timing = KWP_DEFAULT_TIMING;
+	retries = 2;
+	negativeCode = 0;
+	memset(&reply,0,sizeof(reply));
+	requests = 0;
+	connected = false;
+	lengthByte = false;
+}
+
+/**
+ * @brief open the K-line channel of the device for a session with target
+ * @param devID - opened device
+ * @param target - ECU address
+ * @param source - tester address, KWP_TESTER_ADDRESS usually
+ * @return J2534 status
+ */
+long Kwp2000::connect(unsigned long devID, unsigned char target, unsigned char source)
+{
+	this->target = target;
+	this->source = source;
+	timing = KWP_DEFAULT_TIMING;
+	long r = j2534->PassThruConnect(devID,ISO14230,ISO9141_NO_CHECKSUM,10400,&chanID);
+	if (r)
+		return r;
+	connected = true;
+	if ((r = setTiming()))
+		return r;
+
+	// pass everything, replies are picked by their addresses
+	PASSTHRU_MSG msgMask, msgPattern;
+	unsigned long msgId;
+	passthru_init(&msgMask,ISO14230,1);
+	passthru_init(&msgPattern,ISO14230,1);
+	msgMask.Data[0] = 0;
+	msgPattern.Data[0] = 0;
+	return j2534->PassThruStartMsgFilter(chanID,PASS_FILTER,&msgMask,&msgPattern,NULL,&msgId);
+}
+
+/** hand the session timing to the interface */
+long Kwp2000::setTiming()
+{
+	SCONFIG_LIST scl;
+	SCONFIG scp[4] = {{P1_MAX,40},{P3_MIN,0},{P4_MIN,0},{LOOPBACK,0}};
+	scp[1].Value = timing.p3Min / 500; // 0.5 ms units
+	scp[2].Value = timing.p4Min / 500;
+	scl.NumOfParams = 4;
+	scl.ConfigPtr = scp;
+	return j2534->PassThruIoctl(chanID,SET_CONFIG,&scl,NULL);
+}
+
+/** let the interface send testerPresent while the session is idle */
+void Kwp2000::startKeepAlive()
+{
+	static const unsigned char req[] = {KWP_TESTER_PRESENT};
+	PASSTHRU_MSG msg;
+	build(&msg,req,sizeof(req),lengthByte);
+	// well inside P3max, the ECU ends the session after that
+	keepAlive.start(j2534,chanID,&msg,timing.p3Max / 2000,timing.p2Max / 1000);
+}
+
+/**
+ * @brief wake the ECU up and start the session
+ * @param mode - KWP_FAST_INIT or KWP_FIVE_BAUD_INIT
+ * @return KWP_OK, KWP_NO_REPLY, KWP_BAD_CHECKSUM or KWP_FAILED
+ * @remark the key bytes decide the header format of the following requests
+ */
+int Kwp2000::init(int mode)
+{
+	if (mode == KWP_FIVE_BAUD_INIT)
+	{
+		unsigned char address = target;
+		SBYTE_ARRAY in = {1,&address};
+		SBYTE_ARRAY out = {2,keyBytes};
+		if (j2534->PassThruIoctl(chanID,FIVE_BAUD_INIT,&in,&out) || out.NumOfBytes < 2)
+			return KWP_NO_REPLY;
+	}
+	else
+	{
+		// StartCommunication always has the length in the format byte
+		static const unsigned char req[] = {KWP_START_COMMUNICATION};
+		PASSTHRU_MSG tx, rx;
+		build(&tx,req,sizeof(req),false);
+		if (j2534->PassThruIoctl(chanID,FAST_INIT,&tx,&rx))
+			return KWP_NO_REPLY;
+		size_t skip = 0;
+		if (rx.DataSize > tx.DataSize && memcmp(rx.Data,tx.Data,tx.DataSize) == 0)
+			skip = tx.DataSize; // echo
+		KFRAME_INFO info;
+		int r = kframe_decode(KFRAME_KWP,rx.Data + skip,rx.DataSize - skip,&info);
+		if (r == -1)
+			return KWP_BAD_CHECKSUM;
+		const unsigned char *d = rx.Data + skip + info.data;
+		if (r != 1 || info.dataSize < 3 || d[0] != (KWP_START_COMMUNICATION | 0x40))
+			return KWP_FAILED;
+		keyBytes[0] = d[1];
+		keyBytes[1] = d[2];
+	}
+	lengthByte = !(keyBytes[0] & 0x01) && (keyBytes[0] & 0x02);
+	startKeepAlive();
+	return KWP_OK;
+}
+
+/** ISO 14230-2 timing parameter bytes, as AccessTimingParameters carries them */
+static void decode_timing(const unsigned char *b, KWP_TIMING *t)
+{
+	t->p2Min = b[0] * 500UL;
+	t->p2Max = (b[1] ? b[1] : 1) * 25000UL;
+	t->p3Min = b[2] * 500UL;
+	t->p3Max = (b[3] ? b[3] : 1) * 250000UL;
+	t->p4Min = b[4] * 500UL;
+}
+
+/**
+ * @brief switch the session to the fastest timing the ECU allows
+ * @return KWP_OK if the ECU took it, otherwise the session keeps its timing
+ */
+int Kwp2000::tuneTiming()
+{
+	unsigned char req[7] = {KWP_ACCESS_TIMING,0x00};
+	unsigned char resp[KWP_MAX_DATA];
+	size_t len;
+	int r = request(req,2,resp,&len);
+	if (r != KWP_OK)
+		return r;
+	if (len < 7 || resp[1] != 0x00)
+		return KWP_FAILED;
+	// set the limits as they are, the ECU promised them
+	req[1] = 0x03;
+	memcpy(req + 2,resp + 2,5);
+	KWP_TIMING t;
+	decode_timing(resp + 2,&t);
+	if ((r = request(req,7,resp,&len)) != KWP_OK)
+		return r;
+	timing = t;
+	if (setTiming())
+		return KWP_FAILED;
+	startKeepAlive();
+	return KWP_OK;
+}
+
+/** frame a request for the ECU, checksum included */
+void Kwp2000::build(PASSTHRU_MSG* msg, const unsigned char* data, size_t len, bool lengthByte)
+{
+	passthru_init(msg,ISO14230,0);
+	unsigned char *p = msg->Data;
+	bool extra = lengthByte || len > 0x3F;
+	*p++ = extra ? 0x80 : (unsigned char)(0x80 | len);
+	*p++ = target;
+	*p++ = source;
+	if (extra)
+		*p++ = (unsigned char)len;
+	memcpy(p,data,len);
+	p += len;
+	unsigned char cs = 0;
+	for (unsigned char *q = msg->Data; q < p; q++)
+		cs += *q;
+	*p++ = cs;
+	msg->DataSize = p - msg->Data;
+}
+
+/**
+ * @brief wait for the answer to the request tx
+ * @param sid - service of the request
+ * @param resp - receives the reply data (service ID on), KWP_MAX_DATA bytes
+ * @param deadline - give up at this time unless a reply is coming in
+ * @return KWP_OK, KWP_NEGATIVE, KWP_BAD_CHECKSUM or KWP_NO_REPLY
+ * @remark frames of other ECUs and response pending answers are skipped,
+ * the reply is returned as soon as its last byte is in
+ */
+int Kwp2000::receive(const PASSTHRU_MSG* tx, unsigned char sid, unsigned char* resp, size_t* respLen,
+	clk::time_point deadline)
+{
+	PASSTHRU_MSG rx, msg;
+	passthru_init(&rx,ISO14230,0);
+	bool echoChecked = false;
+	for (;;)
+	{
+		if (!echoChecked)
+		{
+			// the interface may pass the request on, K-line echoes every byte
+			size_t n = rx.DataSize < tx->DataSize ? rx.DataSize : tx->DataSize;
+			if (memcmp(rx.Data,tx->Data,n))
+				echoChecked = true;
+			else if (rx.DataSize >= tx->DataSize)
+			{
+				rx.DataSize -= tx->DataSize;
+				memmove(rx.Data,rx.Data + tx->DataSize,rx.DataSize);
+				echoChecked = true;
+			}
+		}
+		while (echoChecked && rx.DataSize)
+		{
+			KFRAME_INFO info;
+			int r = kframe_decode(KFRAME_KWP,rx.Data,rx.DataSize,&info);
+			if (r == 0)
+				break; // the rest is on its way
+			if (r == -1)
+				return KWP_BAD_CHECKSUM;
+			size_t used = 1;
+			if (r == 1)
+			{
+				const unsigned char *d = rx.Data + info.data;
+				used = info.size;
+				bool ours = info.target < 0 || (info.target == source && info.source == target);
+				if (ours && info.dataSize >= 3 && d[0] == KWP_NEGATIVE_RESPONSE && d[1] == sid)
+				{
+					if (d[2] != KWP_RESPONSE_PENDING)
+					{
+						negativeCode = d[2];
+						return KWP_NEGATIVE;
+					}
+					deadline = clk::now() + std::chrono::microseconds(timing.p3Max);
+				}
+				else if (ours && info.dataSize && d[0] == (sid | 0x40))
+				{
+					*respLen = info.dataSize;
+					memcpy(resp,d,info.dataSize);
+					reply = rx;
+					reply.DataSize = info.size;
+					return KWP_OK;
+				}
+			}
+			rx.DataSize -= used;
+			memmove(rx.Data,rx.Data + used,rx.DataSize);
+		}
+
+		clk::time_point now = clk::now();
+		if (now >= deadline)
+			return KWP_NO_REPLY;
+		unsigned long left = (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+		unsigned long numRxMsg = 1;
+		if (j2534->PassThruReadMsgs(chanID,&msg,&numRxMsg,left) || !numRxMsg)
+			continue;
+		if (msg.RxStatus & (START_OF_MESSAGE | TX_MSG_TYPE))
+			continue;
+		unsigned long size = msg.DataSize;
+		if (size > PASSTHRU_MSG_DATA_SIZE - rx.DataSize)
+			size = PASSTHRU_MSG_DATA_SIZE - rx.DataSize;
+		memcpy(rx.Data + rx.DataSize,msg.Data,size);
+		rx.DataSize += size;
+		rx.Timestamp = msg.Timestamp;
+		// a reply in progress may take longer than P2max in total
+		clk::time_point more = clk::now() + std::chrono::microseconds(timing.p2Max);
+		if (deadline < more)
+			deadline = more;
+	}
+}
+
+/**
+ * @brief one request / reply exchange with the ECU
+ * @param req - service ID and parameters
+ * @param resp - receives the positive reply, KWP_MAX_DATA bytes
+ * @param respLen - reply size
+ * @return KWP_OK, or the failure of the last attempt; negativeCode is set
+ * for KWP_NEGATIVE
+ * @remark the request is written without delay, the interface waits out
+ * P3min itself. A reply with a bad checksum, or none within P2max, is
+ * asked for again up to retries times. The keep-alive is held meanwhile.
+ */
+int Kwp2000::request(const unsigned char* req, size_t len, unsigned char* resp, size_t* respLen)
+{
+	if (!len || len > KWP_MAX_DATA)
+		return KWP_FAILED;
+	PASSTHRU_MSG tx;
+	build(&tx,req,len,lengthByte);
+	tx.TxFlags = WAIT_P3_MIN_ONLY;
+
+	int result = KWP_NO_REPLY;
+	keepAlive.hold();
+	for (int attempt = 0; attempt <= retries; attempt++)
+	{
+		if (attempt)
+			j2534->PassThruIoctl(chanID,CLEAR_RX_BUFFER,NULL,NULL);
+		unsigned long numMsgs = 1;
+		requests++;
+		if (j2534->PassThruWriteMsgs(chanID,&tx,&numMsgs,0))
+		{
+			result = KWP_FAILED;
+			continue;
+		}
+		// P3min in the interface, then about 1 ms per request byte on the wire
+		clk::time_point deadline = clk::now() + std::chrono::microseconds(timing.p3Min + timing.p2Max) +
+			std::chrono::milliseconds(tx.DataSize);
+		result = receive(&tx,req[0],resp,respLen,deadline);
+		if (result != KWP_NO_REPLY && result != KWP_BAD_CHECKSUM)
+			break;
+	}
+	keepAlive.release();
+	return result;
+}
+
+/**
+ * @brief readDataByLocalIdentifier
+ * @param data - receives the record, KWP_MAX_DATA bytes
+ * @param size - record size
+ */
+int Kwp2000::readLocalId(unsigned char lid, unsigned char* data, size_t* size)
+{
+	unsigned char req[2] = {KWP_READ_LOCAL_ID,lid};
+	unsigned char resp[KWP_MAX_DATA];
+	size_t len;
+	int r = request(req,sizeof(req),resp,&len);
+	if (r != KWP_OK)
+		return r;
+	if (len < 2 || resp[1] != lid)
+		return KWP_FAILED;
+	*size = len - 2;
+	memcpy(data,resp + 2,*size);
+	return KWP_OK;
+}
+
+/** end the session and close the channel */
+void Kwp2000::disconnect()
+{
+	if (!connected)
+		return;
+	keepAlive.stop();
+	static const unsigned char req[] = {KWP_STOP_COMMUNICATION};
+	PASSTHRU_MSG tx;
+	unsigned long numMsgs = 1;
+	build(&tx,req,sizeof(req),lengthByte);
+	// wait until it is out, the channel goes away next
+	j2534->PassThruWriteMsgs(chanID,&tx,&numMsgs,timing.p3Min / 1000 + 50);
+	j2534->PassThruDisconnect(chanID);
+	connected = false;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include "J2534.h"
+#include "keepalive.h"
+
+/*
+KWP2000 (ISO 14230) SESSION
+
+    Frames are built and checked here (kline_frame.h has the layout), the
+    interface runs with ISO9141_NO_CHECKSUM and only handles the bus timing.
+
+    init        fast: FAST_INIT with StartCommunication  81 -> C1 KB1 KB2
+                5 baud: FIVE_BAUD_INIT with the ECU address -> KB1 KB2
+                KB1 tells the header formats the ECU accepts: bit 0 length
+                in the format byte, bit 1 extra length byte
+    timing      AccessTimingParameters 83 00 reads the ECU's limits, 83 03
+                sets them, so P3min (the gap before the next request) drops
+                from 55 ms to what the ECU can do. The same P3min goes to
+                the interface with SET_CONFIG
+    requests    physical addressing, tester address F1 by default
+                21 xx readDataByLocalIdentifier -> 61 xx data
+                3E testerPresent -> 7E, sent by the interface while idle
+                7F sid 78 (response pending) extends the wait to P3max
+
+    A request is written with WAIT_P3_MIN_ONLY as soon as the previous
+    reply is complete by its length byte, without waiting for the P1 end of
+    message timeout on the host, so the interface holds the next request
+    ready and sends it right after P3min.
+*/
+
+#define KWP_START_COMMUNICATION 0x81
+#define KWP_STOP_COMMUNICATION 0x82
+#define KWP_ACCESS_TIMING 0x83
+#define KWP_READ_LOCAL_ID 0x21
+#define KWP_TESTER_PRESENT 0x3E
+#define KWP_NEGATIVE_RESPONSE 0x7F
+#define KWP_RESPONSE_PENDING 0x78	// negative response code
+
+#define KWP_TESTER_ADDRESS 0xF1
+#define KWP_MAX_DATA 255
+
+/** Kwp2000::init() modes */
+enum { KWP_FAST_INIT, KWP_FIVE_BAUD_INIT };
+
+/** Kwp2000::request() results */
+enum { KWP_OK, KWP_NO_REPLY, KWP_BAD_CHECKSUM, KWP_NEGATIVE, KWP_FAILED };
+
+/** session timing, us */
+typedef struct
+{
+	unsigned long p2Min;	// end of request to start of reply
+	unsigned long p2Max;
+	unsigned long p3Min;	// end of reply to next request
+	unsigned long p3Max;	// session times out
+	unsigned long p4Min;	// tester inter-byte gap
+} KWP_TIMING;
+
+// ISO 14230-2 normal timing
+const KWP_TIMING KWP_DEFAULT_TIMING = {25000, 50000, 55000, 5000000, 5000};
+
+/**
+ * @brief KWP2000 session with one ECU over a J2534 K-line channel
+ */
+class Kwp2000
+{
+public:
+	Kwp2000(J2534* j2534);
+	long connect(unsigned long devID, unsigned char target, unsigned char source);
+	int init(int mode);
+	int tuneTiming();
+	int request(const unsigned char* req, size_t len, unsigned char* resp, size_t* respLen);
+	int readLocalId(unsigned char lid, unsigned char* data, size_t* size);
+	void disconnect();
+
+	unsigned long chanID;
+	unsigned char target;		// ECU address
+	unsigned char source;		// tester address
+	unsigned char keyBytes[2];
+	KWP_TIMING timing;
+	int retries;				// extra attempts after a bad checksum or no reply
+	int negativeCode;			// of the last KWP_NEGATIVE
+	PASSTHRU_MSG reply;			// frame of the last positive reply, Timestamp of its end
+	unsigned long requests;		// written, retries included
+	KeepAlive keepAlive;		// tester present, held while requests go out
+
+private:
+	Kwp2000(const Kwp2000&);
+	Kwp2000& operator=(const Kwp2000&);
+	void build(PASSTHRU_MSG* msg, const unsigned char* data, size_t len, bool lengthByte);
+	int receive(const PASSTHRU_MSG* tx, unsigned char sid, unsigned char* resp, size_t* respLen,
+		std::chrono::steady_clock::time_point deadline);
+	long setTiming();
+	void startKeepAlive();
+
+	J2534* j2534;
+	bool connected;
+	bool lengthByte;			// ECU wants the extra length byte (KB1 AL0 clear)
+};
@@ -0,0 +1,86 @@
+#include "latency.h"
+
+unsigned int LatencyHistogram::bucket(unsigned long long us)
+{
+	if (us < LAT_LINEAR)
+		return (unsigned int)us;
+	unsigned int e = 63 - __builtin_clzll(us); // us >= 16, so e >= 4
+	if (e >= 36)
+		return LAT_BUCKETS - 1;
+	unsigned int sub = (unsigned int)(us >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1);
+	return LAT_LINEAR + ((e - 4) << LAT_SUB_BITS) + sub;
+}
+
+/** largest value that falls into bucket idx */
+unsigned long long LatencyHistogram::bucketTop(unsigned int idx)
+{
+	if (idx < LAT_LINEAR)
+		return idx;
+	unsigned int e = 4 + ((idx - LAT_LINEAR) >> LAT_SUB_BITS);
+	unsigned long long sub = (idx - LAT_LINEAR) & ((1 << LAT_SUB_BITS) - 1);
+	unsigned long long lo = ((1ULL << LAT_SUB_BITS) + sub) << (e - LAT_SUB_BITS);
+	return lo + (1ULL << (e - LAT_SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(unsigned long long us)
+{
+	buckets[bucket(us)].fetch_add(1,std::memory_order_relaxed);
+	total.fetch_add(1,std::memory_order_relaxed);
+	sum.fetch_add(us,std::memory_order_relaxed);
+	unsigned long long m = maxValue.load(std::memory_order_relaxed);
+	while (us > m && !maxValue.compare_exchange_weak(m,us,std::memory_order_relaxed))
+		;
+}
+
+void LatencyHistogram::reset()
+{
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+		buckets[i].store(0,std::memory_order_relaxed);
+	total.store(0,std::memory_order_relaxed);
+	sum.store(0,std::memory_order_relaxed);
+	maxValue.store(0,std::memory_order_relaxed);
+}
+
+/**
+ * @brief value below which the given share of the calls fall
+ * @param p - 0..1
+ * @return upper edge of the bucket holding the percentile, at most the max seen
+ */
+unsigned long long LatencyHistogram::percentile(double p) const
+{
+	unsigned long long n = count();
+	if (!n)
+		return 0;
+	unsigned long long rank = (unsigned long long)(p * n);
+	if (rank >= n)
+		rank = n - 1;
+	unsigned long long seen = 0;
+	unsigned long long top = 0;
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+	{
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen > rank)
+		{
+			top = bucketTop(i);
+			break;
+		}
+	}
+	unsigned long long m = maxValue.load(std::memory_order_relaxed);
+	return top < m ? top : m;
+}
+
+void LatencyHistogram::printHeader(FILE* fp)
+{
+	fprintf(fp,"%-28s %10s %10s %10s %10s %10s %10s\n","call (us)","count","mean","p50","p90","p99","max");
+}
+
+/** one line with count, mean, percentiles and max, nothing if never recorded */
+void LatencyHistogram::print(FILE* fp, const char* name) const
+{
+	unsigned long long n = count();
+	if (!n)
+		return;
+	fprintf(fp,"%-28s %10llu %10.1f %10llu %10llu %10llu %10llu\n",name,n,
+		(double)sum.load(std::memory_order_relaxed) / n,
+		percentile(0.5),percentile(0.9),percentile(0.99),maxValue.load(std::memory_order_relaxed));
+}
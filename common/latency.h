@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+
+// log-linear buckets: 0..15 us one per microsecond, then 8 per power of two
+// up to 2^36 us, so any value lands in a bucket at most 12.5% wide
+#define LAT_LINEAR 16
+#define LAT_SUB_BITS 3
+#define LAT_BUCKETS (LAT_LINEAR + (36 - 4) * (1 << LAT_SUB_BITS))
+
+/**
+ * @brief lock-free latency histogram
+ * @remark record() is a few relaxed atomic adds, any thread may call it
+ * while another one prints. Values are microseconds.
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram() { reset(); };
+	void record(unsigned long long us);
+	void reset();
+	unsigned long long count() const { return total.load(std::memory_order_relaxed); };
+	unsigned long long percentile(double p) const;
+	void print(FILE* fp, const char* name) const;
+	static void printHeader(FILE* fp);
+
+private:
+	static unsigned int bucket(unsigned long long us);
+	static unsigned long long bucketTop(unsigned int idx);
+
+	std::atomic<unsigned long long> buckets[LAT_BUCKETS];
+	std::atomic<unsigned long long> total;
+	std::atomic<unsigned long long> sum;
+	std::atomic<unsigned long long> maxValue;
+};
@@ -0,0 +1,268 @@
+#include <string.h>
+#include "lzblock.h"
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#define lz_fseek _fseeki64
+#define lz_ftell _ftelli64
+#else
+#define lz_fseek fseeko
+#define lz_ftell ftello
+#endif
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static unsigned long read32(const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v,p,4);
+	return v;
+}
+
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+/**
+ * @brief compress one block
+ * @param src - raw data
+ * @param srcLen - size of the raw data
+ * @param dst - destination, at least LZ_BOUND(srcLen) bytes
+ * @return compressed size
+ */
+size_t lz_compress(const unsigned char *src, size_t srcLen, unsigned char *dst)
+{
+	unsigned int table[1 << LZ_HASH_BITS];
+	unsigned char *op = dst;
+	size_t ip = 0;
+	size_t anchor = 0;
+
+	memset(table,0,sizeof(table));
+	while (srcLen >= LZ_MIN_MATCH && ip <= srcLen - LZ_MIN_MATCH)
+	{
+		unsigned long seq = read32(src + ip);
+		unsigned int h = (unsigned int)((seq * 2654435761U) & 0xFFFFFFFFU) >> (32 - LZ_HASH_BITS);
+		size_t ref = table[h];
+		table[h] = (unsigned int)ip;
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq)
+		{
+			ip += 1 + ((ip - anchor) >> 6); // skip faster through incompressible data
+			continue;
+		}
+
+		size_t len = LZ_MIN_MATCH;
+		while (ip + len < srcLen && src[ref + len] == src[ip + len])
+			len++;
+
+		size_t lit = ip - anchor;
+		unsigned char *token = op++;
+		*token = (unsigned char)(((lit < 15 ? lit : 15) << 4) | (len - LZ_MIN_MATCH < 15 ? len - LZ_MIN_MATCH : 15));
+		if (lit >= 15)
+			op = put_length(op,lit - 15);
+		memcpy(op,src + anchor,lit);
+		op += lit;
+		*op++ = (unsigned char)(ip - ref);
+		*op++ = (unsigned char)((ip - ref) >> 8);
+		if (len - LZ_MIN_MATCH >= 15)
+			op = put_length(op,len - LZ_MIN_MATCH - 15);
+
+		ip += len;
+		anchor = ip;
+	}
+
+	// trailing literals
+	size_t lit = srcLen - anchor;
+	*op++ = (unsigned char)((lit < 15 ? lit : 15) << 4);
+	if (lit >= 15)
+		op = put_length(op,lit - 15);
+	memcpy(op,src + anchor,lit);
+	op += lit;
+	return op - dst;
+} //..lz_compress
+
+/**
+ * @brief decompress one block, input is fully bounds checked
+ * @param src - compressed data
+ * @param srcLen - size of the compressed data
+ * @param dst - destination
+ * @param dstCap - size of the destination
+ * @return decompressed size or -1 on corrupt data
+ */
+long lz_decompress(const unsigned char *src, size_t srcLen, unsigned char *dst, size_t dstCap)
+{
+	const unsigned char *ip = src;
+	const unsigned char *end = src + srcLen;
+	unsigned char *op = dst;
+	unsigned char *opEnd = dst + dstCap;
+
+	while (ip < end)
+	{
+		unsigned int token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if (ip >= end)
+					return -1;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > (size_t)(end - ip) || lit > (size_t)(opEnd - op))
+			return -1;
+		memcpy(op,ip,lit);
+		op += lit;
+		ip += lit;
+		if (ip == end)
+			break; // last sequence has no match
+
+		if (end - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+
+		size_t len = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if (ip >= end)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (size_t)(opEnd - op))
+			return -1;
+		const unsigned char *ref = op - offset;
+		for (size_t i = 0; i < len; i++) // may overlap
+			op[i] = ref[i];
+		op += len;
+	}
+	return (long)(op - dst);
+} //..lz_decompress
+
+static void put_le32(unsigned char *buf, unsigned long v)
+{
+	buf[0] = (unsigned char)v;
+	buf[1] = (unsigned char)(v >> 8);
+	buf[2] = (unsigned char)(v >> 16);
+	buf[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned long get_le32(const unsigned char *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+/**
+ * @brief compressed file header
+ * @param buf - destination, at least 5 + capHeaderLen bytes
+ * @param capHeader - capture header to embed, may be NULL
+ * @param capHeaderLen - its size, up to 255
+ * @return bytes written
+ */
+size_t lzb_encode_header(unsigned char *buf, const void *capHeader, size_t capHeaderLen)
+{
+	memcpy(buf,LZB_MAGIC,4);
+	buf[4] = (unsigned char)capHeaderLen;
+	memcpy(buf + 5,capHeader,capHeaderLen);
+	return 5 + capHeaderLen;
+}
+
+/**
+ * @brief compress raw capture bytes into one block
+ * @param buf - destination, at least LZB_BLOCK_HEADER + LZ_BOUND(rawLen) bytes
+ * @param raw - capture bytes, cut at a message boundary
+ * @param rawLen - their size
+ * @param tsBase - timestamp of the last message before the block
+ * @return bytes written
+ */
+size_t lzb_encode_block(unsigned char *buf, const unsigned char *raw, size_t rawLen, unsigned long tsBase)
+{
+	size_t stored = lz_compress(raw,rawLen,buf + LZB_BLOCK_HEADER);
+	if (stored >= rawLen)
+	{
+		memcpy(buf + LZB_BLOCK_HEADER,raw,rawLen);
+		stored = rawLen;
+	}
+	put_le32(buf,rawLen);
+	put_le32(buf + 4,stored);
+	put_le32(buf + 8,tsBase);
+	return LZB_BLOCK_HEADER + stored;
+}
+
+/**
+ * @brief locate all blocks by hopping over their headers
+ * @param fp - compressed capture
+ * @param capHeader - receives the embedded capture header, 255 bytes
+ * @param capHeaderLen - receives its size
+ * @param blocks - receives the block list, a truncated last block is left out
+ * @return 1 on success, 0 if the file isn't a compressed capture
+ */
+int lzb_read_index(FILE *fp, unsigned char *capHeader, size_t *capHeaderLen, std::vector<LZB_BLOCK> &blocks)
+{
+	unsigned char buf[LZB_BLOCK_HEADER];
+	if (fread(buf,1,5,fp) != 5 || memcmp(buf,LZB_MAGIC,4))
+		return 0;
+	*capHeaderLen = buf[4];
+	if (fread(capHeader,1,*capHeaderLen,fp) != *capHeaderLen)
+		return 0;
+
+	lz_fseek(fp,0,SEEK_END);
+	long long size = lz_ftell(fp);
+	long long pos = 5 + *capHeaderLen;
+	blocks.clear();
+	while (pos + LZB_BLOCK_HEADER <= size)
+	{
+		lz_fseek(fp,pos,SEEK_SET);
+		if (fread(buf,1,LZB_BLOCK_HEADER,fp) != LZB_BLOCK_HEADER)
+			break;
+		LZB_BLOCK blk;
+		blk.offset = pos + LZB_BLOCK_HEADER;
+		blk.rawSize = get_le32(buf);
+		blk.storedSize = get_le32(buf + 4);
+		blk.tsBase = get_le32(buf + 8);
+		if (blk.storedSize > blk.rawSize || blk.offset + (long long)blk.storedSize > size)
+			break;
+		blocks.push_back(blk);
+		pos = blk.offset + blk.storedSize;
+	}
+	return 1;
+}
+
+/**
+ * @brief read and decompress one block
+ * @param fp - compressed capture
+ * @param blk - block from lzb_read_index()
+ * @param raw - destination
+ * @param rawCap - size of the destination
+ * @return raw size or -1 on error
+ */
+long lzb_read_block(FILE *fp, const LZB_BLOCK *blk, unsigned char *raw, size_t rawCap)
+{
+	if (blk->rawSize > rawCap)
+		return -1;
+	lz_fseek(fp,blk->offset,SEEK_SET);
+	if (blk->storedSize == blk->rawSize)
+		return fread(raw,1,blk->rawSize,fp) == blk->rawSize ? (long)blk->rawSize : -1;
+
+	std::vector<unsigned char> stored(blk->storedSize);
+	if (fread(&stored[0],1,blk->storedSize,fp) != blk->storedSize)
+		return -1;
+	long n = lz_decompress(&stored[0],blk->storedSize,raw,rawCap);
+	return n == (long)blk->rawSize ? n : -1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+KLOGGER COMPRESSED CAPTURE (/z)
+
+    Built-in LZ77 codec in the LZ4 block style: a token byte holds the
+    literal count and match length (4 bits each, 15 = more length bytes
+    follow, 255 per byte), then the literals, then a 2-byte little endian
+    match offset. The last sequence is literals only. Every block is
+    compressed on its own, so any block can be decoded without the others.
+
+    file header
+        4B   magic "KLZ1"
+        1B   size of the embedded capture header
+        ...  capture header (KLOG binary header, empty for text captures)
+    blocks, back to back until EOF
+        4B   raw size, little endian
+        4B   stored size, equal to raw size if the block is stored uncompressed
+        4B   timestamp of the last message before the block (binary delta base)
+        ...  stored bytes
+
+    Raw blocks are cut at message boundaries. Header and raw blocks put
+    together give the uncompressed capture.
+*/
+
+#define LZB_MAGIC "KLZ1"
+#define LZB_BLOCK_SIZE (64*1024)	// raw bytes collected before a block is compressed
+#define LZB_BLOCK_HEADER 12
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/** block located by lzb_read_index() */
+typedef struct
+{
+	long long offset;		// file offset of the stored bytes
+	unsigned long rawSize;
+	unsigned long storedSize;
+	unsigned long tsBase;
+} LZB_BLOCK;
+
+size_t lz_compress(const unsigned char *src, size_t srcLen, unsigned char *dst);
+long lz_decompress(const unsigned char *src, size_t srcLen, unsigned char *dst, size_t dstCap);
+
+size_t lzb_encode_header(unsigned char *buf, const void *capHeader, size_t capHeaderLen);
+size_t lzb_encode_block(unsigned char *buf, const unsigned char *raw, size_t rawLen, unsigned long tsBase);
+int lzb_read_index(FILE *fp, unsigned char *capHeader, size_t *capHeaderLen, std::vector<LZB_BLOCK> &blocks);
+long lzb_read_block(FILE *fp, const LZB_BLOCK *blk, unsigned char *raw, size_t rawCap);
@@ -0,0 +1,71 @@
+#pragma once
+
+// console helpers the tools use from the Windows CRT, with POSIX versions
+// so klogger and hd also build on Linux/macOS (e.g. against the replay library)
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#include <windows.h>
+#include <conio.h>
+#include <tchar.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+typedef char _TCHAR;
+#define _tmain main
+
+static struct termios platform_saved_tty;
+
+static void platform_restore_tty()
+{
+	tcsetattr(STDIN_FILENO,TCSANOW,&platform_saved_tty);
+}
+
+/** key pressed? Never true when stdin isn't a terminal, so runs can be scripted */
+static inline int _kbhit()
+{
+	static bool raw = false;
+	if (!isatty(STDIN_FILENO))
+		return 0;
+	if (!raw)
+	{
+		// unbuffered, no echo, restored at exit
+		struct termios t;
+		tcgetattr(STDIN_FILENO,&platform_saved_tty);
+		t = platform_saved_tty;
+		t.c_lflag &= ~(ICANON | ECHO);
+		tcsetattr(STDIN_FILENO,TCSANOW,&t);
+		atexit(platform_restore_tty);
+		raw = true;
+	}
+	fd_set fds;
+	struct timeval tv = {0,0};
+	FD_ZERO(&fds);
+	FD_SET(STDIN_FILENO,&fds);
+	return select(STDIN_FILENO + 1,&fds,NULL,NULL,&tv) > 0;
+}
+
+static inline int _getch()
+{
+	unsigned char c;
+	return read(STDIN_FILENO,&c,1) == 1 ? c : EOF;
+}
+
+static inline void Sleep(unsigned long ms)
+{
+	usleep(ms * 1000);
+}
+#endif
+
+/** command line switch? /x is one on Windows only, elsewhere it is an absolute path */
+static inline bool is_switch(const char* arg)
+{
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+	return arg[0] == '/' || arg[0] == '-';
+#else
+	return arg[0] == '-';
+#endif
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pollsched.h"
+
+typedef std::chrono::steady_clock clk;
+
+/**
+ * @brief parse a poll list, e.g. "11:20,13:5,17"
+ * @param items - filled in list order
+ * @param max - size of items
+ * @param spec - comma separated hex IDs (00..FF), each optionally followed
+ * by :rate in samples/s; changed by strtok
+ * @return number of items, -1 if spec is malformed or too long
+ */
+int poll_parse(POLL_ITEM *items, int max, char *spec)
+{
+	int count = 0;
+	for (char *s = strtok(spec,","); s; s = strtok(NULL,","))
+	{
+		char *end;
+		unsigned long id = strtoul(s,&end,16);
+		if (count >= max || end == s || id > 0xFF || (*end && *end != ':'))
+			return -1;
+		POLL_ITEM *it = &items[count++];
+		*it = POLL_ITEM();
+		it->id = (unsigned int)id;
+		it->rate = *end == ':' ? atof(end + 1) : 0;
+		if (it->rate < 0)
+			return -1;
+	}
+	return count;
+}
+
+/** everything is due now, counters cleared */
+void poll_start(POLL_SCHEDULE *ps, POLL_ITEM *items, int count)
+{
+	ps->items = items;
+	ps->count = count;
+	ps->rr = count - 1;
+	ps->active = count;
+	ps->silent = 0;
+	ps->start = clk::now();
+	for (int i = 0; i < count; i++)
+	{
+		items[i].next = ps->start;
+		items[i].samples = 0;
+		items[i].errors = 0;
+		items[i].failures = 0;
+		items[i].dropped = false;
+		items[i].silent = false;
+		if (items[i].rate > 0)
+			items[i].period = std::chrono::duration_cast<clk::duration>(std::chrono::duration<double>(1.0 / items[i].rate));
+	}
+}
+
+/**
+ * @brief pick the item to poll next and book its slot
+ * @param wake - set to when the next item is due if none is now
+ * @return item index, -1 if none is due
+ */
+int poll_next(POLL_SCHEDULE *ps, clk::time_point now, clk::time_point *wake)
+{
+	POLL_ITEM *items = ps->items;
+	for (int i = 0; i < ps->count; i++)
+		if (!items[i].dropped && items[i].rate > 0 && items[i].next <= now)
+		{
+			items[i].next += items[i].period;
+			if (items[i].next < now)
+				items[i].next = now;
+			return i;
+		}
+	for (int k = 1; k <= ps->count; k++)
+	{
+		int i = (ps->rr + k) % ps->count;
+		if (!items[i].dropped && items[i].rate <= 0)
+		{
+			ps->rr = i;
+			return i;
+		}
+	}
+	*wake = now + std::chrono::seconds(1);
+	for (int i = 0; i < ps->count; i++)
+		if (!items[i].dropped && items[i].next < *wake)
+			*wake = items[i].next;
+	return -1;
+}
+
+/** the ECU answered, whatever it said */
+static void poll_answered(POLL_SCHEDULE *ps)
+{
+	for (int i = 0; ps->silent && i < ps->count; i++)
+		if (ps->items[i].silent)
+		{
+			ps->items[i].silent = false;
+			ps->silent--;
+		}
+}
+
+/** item i was answered */
+void poll_sampled(POLL_SCHEDULE *ps, int i)
+{
+	poll_answered(ps);
+	ps->items[i].samples++;
+	ps->items[i].failures = 0;
+}
+
+/**
+ * @brief item i got a bad reply or none
+ * @param answered - false if the ECU didn't reply at all
+ * @return true if that dropped it from the schedule
+ */
+bool poll_failed(POLL_SCHEDULE *ps, int i, bool answered)
+{
+	POLL_ITEM *it = &ps->items[i];
+	if (answered)
+		poll_answered(ps);
+	else if (!it->silent)
+	{
+		it->silent = true;
+		ps->silent++;
+	}
+	it->errors++;
+	if (it->dropped || ++it->failures < POLL_DROP_AFTER)
+		return false;
+	it->dropped = true;
+	ps->active--;
+	return true;
+}
+
+/**
+ * @brief print target and achieved rate per item and in total
+ * @param idName - column title of the IDs, e.g. "table"
+ * @return achieved samples/s of all items
+ */
+double poll_report(FILE *fp, const POLL_SCHEDULE *ps, const char *idName)
+{
+	double elapsed = std::chrono::duration<double>(clk::now() - ps->start).count();
+	unsigned long total = 0;
+	fprintf(fp,"\n%5s  target/s  samples/s  samples  errors\n",idName);
+	for (int i = 0; i < ps->count; i++)
+	{
+		const POLL_ITEM *it = &ps->items[i];
+		total += it->samples;
+		if (it->rate > 0)
+			fprintf(fp,"   %02X  %8.1f",it->id,it->rate);
+		else
+			fprintf(fp,"   %02X       max",it->id);
+		fprintf(fp,"  %9.1f  %7lu  %6lu%s\n",elapsed > 0 ? it->samples / elapsed : 0.0,it->samples,it->errors,it->dropped ? "  dropped" : "");
+	}
+	double rate = elapsed > 0 ? total / elapsed : 0.0;
+	fprintf(fp,"%lu samples in %.1f s, %.1f/s\n",total,elapsed,rate);
+	return rate;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+
+#define POLL_DROP_AFTER 3	// failed polls in a row that take an item off the schedule
+
+/**
+ * @brief one value a datalogger polls (Honda data table, KWP2000 local
+ * identifier), with its target rate and what was achieved
+ */
+typedef struct
+{
+	unsigned int id;
+	double rate;			// target samples/s, 0 - whatever the bus has left
+	std::chrono::steady_clock::duration period;	// 1 / rate
+	std::chrono::steady_clock::time_point next;	// when the next sample is due
+	unsigned long samples;	// good replies
+	unsigned long errors;	// bad, missing or foreign replies
+	unsigned int failures;	// errors since the last sample
+	bool dropped;			// not polled any more
+	bool silent;			// unanswered since the last answer to any item
+} POLL_ITEM;
+
+/**
+ * @brief priority scheduler of the polled values
+ * @remark items are in priority order, highest first. A due item with a
+ * rate goes first; the gaps are filled with the items without a rate, in
+ * turn. An item that falls behind is polled as often as the bus allows,
+ * not in a burst to catch up. An item that fails POLL_DROP_AFTER times in
+ * a row, e.g. an ID the ECU doesn't know, is dropped so it doesn't keep
+ * the bus time of the others. A due item with a rate is polled back to
+ * back while it fails, so only different items going unanswered in a row
+ * (silent) tell that the ECU itself is gone.
+ */
+typedef struct
+{
+	POLL_ITEM *items;
+	int count;
+	int rr;		// round robin position of the items without a rate
+	int active;	// items not dropped
+	int silent;	// different items unanswered since the last answer
+	std::chrono::steady_clock::time_point start;
+} POLL_SCHEDULE;
+
+int poll_parse(POLL_ITEM *items, int max, char *spec);
+void poll_start(POLL_SCHEDULE *ps, POLL_ITEM *items, int count);
+int poll_next(POLL_SCHEDULE *ps, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point *wake);
+void poll_sampled(POLL_SCHEDULE *ps, int i);
+bool poll_failed(POLL_SCHEDULE *ps, int i, bool answered);
+double poll_report(FILE *fp, const POLL_SCHEDULE *ps, const char *idName);
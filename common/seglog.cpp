@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <string.h>
+#include "seglog.h"
+#include "uringlog.h"
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#define SEG_NONE INVALID_HANDLE_VALUE
+
+static SEG_FILE seg_create(const char* name, bool direct)
+{
+	(void)direct; // no io_uring, never set
+	return CreateFileA(name,GENERIC_WRITE,FILE_SHARE_READ,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+}
+
+static bool seg_write(SEG_FILE f, const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+	while (len)
+	{
+		DWORD done;
+		if (!WriteFile(f,p,(DWORD)len,&done,NULL))
+			return false;
+		p += done;
+		len -= done;
+	}
+	return true;
+}
+
+// reserves disk space without moving end of file, so a crash leaves no zero tail
+static void seg_reserve(SEG_FILE f, unsigned long long bytes)
+{
+	FILE_ALLOCATION_INFO ai;
+	ai.AllocationSize.QuadPart = bytes;
+	SetFileInformationByHandle(f,FileAllocationInfo,&ai,sizeof(ai));
+}
+
+static void seg_sync(SEG_FILE f)
+{
+	FlushFileBuffers(f);
+}
+
+static void seg_close(SEG_FILE f, unsigned long long size)
+{
+	(void)size; // NTFS drops the unused allocation on close
+	CloseHandle(f);
+}
+
+static void seg_delete(const char* name)
+{
+	DeleteFileA(name);
+}
+
+static void seg_attach(UringWriter* uring, SEG_FILE f)
+{
+	(void)uring; // no io_uring, never set
+	(void)f;
+}
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SEG_NONE -1
+
+static SEG_FILE seg_create(const char* name, bool direct)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+	if (direct)
+	{
+		int f = ::open(name,flags | O_DIRECT,0644);
+		if (f >= 0 || errno != EINVAL)
+			return f;
+		// the file system doesn't do O_DIRECT, padded writes work cached as well
+	}
+#else
+	(void)direct;
+#endif
+	return ::open(name,flags,0644);
+}
+
+static bool seg_write(SEG_FILE f, const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+	while (len)
+	{
+		ssize_t done = ::write(f,p,len);
+		if (done <= 0)
+			return false;
+		p += done;
+		len -= done;
+	}
+	return true;
+}
+
+// reserves disk space without moving end of file, so a crash leaves no zero tail
+static void seg_reserve(SEG_FILE f, unsigned long long bytes)
+{
+#if defined(__linux__)
+	fallocate(f,FALLOC_FL_KEEP_SIZE,0,bytes);
+#else
+	(void)f;
+	(void)bytes;
+#endif
+}
+
+static void seg_sync(SEG_FILE f)
+{
+#if defined(__linux__)
+	fdatasync(f);
+#else
+	fsync(f);
+#endif
+}
+
+static void seg_close(SEG_FILE f, unsigned long long size)
+{
+	if (ftruncate(f,size) == 0) // give back space reserved past the data
+		seg_sync(f);
+	::close(f);
+}
+
+static void seg_delete(const char* name)
+{
+	unlink(name);
+}
+
+static void seg_attach(UringWriter* uring, SEG_FILE f)
+{
+	uring->attach(f);
+}
+#endif
+
+SegmentedLog::SegmentedLog()
+{
+	basePath[0] = 0;
+	headerLen = 0;
+	maxBytes = 0;
+	maxSeconds = 0;
+	syncInterval = SEG_SYNC_INTERVAL;
+	uring = NULL;
+	direct = false;
+	current = SEG_NONE;
+	next = SEG_NONE;
+	index = 0;
+	written = 0;
+	total = 0;
+	reserved = 0;
+	writtenShared = 0;
+	preparing = false;
+	rotating = false;
+	stopping = false;
+}
+
+SegmentedLog::~SegmentedLog()
+{
+	close();
+	delete uring;
+}
+
+/**
+ * @brief enable rotation, call before open()
+ * @param maxBytes - start a new segment at this size, 0 - no size limit
+ * @param maxSeconds - start a new segment at this age, 0 - no age limit
+ */
+void SegmentedLog::setRotation(unsigned long long maxBytes, unsigned long maxSeconds)
+{
+	this->maxBytes = maxBytes;
+	this->maxSeconds = maxSeconds;
+}
+
+/**
+ * @brief write through io_uring, call before open()
+ * @param direct - bypass the page cache (O_DIRECT)
+ * @return false if io_uring isn't available, plain writes are used
+ */
+bool SegmentedLog::useUring(bool direct)
+{
+	UringWriter* u = new UringWriter();
+	if (!u->init(direct))
+	{
+		delete u;
+		return false;
+	}
+	delete uring;
+	uring = u;
+	this->direct = direct;
+	return true;
+}
+
+void SegmentedLog::segmentName(char* name, unsigned int idx)
+{
+	if (!maxBytes && !maxSeconds)
+	{
+		strcpy(name,basePath);
+		return;
+	}
+
+	// capture.txt -> capture.0001.txt
+	const char* dot = strrchr(basePath,'.');
+	const char* sep = strrchr(basePath,'/');
+	const char* bsep = strrchr(basePath,'\\');
+	if (bsep > sep)
+		sep = bsep;
+	if (!dot || (sep && dot < sep))
+		dot = basePath + strlen(basePath);
+	sprintf(name,"%.*s.%04u%s",(int)(dot - basePath),basePath,idx,dot);
+}
+
+/** create segment idx and reserve its expected size */
+SEG_FILE SegmentedLog::create(unsigned int idx)
+{
+	char name[1100];
+	segmentName(name,idx);
+	SEG_FILE f = seg_create(name,direct);
+	if (f != SEG_NONE)
+		seg_reserve(f,maxBytes ? maxBytes + 4096 : SEG_PREALLOC_STEP);
+	return f;
+}
+
+/**
+ * @brief create the first segment and start the sync thread
+ * @param path - log file name
+ * @param header - bytes repeated at the start of every segment, may be NULL
+ * @param headerLen - size of the header
+ * @return false if the file can't be created
+ */
+bool SegmentedLog::open(const char* path, const void* header, size_t headerLen)
+{
+	if (strlen(path) >= sizeof(basePath) || headerLen > sizeof(this->header))
+		return false;
+	strcpy(basePath,path);
+	memcpy(this->header,header,headerLen);
+	this->headerLen = headerLen;
+
+	index = 1;
+	if ((current = create(index)) == SEG_NONE)
+		return false;
+	if (uring)
+		seg_attach(uring,current);
+	reserved = maxBytes ? maxBytes + 4096 : SEG_PREALLOC_STEP;
+	written = 0;
+	opened = std::chrono::steady_clock::now();
+	if (headerLen && !write(header,headerLen))
+		return false;
+
+	stopping = false;
+	syncer = std::thread(&SegmentedLog::syncThread,this);
+	return true;
+}
+
+/**
+ * @brief check whether the segment is full
+ * @param pending - bytes the caller is about to write
+ * @return true if the caller should rotate() before writing them
+ */
+bool SegmentedLog::due(size_t pending)
+{
+	if (maxBytes && written > headerLen && written + pending >= maxBytes)
+		return true;
+	if (maxSeconds && std::chrono::steady_clock::now() - opened >= std::chrono::seconds(maxSeconds))
+		return true;
+	return false;
+}
+
+/**
+ * @brief switch to the next segment, normally prepared by the sync thread
+ * @return false if the new segment can't be created
+ */
+bool SegmentedLog::rotate()
+{
+	// the sync thread closes the old segment once retired
+	if (uring)
+		uring->drain();
+	SEG_FILE n;
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		while (preparing)
+			ready.wait(lk); // rotating faster than segments are created
+		n = next;
+		next = SEG_NONE;
+		// index + 1 is ours until index moves on, or the sync thread could
+		// create it again and truncate it
+		rotating = true;
+	}
+	if (n == SEG_NONE)
+		n = create(index + 1);
+	if (n != SEG_NONE && uring)
+		seg_attach(uring,n);
+
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		rotating = false;
+		if (n == SEG_NONE)
+			return false;
+		RETIRED r = {current,written};
+		retired.push_back(r);
+		current = n;
+		index++;
+		reserved = maxBytes ? maxBytes + 4096 : SEG_PREALLOC_STEP;
+		writtenShared = 0;
+	}
+	wake.notify_one();
+
+	written = 0;
+	opened = std::chrono::steady_clock::now();
+	return headerLen ? write(header,headerLen) : true;
+}
+
+/** append data to the current segment */
+bool SegmentedLog::write(const void* data, size_t len)
+{
+	if (current == SEG_NONE)
+		return false;
+	if (uring ? !uring->write(data,len) : !seg_write(current,data,len))
+		return false;
+	written += len;
+	total += len;
+	if (!maxBytes && written + SEG_PREALLOC_STEP / 2 > reserved)
+	{
+		// running into the reserved space, let the sync thread extend it
+		std::lock_guard<std::mutex> lk(lock);
+		writtenShared = written;
+		wake.notify_one();
+	}
+	return true;
+}
+
+/** the writer is idle: submit io_uring data still held in memory */
+void SegmentedLog::flush()
+{
+	if (!uring || current == SEG_NONE)
+		return;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	// a direct flush rewrites its last block, not worth it every idle moment
+	if (direct && now - flushed < std::chrono::milliseconds(syncInterval))
+		return;
+	flushed = now;
+	uring->flush();
+}
+
+/**
+ * @brief background work: periodic sync, preallocation, next segment
+ * creation and closing of retired segments. File handles are only used
+ * outside the lock, the writer never waits for disk I/O here.
+ */
+void SegmentedLog::syncThread()
+{
+	std::unique_lock<std::mutex> lk(lock);
+	while (!stopping)
+	{
+		wake.wait_for(lk,std::chrono::milliseconds(syncInterval));
+
+		std::vector<RETIRED> done;
+		done.swap(retired);
+		SEG_FILE cur = current;
+		unsigned long long extend = 0;
+		if (!maxBytes && writtenShared + SEG_PREALLOC_STEP / 2 > reserved)
+			extend = reserved + SEG_PREALLOC_STEP;
+		preparing = (maxBytes || maxSeconds) && next == SEG_NONE && !rotating;
+		unsigned int nextIndex = index + 1;
+		lk.unlock();
+
+		for (size_t i = 0; i < done.size(); i++)
+			seg_close(done[i].file,done[i].size);
+		if (extend)
+			seg_reserve(cur,extend);
+		seg_sync(cur);
+		SEG_FILE n = preparing ? create(nextIndex) : SEG_NONE;
+
+		lk.lock();
+		if (extend && cur == current)
+			reserved = extend;
+		if (preparing)
+		{
+			next = n; // rotate() waits for this, so index hasn't moved
+			preparing = false;
+			ready.notify_one();
+		}
+	}
+}
+
+/** stop the sync thread, sync and close all segments */
+void SegmentedLog::close()
+{
+	if (syncer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		syncer.join();
+	}
+
+	for (size_t i = 0; i < retired.size(); i++)
+		seg_close(retired[i].file,retired[i].size);
+	retired.clear();
+	if (next != SEG_NONE)
+	{
+		// prepared but never used
+		char name[1100];
+		seg_close(next,0);
+		segmentName(name,index + 1);
+		seg_delete(name);
+		next = SEG_NONE;
+	}
+	if (current != SEG_NONE)
+	{
+		if (uring)
+			uring->drain();
+		seg_close(current,written);
+		current = SEG_NONE;
+	}
+}
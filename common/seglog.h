@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <chrono>
+
+#if defined(_WIN32) || defined(WIN32) || defined (_WIN64) || defined (WIN64)
+#include <windows.h>
+typedef HANDLE SEG_FILE;
+#else
+typedef int SEG_FILE;
+#endif
+
+class UringWriter;
+
+#define SEG_PREALLOC_STEP (64ULL*1024*1024)	// allocation ahead of the write position without size rotation
+#define SEG_SYNC_INTERVAL 1000				// default ms between background syncs
+
+/**
+ * @brief log file split into segments by size and/or age
+ * @remark one writer thread calls due()/rotate()/write(). A background
+ * thread syncs the current segment every sync interval. It also keeps
+ * space preallocated ahead of the writer, creates the next segment in
+ * advance and closes retired ones. The writer only ever issues plain
+ * writes. At most one sync interval of written data is lost on a crash.
+ *
+ * On Linux the writes can go through io_uring instead (useUring()), so a
+ * stalling disk doesn't block the writer until all UringWriter buffers are
+ * in flight. rotate() and close() wait for the segment's writes to finish.
+ * Data can wait in a partly filled buffer until the writer calls flush()
+ * when it has nothing to write. With O_DIRECT flush() submits at most once
+ * a sync interval, each time rewriting the last 4 KB block, so up to two
+ * sync intervals of data are lost on a crash.
+ *
+ * Without rotation the file is written to path unchanged, otherwise
+ * segments are named name.0001.ext, name.0002.ext, ...
+ */
+class SegmentedLog
+{
+public:
+	SegmentedLog();
+	~SegmentedLog();
+	void setRotation(unsigned long long maxBytes, unsigned long maxSeconds);
+	void setSyncInterval(unsigned long ms) { syncInterval = ms; };
+	bool useUring(bool direct);
+	bool open(const char* path, const void* header, size_t headerLen);
+	bool due(size_t pending);
+	bool rotate();
+	bool write(const void* data, size_t len);
+	void flush();
+	void close();
+	unsigned int segment() const { return index; };
+	unsigned long long totalBytes() const { return total; };
+	const UringWriter* uringWriter() const { return uring; };
+
+private:
+	typedef struct
+	{
+		SEG_FILE file;
+		unsigned long long size;
+	} RETIRED;
+
+	SEG_FILE create(unsigned int idx);
+	void segmentName(char* name, unsigned int idx);
+	void syncThread();
+
+	char basePath[1024];
+	char header[256];
+	size_t headerLen;
+	unsigned long long maxBytes;
+	unsigned long maxSeconds;
+	unsigned long syncInterval;
+	UringWriter* uring;			// NULL - plain writes
+	bool direct;				// segments opened with O_DIRECT
+
+	// writer side
+	SEG_FILE current;
+	unsigned int index;
+	unsigned long long written;
+	unsigned long long total;
+	std::chrono::steady_clock::time_point opened;
+	std::chrono::steady_clock::time_point flushed;	// last io_uring flush
+
+	// shared with the sync thread, guarded by lock
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable ready;
+	SEG_FILE next;				// prepared segment index+1, or none
+	bool preparing;				// sync thread is creating next
+	bool rotating;				// rotate() is creating index+1 itself
+	unsigned long long reserved;	// bytes allocated in current
+	unsigned long long writtenShared;
+	std::vector<RETIRED> retired;
+	bool stopping;
+	std::thread syncer;
+};
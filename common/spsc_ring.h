@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * @brief bounded lock-free single-producer/single-consumer ring
+ * @remark the producer thread calls reserve()/commit()/overrun(), the
+ * consumer thread calls front()/pop(). Slots are preallocated, so neither
+ * side ever allocates or blocks. reserve() hands out contiguous slots so
+ * PassThruReadMsgs can fill them in place.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+	/** @param capacity - number of slots, rounded up to a power of two */
+	SpscRing(size_t capacity)
+	{
+		size_t cap = 1;
+		while (cap < capacity)
+			cap <<= 1;
+		slots = new T[cap];
+		mask = cap - 1;
+		head.store(0);
+		tail.store(0);
+		hwm.store(0);
+		overrunCnt.store(0);
+	}
+	~SpscRing() { delete[] slots; }
+
+	/**
+	 * @brief producer: get up to *count free contiguous slots
+	 * @param count - in: slots wanted, out: slots available (may be 0)
+	 * @return first slot, valid until commit()
+	 */
+	T* reserve(unsigned long* count)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t used = h - tail.load(std::memory_order_acquire);
+		size_t avail = mask + 1 - used;
+		size_t contiguous = mask + 1 - (h & mask);
+		if (avail > contiguous)
+			avail = contiguous;
+		if (*count > avail)
+			*count = (unsigned long)avail;
+		return &slots[h & mask];
+	}
+
+	/** producer: publish n slots filled after reserve() */
+	void commit(unsigned long n)
+	{
+		size_t h = head.load(std::memory_order_relaxed) + n;
+		size_t used = h - tail.load(std::memory_order_relaxed);
+		if (used > hwm.load(std::memory_order_relaxed))
+			hwm.store(used,std::memory_order_relaxed);
+		head.store(h,std::memory_order_release);
+	}
+
+	/** producer: account for n elements dropped because the ring was full */
+	void overrun(unsigned long n) { overrunCnt.fetch_add(n,std::memory_order_relaxed); }
+
+	/** consumer: oldest element or NULL if the ring is empty */
+	T* front()
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return NULL;
+		return &slots[t & mask];
+	}
+
+	/** consumer: release the element returned by front() */
+	void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1,std::memory_order_release); }
+
+	/** position of a slot, for data kept alongside the ring */
+	size_t index(const T* slot) const { return slot - slots; }
+
+	size_t capacity() const { return mask + 1; }
+	size_t highWater() const { return hwm.load(std::memory_order_relaxed); }
+	unsigned long overruns() const { return overrunCnt.load(std::memory_order_relaxed); }
+
+private:
+	SpscRing(const SpscRing&);
+	SpscRing& operator=(const SpscRing&);
+
+	T* slots;
+	size_t mask;
+	// producer and consumer indices live on separate cache lines
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<size_t> hwm;
+	std::atomic<unsigned long> overrunCnt;
+};
@@ -0,0 +1,276 @@
+#include <string.h>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "trace.h"
+#include "j2534_tactrix.h"
+
+typedef struct
+{
+	unsigned int thread;
+	uint64_t next;				// events ever recorded, next slot is next % TRACE_RING_EVENTS
+	TRACE_EVENT events[TRACE_RING_EVENTS];
+} TRACE_RING;
+
+// rings are never freed and the table has no destructor, so a trace can be
+// saved after the threads are gone, even from a global destructor
+static TRACE_RING* traceRings[TRACE_MAX_THREADS];
+static std::atomic<unsigned int> traceThreads(0);
+static thread_local TRACE_RING* myRing = NULL;
+
+uint64_t trace_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief record one finished call in the calling thread's ring
+ * @param call - TRACE_...
+ * @param start - trace_clock() before the call
+ * @param result - J2534 result
+ * @param a0..a4 - call arguments and outputs
+ * @param data - message bytes or SCONFIG pairs, may be NULL
+ * @param len - their size, cut at TRACE_DATA
+ */
+void trace_record(unsigned int call, uint64_t start, long result,
+				  unsigned long a0, unsigned long a1, unsigned long a2, unsigned long a3, unsigned long a4,
+				  const void *data, size_t len)
+{
+	uint64_t end = trace_clock();
+	if (!myRing)
+	{
+		// first event of this thread
+		unsigned int thread = traceThreads.load(std::memory_order_relaxed);
+		if (thread >= TRACE_MAX_THREADS)
+			return;
+		TRACE_RING *ring = new TRACE_RING;
+		ring->next = 0;
+		while (!traceThreads.compare_exchange_weak(thread,thread + 1))
+		{
+			if (thread >= TRACE_MAX_THREADS)
+			{
+				delete ring;
+				return;
+			}
+		}
+		ring->thread = thread;
+		myRing = ring;
+		traceRings[thread] = ring;
+	}
+
+	TRACE_EVENT *ev = &myRing->events[myRing->next % TRACE_RING_EVENTS];
+	ev->start = start;
+	ev->duration = (end - start > 0xFFFFFFFFULL) ? 0xFFFFFFFFU : (uint32_t)(end - start);
+	ev->call = (uint16_t)call;
+	ev->thread = (uint8_t)myRing->thread;
+	ev->result = (int32_t)result;
+	ev->args[0] = (uint32_t)a0;
+	ev->args[1] = (uint32_t)a1;
+	ev->args[2] = (uint32_t)a2;
+	ev->args[3] = (uint32_t)a3;
+	ev->args[4] = (uint32_t)a4;
+	if (len > TRACE_DATA)
+		len = TRACE_DATA;
+	ev->dataLen = (uint8_t)len;
+	if (len)
+		memcpy(ev->data,data,len);
+	myRing->next++;
+}
+
+static bool earlier(const TRACE_EVENT &a, const TRACE_EVENT &b)
+{
+	return a.start < b.start;
+}
+
+/**
+ * @brief write the events of all threads, ordered by start time
+ * @remark call once the traced threads are idle, a ring being written is
+ * copied as it is
+ * @return false if the file can't be written
+ */
+bool trace_save(const char *path)
+{
+	std::vector<TRACE_EVENT> all;
+	unsigned int threads = traceThreads.load();
+	for (unsigned int r = 0; r < threads; r++)
+	{
+		TRACE_RING *ring = traceRings[r];
+		if (!ring)
+			continue; // thread still setting up its ring
+		uint64_t first = ring->next > TRACE_RING_EVENTS ? ring->next - TRACE_RING_EVENTS : 0;
+		for (uint64_t i = first; i < ring->next; i++)
+			all.push_back(ring->events[i % TRACE_RING_EVENTS]);
+	}
+	std::stable_sort(all.begin(),all.end(),earlier);
+
+	FILE *fp = fopen(path,"wb");
+	if (!fp)
+		return false;
+	unsigned char hdr[6];
+	memcpy(hdr,TRACE_MAGIC,4);
+	hdr[4] = TRACE_VERSION;
+	hdr[5] = sizeof(TRACE_EVENT);
+	fwrite(hdr,1,sizeof(hdr),fp);
+	if (!all.empty())
+		fwrite(&all[0],sizeof(TRACE_EVENT),all.size(),fp);
+	return fclose(fp) == 0;
+}
+
+/** @return 1 on success, 0 if the file isn't a trace of this layout */
+int trace_read_header(FILE *fp)
+{
+	unsigned char hdr[6];
+	if (fread(hdr,1,sizeof(hdr),fp) != sizeof(hdr) || memcmp(hdr,TRACE_MAGIC,4))
+		return 0;
+	return hdr[4] == TRACE_VERSION && hdr[5] == sizeof(TRACE_EVENT);
+}
+
+/** @return 1 on success, 0 at end of file */
+int trace_read_event(FILE *fp, TRACE_EVENT *ev)
+{
+	return fread(ev,sizeof(TRACE_EVENT),1,fp) == 1;
+}
+
+static const char *ioctl_name(unsigned long id)
+{
+	static const char *names[] = {NULL,"GET_CONFIG","SET_CONFIG","READ_VBATT","FIVE_BAUD_INIT","FAST_INIT",NULL,
+		"CLEAR_TX_BUFFER","CLEAR_RX_BUFFER","CLEAR_PERIODIC_MSGS","CLEAR_MSG_FILTERS","CLEAR_FUNCT_MSG_LOOKUP_TABLE",
+		"ADD_TO_FUNCT_MSG_LOOKUP_TABLE","DELETE_FROM_FUNCT_MSG_LOOKUP_TABLE","READ_PROG_VOLTAGE"};
+	if (id < sizeof(names) / sizeof(names[0]) && names[id])
+		return names[id];
+	if (id == TX_IOCTL_APP_SERVICE)
+		return "APP_SERVICE";
+	return NULL;
+}
+
+static const char *param_name(unsigned long id)
+{
+	static const struct
+	{
+		unsigned long id;
+		const char *name;
+	} names[] = {
+		{DATA_RATE,"DATA_RATE"},{LOOPBACK,"LOOPBACK"},{NODE_ADDRESS,"NODE_ADDRESS"},{NETWORK_LINE,"NETWORK_LINE"},
+		{P1_MIN,"P1_MIN"},{P1_MAX,"P1_MAX"},{P2_MIN,"P2_MIN"},{P2_MAX,"P2_MAX"},{P3_MIN,"P3_MIN"},{P3_MAX,"P3_MAX"},
+		{P4_MIN,"P4_MIN"},{P4_MAX,"P4_MAX"},{W0,"W0"},{W1,"W1"},{W2,"W2"},{W3,"W3"},{W4,"W4"},{W5,"W5"},
+		{TIDLE,"TIDLE"},{TINIL,"TINIL"},{TWUP,"TWUP"},{PARITY,"PARITY"},{BIT_SAMPLE_POINT,"BIT_SAMPLE_POINT"},
+		{SYNC_JUMP_WIDTH,"SYNC_JUMP_WIDTH"},{T1_MAX,"T1_MAX"},{T2_MAX,"T2_MAX"},{T3_MAX,"T3_MAX"},{T4_MAX,"T4_MAX"},
+		{T5_MAX,"T5_MAX"},{ISO15765_BS,"ISO15765_BS"},{ISO15765_STMIN,"ISO15765_STMIN"},{DATA_BITS,"DATA_BITS"},
+		{FIVE_BAUD_MOD,"FIVE_BAUD_MOD"},{BS_TX,"BS_TX"},{STMIN_TX,"STMIN_TX"},{ISO15765_WFT_MAX,"ISO15765_WFT_MAX"},
+		{CAN_MIXED_FORMAT,"CAN_MIXED_FORMAT"},{J1962_PINS,"J1962_PINS"}};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (names[i].id == id)
+			return names[i].name;
+	return NULL;
+}
+
+static void print_data(FILE *fp, const TRACE_EVENT *ev)
+{
+	if (!ev->dataLen)
+		return;
+	fprintf(fp," [");
+	for (unsigned int i = 0; i < ev->dataLen; i++)
+		fprintf(fp,i ? " %02X" : "%02X",ev->data[i]);
+	fprintf(fp,"]");
+}
+
+/**
+ * @brief format one event as a text line
+ * @param t0 - start of the first event, times are printed relative to it
+ */
+void trace_print(FILE *fp, const TRACE_EVENT *ev, uint64_t t0)
+{
+	const uint32_t *a = ev->args;
+	fprintf(fp,"%12.6f T%u ",(ev->start - t0) / 1e9,ev->thread);
+	switch (ev->call)
+	{
+	case TRACE_OPEN:
+		fprintf(fp,"PassThruOpen() DeviceID=%u",a[0]);
+		break;
+	case TRACE_CLOSE:
+		fprintf(fp,"PassThruClose(DeviceID=%u)",a[0]);
+		break;
+	case TRACE_CONNECT:
+		fprintf(fp,"PassThruConnect(DeviceID=%u,ProtocolID=%u,Flags=%08X,Baudrate=%u) ChannelID=%u",a[0],a[1],a[2],a[3],a[4]);
+		break;
+	case TRACE_DISCONNECT:
+		fprintf(fp,"PassThruDisconnect(ChannelID=%u)",a[0]);
+		break;
+	case TRACE_READ_MSGS:
+		fprintf(fp,"PassThruReadMsgs(ChannelID=%u,NumMsgs=%u,Timeout=%u) read %u, first %u bytes",a[0],a[1],a[2],a[3],a[4]);
+		print_data(fp,ev);
+		break;
+	case TRACE_WRITE_MSGS:
+		fprintf(fp,"PassThruWriteMsgs(ChannelID=%u,NumMsgs=%u,Timeout=%u) wrote %u, first %u bytes",a[0],a[1],a[2],a[3],a[4]);
+		print_data(fp,ev);
+		break;
+	case TRACE_START_PERIODIC:
+		fprintf(fp,"PassThruStartPeriodicMsg(ChannelID=%u,TimeInterval=%u) MsgID=%u, %u bytes",a[0],a[1],a[2],a[3]);
+		print_data(fp,ev);
+		break;
+	case TRACE_STOP_PERIODIC:
+		fprintf(fp,"PassThruStopPeriodicMsg(ChannelID=%u,MsgID=%u)",a[0],a[1]);
+		break;
+	case TRACE_START_FILTER:
+		// data holds the mask, then the pattern
+		fprintf(fp,"PassThruStartMsgFilter(ChannelID=%u,FilterType=%u) MsgID=%u, mask/pattern %u bytes",a[0],a[1],a[2],a[3]);
+		print_data(fp,ev);
+		break;
+	case TRACE_STOP_FILTER:
+		fprintf(fp,"PassThruStopMsgFilter(ChannelID=%u,MsgID=%u)",a[0],a[1]);
+		break;
+	case TRACE_SET_VOLTAGE:
+		fprintf(fp,"PassThruSetProgrammingVoltage(DeviceID=%u,Pin=%u,Voltage=%u)",a[0],a[1],a[2]);
+		break;
+	case TRACE_READ_VERSION:
+		fprintf(fp,"PassThruReadVersion(DeviceID=%u)",a[0]);
+		break;
+	case TRACE_GET_LAST_ERROR:
+		fprintf(fp,"PassThruGetLastError()");
+		break;
+	case TRACE_IOCTL:
+	{
+		const char *name = ioctl_name(a[1]);
+		if (name)
+			fprintf(fp,"PassThruIoctl(ChannelID=%u,%s",a[0],name);
+		else
+			fprintf(fp,"PassThruIoctl(ChannelID=%u,%u(unknown)",a[0],a[1]);
+		if (a[1] == GET_CONFIG || a[1] == SET_CONFIG)
+		{
+			// data holds the first Parameter/Value pairs
+			for (unsigned int i = 0; i + 8 <= ev->dataLen; i += 8)
+			{
+				uint32_t p, v;
+				memcpy(&p,ev->data + i,4);
+				memcpy(&v,ev->data + i + 4,4);
+				const char *pname = param_name(p);
+				if (pname)
+					fprintf(fp,",%s=%u",pname,v);
+				else
+					fprintf(fp,",%u(unknown)=%u",p,v);
+			}
+			if (a[2] > ev->dataLen / 8)
+				fprintf(fp,",... %u params",a[2]);
+			fprintf(fp,")");
+			if (a[3])
+				fprintf(fp," not passed through, faked success");
+		}
+		else if (a[1] == FAST_INIT || a[1] == FIVE_BAUD_INIT)
+		{
+			fprintf(fp,") sent %u bytes, answer %u bytes",a[2],a[3]);
+			print_data(fp,ev);
+		}
+		else if (a[1] == READ_VBATT)
+			fprintf(fp,") %u mV",a[2]);
+		else
+			fprintf(fp,")");
+		break;
+	}
+	default:
+		fprintf(fp,"call %u",ev->call);
+		break;
+	}
+	fprintf(fp," -> %d (%.3f ms)\n",ev->result,ev->duration / 1e6);
+}
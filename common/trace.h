@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+J2534 CALL TRACE
+
+    Built with J2534_TRACE defined, the J2534 wrapper records one binary
+    event per library call into a ring owned by the calling thread. Nothing
+    is formatted while tracing, so the bus timing stays the same as without
+    it. Without J2534_TRACE the trace macros in J2534.cpp are empty.
+
+    Rings keep the last TRACE_RING_EVENTS calls of each thread. trace_save()
+    merges them by time into a file, kconv formats it as text.
+
+    file header
+        4B   magic "KTRC"
+        1B   format version (TRACE_VERSION)
+        1B   event size in bytes
+    events, back to back, in host byte order (TRACE_EVENT)
+*/
+
+#define TRACE_MAGIC "KTRC"
+#define TRACE_VERSION 1
+#define TRACE_RING_EVENTS 16384	// per thread, older events are overwritten
+#define TRACE_MAX_THREADS 64	// calls of further threads aren't recorded
+#define TRACE_ARGS 5
+#define TRACE_DATA 24
+
+/** traced calls */
+enum
+{
+	TRACE_OPEN,
+	TRACE_CLOSE,
+	TRACE_CONNECT,
+	TRACE_DISCONNECT,
+	TRACE_READ_MSGS,
+	TRACE_WRITE_MSGS,
+	TRACE_START_PERIODIC,
+	TRACE_STOP_PERIODIC,
+	TRACE_START_FILTER,
+	TRACE_STOP_FILTER,
+	TRACE_SET_VOLTAGE,
+	TRACE_READ_VERSION,
+	TRACE_GET_LAST_ERROR,
+	TRACE_IOCTL,
+	TRACE_CALLS
+};
+
+/** one library call, 64 bytes. Argument use per call is in trace_print() */
+typedef struct
+{
+	uint64_t start;				// ns, steady clock
+	uint32_t duration;			// ns, saturated
+	uint16_t call;				// TRACE_...
+	uint8_t thread;				// order in which threads first traced
+	uint8_t dataLen;			// valid bytes in data
+	int32_t result;
+	uint32_t args[TRACE_ARGS];
+	uint8_t data[TRACE_DATA];	// start of a message, or SCONFIG pairs
+} TRACE_EVENT;
+
+uint64_t trace_clock();
+void trace_record(unsigned int call, uint64_t start, long result,
+				  unsigned long a0, unsigned long a1, unsigned long a2, unsigned long a3, unsigned long a4,
+				  const void *data, size_t len);
+bool trace_save(const char *path);
+
+int trace_read_header(FILE *fp);
+int trace_read_event(FILE *fp, TRACE_EVENT *ev);
+void trace_print(FILE *fp, const TRACE_EVENT *ev, uint64_t t0);
@@ -0,0 +1,184 @@
+#include <ctype.h>
+#include <string.h>
+#include "trigger.h"
+#include "klog_format.h"
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = (char)toupper((unsigned char)c);
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * @brief set the pattern to match, trigger_init() leaves it alone
+ * @param text - hex bytes, ?? for any byte, optionally separated by
+ * spaces, commas or colons
+ * @return false if text isn't a pattern of 1 to TRIGGER_MAX_PATTERN bytes
+ */
+bool trigger_parse(TRIGGER *tr, const char *text)
+{
+	size_t n = 0;
+	while (*text)
+	{
+		if (*text == ' ' || *text == ',' || *text == ':')
+		{
+			text++;
+			continue;
+		}
+		if (n == TRIGGER_MAX_PATTERN || !text[1])
+			return false;
+		if (text[0] == '?' && text[1] == '?')
+		{
+			tr->pattern[n] = 0;
+			tr->mask[n] = 0;
+		}
+		else
+		{
+			int hi = hex_digit(text[0]);
+			int lo = hex_digit(text[1]);
+			if (hi < 0 || lo < 0)
+				return false;
+			tr->pattern[n] = (unsigned char)(hi << 4 | lo);
+			tr->mask[n] = 0xFF;
+		}
+		n++;
+		text += 2;
+	}
+	tr->patternSize = n;
+	return n > 0;
+}
+
+/**
+ * @brief set up a trigger with its pattern parsed already
+ * @param preUs - time before a match to write
+ * @param postUs - time after the last match to write
+ * @param emit - receives the messages of every window
+ */
+void trigger_init(TRIGGER *tr, unsigned long long preUs, unsigned long long postUs, TRIGGER_EMIT emit, void *ctx)
+{
+	tr->preUs = preUs;
+	tr->postUs = postUs;
+	tr->emit = emit;
+	tr->ctx = ctx;
+	tr->slots = new TRIGGER_SLOT[TRIGGER_FRAMES];
+	tr->head = 0;
+	tr->count = 0;
+	tr->pool = new KMsgPool(TRIGGER_POOL_CHUNKS,false);
+	tr->open = false;
+	tr->until = 0;
+	tr->triggers = 0;
+	tr->windows = 0;
+	tr->written = 0;
+	tr->dropped = 0;
+	tr->evicted = 0;
+}
+
+static bool matches(const TRIGGER *tr, const KMSG_VIEW *msg)
+{
+	if (klog_note_timeout(msg) || msg->DataSize < tr->patternSize)
+		return false;
+	for (size_t i = 0; i + tr->patternSize <= msg->DataSize; i++)
+	{
+		size_t k = 0;
+		while (k < tr->patternSize && ((msg->Data[i + k] ^ tr->pattern[k]) & tr->mask[k]) == 0)
+			k++;
+		if (k == tr->patternSize)
+			return true;
+	}
+	return false;
+}
+
+static void emit(TRIGGER *tr, const KMSG_VIEW *msg, unsigned int device, unsigned long long time)
+{
+	tr->emit(msg,device,time,tr->ctx);
+	tr->written++;
+}
+
+/** emit the ring's messages of the pre-trigger window and empty it */
+static void flush_ring(TRIGGER *tr, unsigned long long time)
+{
+	for (; tr->count; tr->count--, tr->head = (tr->head + 1) % TRIGGER_FRAMES)
+	{
+		TRIGGER_SLOT *s = &tr->slots[tr->head];
+		if (s->time + tr->preUs >= time)
+		{
+			KMSG_VIEW v = kmsg_view(&s->msg,tr->gather);
+			emit(tr,&v,s->device,s->time);
+		}
+		else
+			tr->dropped++;
+		kmsg_release(&s->msg,tr->pool);
+	}
+	tr->head = 0;
+}
+
+/** drop the oldest message of the ring unwritten */
+static void drop_oldest(TRIGGER *tr)
+{
+	kmsg_release(&tr->slots[tr->head].msg,tr->pool);
+	tr->head = (tr->head + 1) % TRIGGER_FRAMES;
+	tr->count--;
+	tr->dropped++;
+}
+
+/** keep a message outside a window, the oldest ones make room if needed */
+static void hold(TRIGGER *tr, const KMSG_VIEW *msg, unsigned int device, unsigned long long time)
+{
+	if (tr->count == TRIGGER_FRAMES)
+		drop_oldest(tr);
+	// moving head on leaves the free slot where it is
+	TRIGGER_SLOT *s = &tr->slots[(tr->head + tr->count) % TRIGGER_FRAMES];
+	while (!kmsg_from_view(&s->msg,msg,tr->pool))
+	{
+		if (!tr->count)
+		{
+			tr->dropped++; // longer than the whole pool
+			return;
+		}
+		drop_oldest(tr);
+		tr->evicted++;
+	}
+	s->time = time;
+	s->device = device;
+	tr->count++;
+}
+
+/**
+ * @brief pass on or hold one message
+ * @param time - merge time, messages come in its order
+ */
+void trigger_feed(TRIGGER *tr, const KMSG_VIEW *msg, unsigned int device, unsigned long long time)
+{
+	if (tr->open && time > tr->until)
+		tr->open = false;
+	if (matches(tr,msg))
+	{
+		if (!tr->open)
+		{
+			flush_ring(tr,time);
+			tr->open = true;
+			tr->windows++;
+		}
+		tr->until = time + tr->postUs;
+		tr->triggers++;
+	}
+	if (tr->open)
+		emit(tr,msg,device,time);
+	else
+		hold(tr,msg,device,time);
+}
+
+/** release the ring, messages still held are dropped */
+void trigger_free(TRIGGER *tr)
+{
+	while (tr->count)
+		drop_oldest(tr);
+	delete[] tr->slots;
+	delete tr->pool;
+	tr->slots = NULL;
+	tr->pool = NULL;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include "j2534_tactrix.h"
+#include "kmsg.h"
+
+/*
+TRIGGERED CAPTURE
+
+    Out of hours of traffic usually only a few seconds around one event
+    matter, e.g. a DTC reply or a crash data frame. Until a message matches
+    the trigger pattern, messages only go into a preallocated ring of
+    TRIGGER_FRAMES compact messages and nothing is written. A match emits
+    the ring's messages of the last preUs, then every message up to postUs
+    after the last match; after that messages go to the ring again.
+
+    A pattern is a byte sequence that may appear anywhere in the data of a
+    message, ?? matches any byte: "7F ?? 78" or "7F,??,78". Timeout notes
+    never match but are kept like messages.
+
+    The pre-trigger window is limited by the ring: at a full 10400 baud bus
+    TRIGGER_FRAMES frames last over a minute. Messages longer than
+    KMSG_INLINE keep their data in a fixed pool of overflow chunks, enough
+    for a quarter hour of long frames on a full bus. Nothing is allocated
+    while capturing; when the chunks run out, the oldest held messages are
+    dropped early to free theirs.
+*/
+
+#define TRIGGER_FRAMES 65536		// ring of messages before the trigger
+#define TRIGGER_POOL_CHUNKS (TRIGGER_FRAMES / 4)	// overflow chunks of those longer than KMSG_INLINE
+#define TRIGGER_MAX_PATTERN 32
+
+/** called for every message inside a trigger window */
+typedef void (*TRIGGER_EMIT)(const KMSG_VIEW *msg, unsigned int device, unsigned long long time, void *ctx);
+
+/** message held in the ring */
+typedef struct
+{
+	KMSG msg;
+	unsigned long long time;	// merge time, us
+	unsigned int device;
+} TRIGGER_SLOT;
+
+/** trigger state of a capture, used by one thread */
+typedef struct
+{
+	unsigned char pattern[TRIGGER_MAX_PATTERN];
+	unsigned char mask[TRIGGER_MAX_PATTERN];	// 0 - any byte
+	size_t patternSize;
+	unsigned long long preUs;
+	unsigned long long postUs;
+	TRIGGER_EMIT emit;
+	void *ctx;
+	TRIGGER_SLOT *slots;		// TRIGGER_FRAMES
+	size_t head;				// oldest message
+	size_t count;
+	KMsgPool *pool;
+	bool open;					// in a window
+	unsigned long long until;	// end of the window
+	unsigned char gather[PASSTHRU_MSG_DATA_SIZE];	// data of a held message in several chunks
+	unsigned long triggers;		// matches that opened or extended a window
+	unsigned long windows;
+	unsigned long long written;	// messages emitted
+	unsigned long long dropped;	// messages that left the ring unwritten
+	unsigned long long evicted;	// of those, dropped early to free chunks
+} TRIGGER;
+
+bool trigger_parse(TRIGGER *tr, const char *text);
+void trigger_init(TRIGGER *tr, unsigned long long preUs, unsigned long long postUs, TRIGGER_EMIT emit, void *ctx);
+void trigger_feed(TRIGGER *tr, const KMSG_VIEW *msg, unsigned int device, unsigned long long time);
+void trigger_free(TRIGGER *tr);
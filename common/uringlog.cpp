@@ -0,0 +1,384 @@
+#include <string.h>
+#include "uringlog.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_SUPPORTED
+#endif
+#endif
+
+#ifdef URING_SUPPORTED
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+static int uring_setup(unsigned entries, struct io_uring_params* p)
+{
+	return (int)syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	int r;
+	do
+		r = (int)syscall(__NR_io_uring_enter,fd,toSubmit,minComplete,flags,NULL,0);
+	while (r < 0 && errno == EINTR);
+	return r;
+}
+
+static int uring_register(int fd, unsigned opcode, const void* arg, unsigned count)
+{
+	return (int)syscall(__NR_io_uring_register,fd,opcode,arg,count);
+}
+#endif
+
+UringWriter::UringWriter()
+{
+	direct = false;
+	ringFd = -1;
+	fd = -1;
+	seekable = true;
+	offset = 0;
+	flushed = 0;
+	filling = -1;
+	inFlight = 0;
+	failed = false;
+	memset(buffers,0,sizeof(buffers));
+	for (int i = 0; i < URING_BUFFERS; i++)
+		buffers[i].after = -1;
+	submitCnt = 0;
+	waitCnt = 0;
+	sqRing = NULL;
+	sqRingSize = 0;
+	cqRing = NULL;
+	cqRingSize = 0;
+	sqes = NULL;
+	sqesSize = 0;
+	sqTail = sqMask = sqArray = NULL;
+	cqHead = cqTail = cqMask = NULL;
+	cqes = NULL;
+}
+
+UringWriter::~UringWriter()
+{
+	shutdown();
+}
+
+/** bytes of a buffer that go to the file, padded to URING_ALIGN with O_DIRECT */
+static size_t buffer_end(size_t len, bool direct)
+{
+	return direct ? (len + URING_ALIGN - 1) / URING_ALIGN * URING_ALIGN : len;
+}
+
+/**
+ * @brief set up the ring and register the buffers
+ * @param direct - files will be opened with O_DIRECT
+ * @return false if io_uring isn't available, writes stay with the caller
+ */
+bool UringWriter::init(bool direct)
+{
+#ifdef URING_SUPPORTED
+	this->direct = direct;
+	struct io_uring_params p;
+	memset(&p,0,sizeof(p));
+	if ((ringFd = uring_setup(URING_BUFFERS * 2,&p)) < 0)
+		return false;
+
+	sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single)
+		sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+	sqRing = mmap(NULL,sqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ringFd,IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		sqRing = NULL;
+		shutdown();
+		return false;
+	}
+	cqRing = single ? sqRing : mmap(NULL,cqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ringFd,IORING_OFF_CQ_RING);
+	sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL,sqesSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ringFd,IORING_OFF_SQES);
+	if (cqRing == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		if (cqRing == MAP_FAILED)
+			cqRing = NULL;
+		if (sqes == MAP_FAILED)
+			sqes = NULL;
+		shutdown();
+		return false;
+	}
+	sqTail = (unsigned*)((char*)sqRing + p.sq_off.tail);
+	sqMask = (unsigned*)((char*)sqRing + p.sq_off.ring_mask);
+	sqArray = (unsigned*)((char*)sqRing + p.sq_off.array);
+	cqHead = (unsigned*)((char*)cqRing + p.cq_off.head);
+	cqTail = (unsigned*)((char*)cqRing + p.cq_off.tail);
+	cqMask = (unsigned*)((char*)cqRing + p.cq_off.ring_mask);
+	cqes = (char*)cqRing + p.cq_off.cqes;
+
+	struct iovec iov[URING_BUFFERS];
+	for (int i = 0; i < URING_BUFFERS; i++)
+	{
+		void* mem;
+		if (posix_memalign(&mem,URING_ALIGN,URING_BUFFER_SIZE))
+		{
+			shutdown();
+			return false;
+		}
+		buffers[i].data = (unsigned char*)mem;
+		iov[i].iov_base = mem;
+		iov[i].iov_len = URING_BUFFER_SIZE;
+	}
+	// the kernel pins registered buffers once instead of on every write
+	if (uring_register(ringFd,IORING_REGISTER_BUFFERS,iov,URING_BUFFERS) < 0)
+	{
+		shutdown();
+		return false;
+	}
+	return true;
+#else
+	(void)direct;
+	return false;
+#endif
+}
+
+/** continue at the current position of fd, the previous file must be drained */
+void UringWriter::attach(int fd)
+{
+#ifdef URING_SUPPORTED
+	this->fd = fd;
+	off_t pos = lseek(fd,0,SEEK_CUR);
+	seekable = pos >= 0;
+	offset = seekable ? (unsigned long long)pos : 0;
+	flushed = offset;
+	filling = -1;
+	failed = false;
+#else
+	(void)fd;
+#endif
+}
+
+/** queue the unwritten part of buffer idx */
+bool UringWriter::submit(int idx)
+{
+#ifdef URING_SUPPORTED
+	BUFFER* b = &buffers[idx];
+	// the padded copy of a block flush() wrote must not land after this one
+	while (b->after >= 0 && b->after != idx && buffers[b->after].busy)
+		if (!reap(true))
+			return false;
+	b->after = -1;
+	size_t end = buffer_end(b->len,direct);
+	if (end > b->len)
+		memset(b->data + b->len,0,end - b->len); // truncated away on close
+
+	unsigned tail = *sqTail;
+	unsigned slot = tail & *sqMask;
+	struct io_uring_sqe* sqe = &((struct io_uring_sqe*)sqes)[slot];
+	memset(sqe,0,sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(b->data + b->done);
+	sqe->len = (uint32_t)(end - b->done);
+	sqe->off = seekable ? b->offset + b->done : (uint64_t)-1;
+	sqe->buf_index = (uint16_t)idx;
+	sqe->user_data = (uint64_t)idx;
+	// a pipe has no offsets, its writes must not overtake each other
+	if (!seekable)
+		sqe->flags = IOSQE_IO_DRAIN;
+	sqArray[slot] = slot;
+	__atomic_store_n(sqTail,tail + 1,__ATOMIC_RELEASE);
+	if (uring_enter(ringFd,1,0,0) < 0)
+	{
+		failed = true;
+		return false;
+	}
+	b->busy = true;
+	inFlight++;
+	submitCnt++;
+	return true;
+#else
+	(void)idx;
+	return false;
+#endif
+}
+
+/**
+ * @brief handle finished writes, resubmitting short ones
+ * @param wait - block until at least one write has finished
+ * @return false if waiting failed
+ */
+bool UringWriter::reap(bool wait)
+{
+#ifdef URING_SUPPORTED
+	if (wait && inFlight && uring_enter(ringFd,0,1,IORING_ENTER_GETEVENTS) < 0)
+	{
+		failed = true;
+		return false;
+	}
+	unsigned head = *cqHead;
+	unsigned tail = __atomic_load_n(cqTail,__ATOMIC_ACQUIRE);
+	while (head != tail)
+	{
+		const struct io_uring_cqe* cqe = &((const struct io_uring_cqe*)cqes)[head & *cqMask];
+		int idx = (int)cqe->user_data;
+		int res = cqe->res;
+		head++;
+		__atomic_store_n(cqHead,head,__ATOMIC_RELEASE);
+
+		BUFFER* b = &buffers[idx];
+		b->busy = false;
+		inFlight--;
+		if (res <= 0)
+			failed = true;
+		else if ((b->done += res) < buffer_end(b->len,direct))
+			submit(idx);
+	}
+	return true;
+#else
+	(void)wait;
+	return false;
+#endif
+}
+
+/** @return a buffer to fill, waiting for one if all are in flight; -1 on error */
+int UringWriter::freeBuffer()
+{
+	bool waited = false;
+	for (;;)
+	{
+		for (int i = 0; i < URING_BUFFERS; i++)
+			if (!buffers[i].busy)
+				return i;
+		if (!waited)
+			waitCnt++;
+		waited = true;
+		if (!reap(true) || failed)
+			return -1;
+	}
+}
+
+/**
+ * @brief copy data into the buffers, submitting each one that is full.
+ * Without O_DIRECT a partly filled buffer goes out as well while nothing
+ * else is in flight, small writes are collected while the disk is busy.
+ * @return false once a write has failed
+ */
+bool UringWriter::write(const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	if (failed || !reap(false))
+		return false;
+	while (len)
+	{
+		if (filling < 0)
+		{
+			if ((filling = freeBuffer()) < 0)
+				return false;
+			buffers[filling].len = 0;
+			buffers[filling].done = 0;
+			buffers[filling].offset = offset;
+			buffers[filling].after = -1;
+		}
+		BUFFER* b = &buffers[filling];
+		size_t n = URING_BUFFER_SIZE - b->len;
+		if (n > len)
+			n = len;
+		memcpy(b->data + b->len,p,n);
+		b->len += n;
+		offset += n;
+		p += n;
+		len -= n;
+		if (b->len == URING_BUFFER_SIZE || (!direct && !len && !inFlight))
+		{
+			int idx = filling;
+			filling = -1;
+			if (!submit(idx))
+				return false;
+		}
+	}
+	return !failed;
+}
+
+/**
+ * @brief submit the buffer being filled, however little it holds. With
+ * O_DIRECT its last partial block goes out padded and starts the next
+ * buffer, which writes it again once completed.
+ * @return false once a write has failed
+ */
+bool UringWriter::flush()
+{
+	if (failed || !reap(false))
+		return false;
+	if (filling < 0 || offset == flushed)
+		return true;
+	int idx = filling;
+	BUFFER* b = &buffers[idx];
+	size_t keep = direct ? b->len % URING_ALIGN : 0;
+	filling = -1;
+	flushed = offset;
+	if (!submit(idx))
+		return false;
+	if (keep)
+	{
+		int n = freeBuffer();
+		if (n < 0)
+			return false;
+		BUFFER* c = &buffers[n];
+		// n may be idx again if its write has finished already
+		memmove(c->data,b->data + b->len - keep,keep);
+		c->len = keep;
+		c->done = 0;
+		c->offset = offset - keep;
+		c->after = n == idx ? -1 : idx;
+		filling = n;
+	}
+	return !failed;
+}
+
+/**
+ * @brief submit what is left and wait until everything is written
+ * @return false if any write failed
+ */
+bool UringWriter::drain()
+{
+	if (filling >= 0)
+	{
+		int idx = filling;
+		filling = -1;
+		if (buffers[idx].len)
+			submit(idx);
+	}
+	while (inFlight)
+		if (!reap(true))
+			break;
+	return !failed;
+}
+
+/** release the ring and the buffers, drain() first */
+void UringWriter::shutdown()
+{
+#ifdef URING_SUPPORTED
+	if (ringFd >= 0)
+		::close(ringFd);
+	ringFd = -1;
+	if (sqes)
+		munmap(sqes,sqesSize);
+	if (cqRing && cqRing != sqRing)
+		munmap(cqRing,cqRingSize);
+	if (sqRing)
+		munmap(sqRing,sqRingSize);
+	sqes = cqRing = sqRing = NULL;
+	for (int i = 0; i < URING_BUFFERS; i++)
+	{
+		free(buffers[i].data);
+		buffers[i].data = NULL;
+	}
+	inFlight = 0;
+#endif
+}
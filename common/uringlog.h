@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+IO_URING LOG WRITER (Linux)
+
+    The writer copies log data into one of URING_BUFFERS registered,
+    page aligned buffers and submits it with IORING_OP_WRITE_FIXED; it
+    only waits when every buffer is still in flight. A disk that stalls
+    for a moment is absorbed by URING_BUFFERS * URING_BUFFER_SIZE bytes
+    instead of blocking write(). Small writes are collected in a buffer
+    while an earlier one is in flight. Completions are reaped on the next
+    write(), short writes are resubmitted. flush() submits a partly filled
+    buffer, so data doesn't stay in memory while nothing more is written.
+
+    With O_DIRECT (the file must be opened with it) write() only submits
+    whole buffers, so up to one buffer of data waits in memory until it
+    fills or flush() is called. flush() and drain() write the last block
+    padded to URING_ALIGN; after flush() that block is written again,
+    completed, with the next buffer. The caller truncates the file to its
+    real size.
+
+    The ring is driven through the raw system calls, no liburing needed.
+    On other systems, or where io_uring is unavailable, init() fails and
+    the caller keeps writing as before.
+*/
+
+#define URING_BUFFERS 8
+#define URING_BUFFER_SIZE (256*1024)
+#define URING_ALIGN 4096
+
+/**
+ * @brief asynchronous appender to one file at a time
+ * @remark used by one thread only. attach() a file, write(), and drain()
+ * before the file is closed or another one is attached.
+ */
+class UringWriter
+{
+public:
+	UringWriter();
+	~UringWriter();
+	bool init(bool direct);
+	void attach(int fd);
+	bool write(const void* data, size_t len);
+	bool flush();
+	bool drain();
+	void shutdown();
+	unsigned long long submits() const { return submitCnt; };
+	unsigned long waits() const { return waitCnt; };
+
+private:
+	UringWriter(const UringWriter&);
+	UringWriter& operator=(const UringWriter&);
+
+	typedef struct
+	{
+		unsigned char* data;
+		size_t len;					// bytes filled
+		size_t done;				// bytes the kernel has written
+		unsigned long long offset;	// file position of data[0]
+		bool busy;					// submitted, not complete
+		int after;					// buffer whose write of the first block must finish first, -1 if none
+	} BUFFER;
+
+	bool submit(int idx);
+	bool reap(bool wait);
+	int freeBuffer();
+
+	bool direct;
+	int ringFd;
+	int fd;
+	bool seekable;
+	unsigned long long offset;	// file position of the next byte
+	unsigned long long flushed;	// offset at the last flush()
+	int filling;				// buffer being filled, -1 if none
+	int inFlight;
+	bool failed;
+	BUFFER buffers[URING_BUFFERS];
+	unsigned long long submitCnt;
+	unsigned long waitCnt;
+
+	// mapped ring
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	void* sqes;
+	size_t sqesSize;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	void* cqes;
+};
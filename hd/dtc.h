@@ -133,4 +133,5 @@ const struct DTC_struct g_Known_DTCs[] = {
     {"87-31", "Internal Failure Of SRS Unit"},
     {"87-32", "Side Impact Air Bag Cutoff Indicator Stays On"},
     {"91-1x", "Internal Failure Of SRS Unit"},
-    {"91-2x", "short circuited In SRS Indicator Circuit"}};
\ No newline at end of file
+    {"91-2x", "short circuited In SRS Indicator Circuit"}};
+#define DTC_COUNT (sizeof(g_Known_DTCs) / sizeof(DTC_struct))
@@ -0,0 +1,284 @@
+#include "honda.h"
+#include "../common/hexfmt.h"
+#include <stdio.h>
+#include <string.h>
+#include "dtc.h"
+
+static char szOut[1024]; // output string
+
+/**
+ * @brief dump HONDA_PACKET
+ * @remark used for debugging, set DEBUG_MESSAGES to see all traffic in output
+ * @param hp HONDA_PACKET pointer
+ */
+void dump_hp(HONDA_PACKET *hp) {
+  printf("Packet : %02X [", hp->hrc);
+  for (unsigned int i = 0; i < hp->cmd_len; i++)
+    printf("%02X ", hp->cmd[i]);
+  printf("]\n");
+} //..dump_hp
+
+/**
+ * @brief calculate checksum of the message received or to be transferred
+ * @param data - data array
+ * @param len - length of the data array
+ * @return 8-bit checksum
+ */
+uint8_t iso_checksum(uint8_t *data, uint16_t len) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < len; i++)
+    crc = crc + data[i];
+  return 0x100 - crc;
+} //..iso_checksum
+
+/**
+ * @brief create PASSTHRU_MSG from HONDA_PACKET structure
+ * @param cmd - HONDA_PACKET structure pointer
+ * @param msg - destination PASSTHRU_MSG structure
+ * @remark in the destination packet filled only DataSize and Data
+ * parameters, no other fields are filled up.
+ */
+void make_packet(const HONDA_PACKET *cmd, PASSTHRU_MSG *msg) {
+  msg->Data[0] = cmd->hrc;
+  uint8_t alen = cmd->cmd_len + 3;
+  msg->Data[1] = alen;
+  memcpy(msg->Data + 2, cmd->cmd, cmd->cmd_len);
+  msg->Data[alen - 1] = iso_checksum(msg->Data, alen - 1);
+  msg->DataSize = alen;
+} //..make_packet
+
+/**
+ * @brief  fill up HONDA_PACKET structure from received PASSTHRU_MSG
+ * @param msg - received PASSTHRU_MSG structure
+ * @param cmd - HONDA_PACKET destination structure pointer
+ * @return 1 on success, 0 - on checksum error
+ */
+int decode_packet(PASSTHRU_MSG *msg, HONDA_PACKET *cmd) {
+  int br = 1;
+  cmd->hrc = msg->Data[0];
+  cmd->cmd_len = msg->DataSize - 3;
+  uint8_t cs = iso_checksum(msg->Data, msg->DataSize - 1);
+  if (cs != msg->Data[msg->DataSize - 1]) {
+    printf("Invalid checksum in result!"); // << warning
+    br = 0;
+  }
+  if (cmd->cmd_len > HONDA_MAX_DATASIZE)
+    cmd->cmd_len = HONDA_MAX_DATASIZE;
+  memcpy(cmd->cmd, msg->Data + 2, cmd->cmd_len);
+  return br;
+} //..decode_packet
+
+/**
+ * @brief convert binary to hex string
+ *
+ * @param ptr - binary data
+ * @param size - size of the data
+ * @return const char* string with hex
+ */
+const char *hextostr(uint8_t *ptr, int size) {
+  if (size > (int)(sizeof(szOut) - 1) / 3)
+    size = (sizeof(szOut) - 1) / 3;
+  szOut[hex_encode(szOut, ptr, size)] = 0;
+  return szOut;
+} //..hextostr
+
+int mask_compare(const char *s1, const char *s2) {
+  size_t len1 = strlen(s1);
+  size_t len2 = strlen(s2);
+  for (size_t i = 0; i < len1; i++) {
+    if (i > len2)
+      return 1;
+    if ('x' == s1[i]) // any symbol
+      continue;
+    if (s1[i] != s2[i])
+      return s1[i] - s2[i];
+  } //..for
+  return 0;
+} //..mask_compare
+
+/** first g_Known_DTCs entry matching dtc_str, scanning the whole table */
+const char *get_dtc_descr_scan(const char *dtc_str) {
+  for (size_t i = 0; i < DTC_COUNT; i++) {
+    if (0 == mask_compare(g_Known_DTCs[i].szCode, dtc_str)) {
+      return g_Known_DTCs[i].szDescr;
+    }
+  } //..for
+  return "Unknown DTC";
+} //..get_dtc_descr_scan
+
+// index + 1 of the first g_Known_DTCs entry matching each code "HH-HH",
+// 0 if none. Built from dtc.h on the first lookup
+static uint16_t dtcIndex[0x10000];
+static bool dtcIndexBuilt = false;
+
+static int hex_nibble(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+} //..hex_nibble
+
+/**
+ * @brief nibble values a table code matches, the way mask_compare() compares
+ * it against the 5 characters of "HH-HH"
+ *
+ * @param code - g_Known_DTCs code
+ * @param values - per nibble, bit v set if nibble value v matches
+ * @return int 0 if the code matches nothing
+ */
+static int code_nibbles(const char *code, uint16_t values[4]) {
+  static const size_t pos[4] = {0, 1, 3, 4};
+  size_t len = strlen(code);
+  // past "HH-HH" only an 'x' against the terminator matches
+  if (len > 6 || (len == 6 && code[5] != 'x'))
+    return 0;
+  if (len > 2 && code[2] != '-' && code[2] != 'x')
+    return 0;
+  for (int n = 0; n < 4; n++) {
+    if (pos[n] >= len || code[pos[n]] == 'x') {
+      values[n] = 0xFFFF;
+      continue;
+    }
+    int v = hex_nibble(code[pos[n]]);
+    if (v < 0)
+      return 0;
+    values[n] = 1 << v;
+  }
+  return 1;
+} //..code_nibbles
+
+static void build_dtc_index() {
+  // last entry first, so earlier entries overwrite and the first match wins
+  for (size_t i = DTC_COUNT; i-- > 0;) {
+    uint16_t values[4];
+    if (!code_nibbles(g_Known_DTCs[i].szCode, values))
+      continue;
+    for (int a = 0; a < 16; a++) {
+      if (!(values[0] >> a & 1))
+        continue;
+      for (int b = 0; b < 16; b++) {
+        if (!(values[1] >> b & 1))
+          continue;
+        for (int c = 0; c < 16; c++) {
+          if (!(values[2] >> c & 1))
+            continue;
+          for (int d = 0; d < 16; d++) {
+            if (values[3] >> d & 1)
+              dtcIndex[a << 12 | b << 8 | c << 4 | d] = (uint16_t)(i + 1);
+          }
+        }
+      }
+    }
+  } //..for
+  dtcIndexBuilt = true;
+} //..build_dtc_index
+
+/**
+ * @brief DTC description by the two code bytes
+ *
+ * @param code - first byte << 8 | second byte
+ * @return const char* description or "Unknown DTC"
+ */
+const char *get_dtc_descr_code(uint16_t code) {
+  if (!dtcIndexBuilt)
+    build_dtc_index();
+  uint16_t entry = dtcIndex[code];
+  return entry ? g_Known_DTCs[entry - 1].szDescr : "Unknown DTC";
+} //..get_dtc_descr_code
+
+/**
+ * @brief DTC description by its text
+ * @remark "HH-HH" codes (as dtc_fromdata() writes them) are looked up in the
+ * index, anything else is matched against the table one entry at a time
+ */
+const char *get_dtc_descr(const char *dtc_str) {
+  int n[4] = {hex_nibble(dtc_str[0]), -1, -1, -1};
+  if (n[0] >= 0 && (n[1] = hex_nibble(dtc_str[1])) >= 0 && dtc_str[2] == '-' &&
+      (n[2] = hex_nibble(dtc_str[3])) >= 0 &&
+      (n[3] = hex_nibble(dtc_str[4])) >= 0 && dtc_str[5] == 0)
+    return get_dtc_descr_code((uint16_t)(n[0] << 12 | n[1] << 8 | n[2] << 4 | n[3]));
+  return get_dtc_descr_scan(dtc_str);
+} //..get_dtc_descr
+
+/**
+ * @brief get DTC from HONDA_PACKET structure
+ *
+ * @param hp - HONDA_PACKET structure pointer
+ * @return const char* DTC in text format `53-89`
+ */
+const char *dtc_fromdata(HONDA_PACKET *hp) {
+  sprintf(szOut, "%02X-%02X", hp->cmd[0], hp->cmd[1]);
+  return szOut;
+} //..dtc_fromdata
+
+/** checks if the crash data inside reply: */
+int check_crash(const HONDA_PACKET *hp) {
+  for (int i = 0; i < hp->cmd_len; i++) {
+    if (hp->cmd[i]) {
+      return 1;
+    }
+  }
+  return 0;
+} //..check_crash
+
+/**
+ * @brief look up the calibrated timing of an ECU
+ * @param file - timing file, lines of "ecu p1Max p2Max p3Min retries
+ * keepAlive tinil twup", ms
+ * @param ecu - ECU key, no blanks
+ * @param t - set if the ECU is in the file
+ * @return 1 if found
+ */
+int load_timing(const char *file, const char *ecu, HONDA_TIMING *t) {
+  FILE *fp = fopen(file, "r");
+  if (!fp)
+    return 0;
+  char line[256], key[128];
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), fp)) {
+    HONDA_TIMING v;
+    found = sscanf(line, "%127s %d %d %d %d %d %d %d", key, &v.p1Max,
+                   &v.p2Max, &v.p3Min, &v.retries, &v.keepAlive, &v.tinil,
+                   &v.twup) == 8 &&
+            strcmp(key, ecu) == 0;
+    if (found)
+      *t = v;
+  }
+  fclose(fp);
+  return found;
+} //..load_timing
+
+/**
+ * @brief store the calibrated timing of an ECU, replacing its old line
+ * @return 1 on success
+ */
+int save_timing(const char *file, const char *ecu, const HONDA_TIMING *t) {
+  static char buf[64 * 1024];
+  size_t len = 0;
+  FILE *fp = fopen(file, "r");
+  if (fp) {
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+  }
+  buf[len] = 0;
+  if (!(fp = fopen(file, "w")))
+    return 0;
+  size_t keyLen = strlen(ecu);
+  int newline = 1;
+  for (char *line = buf; *line;) {
+    char *next = strchr(line, '\n');
+    next = next ? next + 1 : line + strlen(line);
+    if (!(strncmp(line, ecu, keyLen) == 0 &&
+          (line[keyLen] == ' ' || line[keyLen] == '\t'))) {
+      fwrite(line, 1, next - line, fp);
+      newline = next[-1] == '\n';
+    }
+    line = next;
+  }
+  if (!newline)
+    fputc('\n', fp);
+  fprintf(fp, "%s %d %d %d %d %d %d %d\n", ecu, t->p1Max, t->p2Max, t->p3Min,
+          t->retries, t->keepAlive, t->tinil, t->twup);
+  return fclose(fp) == 0;
+} //..save_timing
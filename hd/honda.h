@@ -0,0 +1,91 @@
+#pragma once
+
+// Honda K-line packet helpers, shared by hd and the benchmarks
+
+#include <stdint.h>
+#include "../common/j2534_tactrix.h"
+
+/*
+HONDA KEIHIN KLINE PROTOCOL (DIAGNOSTIC)
+    Pin Tx = Low (70 ms)
+    Pin Tx = High (120 ms)
+    Set Baudrate = 10400 bps
+    Wake Up with send to ECU code = FE 04 72 8C
+    ECU Response with code = 0E 04 72 7C
+    Send Initialise code = 72 05 00 F0 99
+    ECU Response = 02 04 00 FA
+    Repeat point 1 if there is no response from the ECU. And continue the next
+Steps if there is a response from the ECU
+DESCRIPTION:
+    Request = 72 AA BB CC CS
+    72 = Request Header Code
+    AA = Number of Bytes (including the Checksum)
+    BB = Query Table
+    CC = Table
+    CS = Checksum
+
+CHECKSUM
+
+    Usually to make a data table can be started from 00 to FF. With code 72 05
+71 ZZ CS Where ZZ = data table 00 to FF and CS = Checksum The formula checksum =
+100 - (sumbyte and FF) For example the data request Table 13 = 72 05 71 13 CS
+Then the checksum value = 100 - ((72 + 05 + 71 + 13) AND FF) , result CS = 05 So
+the data request table 13 = 72 05 71 13 05
+
+
+*/
+#define HONDA_MAX_DATASIZE 100
+
+/** HONDA message packet structure */
+typedef struct {
+  uint8_t hrc;
+  uint8_t cmd_len;
+  uint8_t cmd[HONDA_MAX_DATASIZE];
+} HONDA_PACKET;
+
+
+/** K-line timing of a diagnostic session, ms */
+typedef struct {
+  int p1Max;   // inter-byte gap that ends a message at the interface
+  int p2Max;   // end of request to complete reply
+  int p3Min;   // end of reply to next request
+  int retries; // extra attempts after a bad checksum or no reply
+  int keepAlive; // idle time between two KEEP_ALIVE messages, 0 = none
+  int tinil;     // wake up pulse low
+  int twup;      // wake up pulse, low and high (~120ms why? don't ask)
+} HONDA_TIMING;
+// replies are parsed by their length byte, so a short P1_MAX only splits
+// messages, it doesn't lose bytes
+const HONDA_TIMING HONDA_DEFAULT_TIMING = {5, 300, 20, 2, 1000, 70, 200};
+// timing calibrated per ECU, one line per ECU
+#define HONDA_TIMING_FILE "hd_timing.txt"
+// diagnostic messages:
+const HONDA_PACKET HELLO = {0x60, 0x02, {0x70, 0x02}};
+// sent by the interface while the session is idle, the shortest request
+// that gets an answer
+const HONDA_PACKET KEEP_ALIVE = HELLO;
+const HONDA_PACKET GET_ECU_INFO = {0x60, 0x02, {0x20, 0xf}};
+const HONDA_PACKET GET_ECU_SERIAL = {0x60, 0x02, {0x30, 0xf}};
+const HONDA_PACKET GET_DTC[5] = {{0x60, 0x02, {0x08, 0x06}},
+                                 {0x60, 0x02, {0x0A, 0x02}},
+                                 {0x60, 0x02, {0x0C, 0x02}}};
+const HONDA_PACKET CLR_ERR = {0x61, 0x01, {0x01}};
+const HONDA_PACKET END_SESS = {0x60, 0x02, {0x80, 0x0A}};
+// engine ECU, live data:
+const HONDA_PACKET ECU_WAKE_UP = {0xFE, 0x01, {0x72}};
+const HONDA_PACKET ECU_INIT = {0x72, 0x02, {0x00, 0xF0}};
+const HONDA_PACKET READ_TABLE = {0x72, 0x02, {0x71, 0x00}}; // cmd[1] = table
+
+void dump_hp(HONDA_PACKET *hp);
+uint8_t iso_checksum(uint8_t *data, uint16_t len);
+void make_packet(const HONDA_PACKET *cmd, PASSTHRU_MSG *msg);
+int decode_packet(PASSTHRU_MSG *msg, HONDA_PACKET *cmd);
+const char *hextostr(uint8_t *ptr, int size);
+int mask_compare(const char *s1, const char *s2);
+const char *get_dtc_descr(const char *dtc_str);
+const char *get_dtc_descr_code(uint16_t code);
+const char *get_dtc_descr_scan(const char *dtc_str);
+const char *dtc_fromdata(HONDA_PACKET *hp);
+int check_crash(const HONDA_PACKET *hp);
+int load_timing(const char *file, const char *ecu, HONDA_TIMING *t);
+int save_timing(const char *file, const char *ecu, const HONDA_TIMING *t);
@@ -8,79 +8,98 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "../common/J2534.h"
-#include <conio.h>
+#include "../common/klog_format.h"
+#include "../common/keepalive.h"
+#include "../common/kline_frame.h"
+#include "../common/kmsg.h"
+#include "../common/platform.h"
+#include "../common/pollsched.h"
+#include "honda.h"
+#include <chrono>
 #include <iostream>
 #include <stdio.h>
-#include <tchar.h>
-#include <time.h>
-#include <windows.h>
-#include "dtc.h"
+#include <string.h>
+#include <mutex>
+#include <thread>
 
 // #define DEBUG_MESSAGES
 // #define TESTS
 
-/*
-HONDA KEIHIN KLINE PROTOCOL (DIAGNOSTIC)
-    Pin Tx = Low (70 ms)
-    Pin Tx = High (120 ms)
-    Set Baudrate = 10400 bps
-    Wake Up with send to ECU code = FE 04 72 8C
-    ECU Response with code = 0E 04 72 7C
-    Send Initialise code = 72 05 00 F0 99
-    ECU Response = 02 04 00 FA
-    Repeat point 1 if there is no response from the ECU. And continue the next
-Steps if there is a response from the ECU
-DESCRIPTION:
-    Request = 72 AA BB CC CS
-    72 = Request Header Code
-    AA = Number of Bytes (including the Checksum)
-    BB = Query Table
-    CC = Table
-    CS = Checksum
-
-CHECKSUM
-
-    Usually to make a data table can be started from 00 to FF. With code 72 05
-71 ZZ CS Where ZZ = data table 00 to FF and CS = Checksum The formula checksum =
-100 - (sumbyte and FF) For example the data request Table 13 = 72 05 71 13 CS
-Then the checksum value = 100 - ((72 + 05 + 71 + 13) AND FF) , result CS = 05 So
-the data request table 13 = 72 05 71 13 05
+#define MAX_DEVICES 8 // adapters checked at once in fleet mode
+#define MAX_TABLES 32 // data tables polled at once
+#define CALIBRATION_PROBES 5 // requests per timing tried
+#define ENGINE_ECU "engine" // timing file key of the engine ECU
 
+void usage() { printf("Diagnostics of HONDA CR-V 3 SRS ECU.\n\n"); }
+void help() {
+  printf("hd {switches}\n\n"
+         "    /o [name,...] J2534 device(s) to use, with several all vehicles "
+         "are checked at once\n"
+         "                  (fleet mode: no questions, crash data is reported "
+         "but not cleared)\n"
+         "    /r [file] write a JSON report of the session(s)\n"
+         "    /c calibrate the K-line timing of the ECU(s) and save it "
+         "to " HONDA_TIMING_FILE "\n"
+         "    /t [table[:rate],...] log the engine ECU's data tables (hex) "
+         "instead,\n"
+         "                  rate in samples/s, in priority order; tables "
+         "without a rate\n"
+         "                  share what the bus has left\n"
+         "    /w [file] write the samples as a binary capture (klogger /f "
+         "bin)\n"
+         "    /d [seconds] stop logging after this time, not at a key "
+         "press\n");
+  exit(0);
+}
 
-*/
-#define HONDA_MAX_DATASIZE 100
+typedef std::chrono::steady_clock clk;
 
-/** HONDA message packet structure */
-typedef struct {
-  uint8_t hrc;
-  uint8_t cmd_len;
-  uint8_t cmd[HONDA_MAX_DATASIZE];
-} HONDA_PACKET;
-
-const int HONDA_PROPRIETARY_TINIL = 70; // 70ms
-const int HONDA_PROPRIETARY_TWUP = 200; //~120ms why? don't ask
-// diagnostic messages:
-const HONDA_PACKET HELLO = {0x60, 0x02, {0x70, 0x02}};
-const HONDA_PACKET GET_ECU_INFO = {0x60, 0x02, {0x20, 0xf}};
-const HONDA_PACKET GET_ECU_SERIAL = {0x60, 0x02, {0x30, 0xf}};
-const HONDA_PACKET GET_DTC[5] = {{0x60, 0x02, {0x08, 0x06}},
-                                 {0x60, 0x02, {0x0A, 0x02}},
-                                 {0x60, 0x02, {0x0C, 0x02}}};
-const HONDA_PACKET CLR_ERR = {0x61, 0x01, {0x01}};
-const HONDA_PACKET END_SESS = {0x60, 0x02, {0x80, 0x0A}};
-//
-char szOut[1024]; // output string
+/** transact() results */
+enum { TXN_OK, TXN_NO_REPLY, TXN_BAD_CHECKSUM };
 
-void usage() { printf("Diagnostics of HONDA CR-V 3 SRS ECU.\n\n"); }
-void ECU_silent() {
-  printf("Error receiving ECU response\n\n");
-  exit(1);
-}
+/** what the SRS sequence found on one vehicle */
+typedef struct {
+  const char *error;       //!< NULL if the sequence completed
+  HONDA_PACKET someId;     //!< reply to HELLO
+  char ecuId[HONDA_MAX_DATASIZE + 1];
+  char ecuSerial[HONDA_MAX_DATASIZE + 1];
+  uint16_t dtc[3];         //!< codes set, numDtc of them
+  int numDtc;
+  HONDA_PACKET endSession; //!< reply to END_SESS, crash data if not all 0
+  int crash;
+  int crashCleared;
+  int dtcCleared;
+  double ms; //!< session time
+} SRS_RESULT;
+
+/** one adapter and the ECU session on it */
+typedef struct {
+  const char *name; //!< PassThruOpen name, NULL for the default device
+  bool interactive; //!< print progress, ask before clearing crash data
+  unsigned long devID;
+  unsigned long chanID;
+  int firstMessage; //!< next request goes out with the wake up pulse
+  HONDA_TIMING timing;
+  clk::time_point nextTx; //!< earliest time the ECU accepts the next request
+  unsigned int retries;
+  unsigned long rxTimestamp; //!< interface time of the last reply's end, us
+  unsigned int rxChunks;     //!< messages the last reply came in
+  int calibrate;             //!< measure the timing of the ECU and save it
+  KeepAlive keepAlive; //!< held while requests go out
+  char adapterSerial[256];
+  SRS_RESULT result;
+} HD_SESSION;
 
 J2534 j2534;
-unsigned long devID;
-unsigned long chanID;
-int g_FirstMessage = 1;
+HD_SESSION sessions[MAX_DEVICES];
+unsigned int numSessions = 0;
+std::mutex timingLock; //!< fleet workers share the timing file
+
+/** J2534 call latencies, printed however hd exits */
+void dump_latency() {
+  printf("\n");
+  j2534.dumpLatency(stdout);
+} //..dump_latency
 
 void reportJ2534Error() {
   char err[512];
@@ -92,126 +111,12 @@ void dump_msg(PASSTHRU_MSG *msg) {
   if (msg->RxStatus & START_OF_MESSAGE)
     return; // skip
 
-  printf("[%u] ", msg->Timestamp);
-  for (unsigned int i = 0; i < msg->DataSize; i++)
-    printf("%02X ", msg->Data[i]);
-  printf("\n");
+  static char line[KLOG_MAX_TEXT_LINE];
+  KMSG_VIEW v = passthru_view(msg);
+  fwrite(line, 1, klog_format_text(line, &v), stdout);
 } //..dump_msg
 
-/**
- * @brief dump HONDA_PACKET
- * @remark used for debugging, set DEBUG_MESSAGES to see all traffic in output
- * @param hp HONDA_PACKET pointer
- */
-void dump_hp(HONDA_PACKET *hp) {
-  printf("Packet : %02X [", hp->hrc);
-  for (unsigned int i = 0; i < hp->cmd_len; i++)
-    printf("%02X ", hp->cmd[i]);
-  printf("]\n");
-} //..dump_hp
-
-/**
- * @brief calculate checksum of the message received or to be transferred
- * @param data - data array
- * @param len - length of the data array
- * @return 8-bit checksum
- */
-uint8_t iso_checksum(uint8_t *data, uint16_t len) {
-  uint8_t crc = 0;
-  for (uint8_t i = 0; i < len; i++)
-    crc = crc + data[i];
-  return 0x100 - crc;
-} //..iso_checksum
-
-/**
- * @brief create PASSTHRU_MSG from HONDA_PACKET structure
- * @param cmd - HONDA_PACKET structure pointer
- * @param msg - destination PASSTHRU_MSG structure
- * @remark in the destination packet filled only DataSize and Data
- * parameters, no other fields are filled up.
- */
-void make_packet(const HONDA_PACKET *cmd, PASSTHRU_MSG *msg) {
-  memset(msg->Data, 0, 100);
-  msg->Data[0] = cmd->hrc;
-  uint8_t alen = cmd->cmd_len + 3;
-  msg->Data[1] = alen;
-  memcpy(msg->Data + 2, cmd->cmd, cmd->cmd_len);
-  msg->Data[alen - 1] = iso_checksum(msg->Data, alen - 1);
-  msg->DataSize = alen;
-} //..make_packet
-
-/**
- * @brief  fill up HONDA_PACKET structure from received PASSTHRU_MSG
- * @param msg - received PASSTHRU_MSG structure
- * @param cmd - HONDA_PACKET destination structure pointer
- * @return 1 on success, 0 - on checksum error
- */
-int decode_packet(PASSTHRU_MSG *msg, HONDA_PACKET *cmd) {
-  int br = 1;
-  cmd->hrc = msg->Data[0];
-  cmd->cmd_len = msg->DataSize - 3;
-  uint8_t cs = iso_checksum(msg->Data, msg->DataSize - 1);
-  if (cs != msg->Data[msg->DataSize - 1]) {
-    printf("Invalid checksum in result!"); // << warning
-    br = 0;
-  }
-  if (cmd->cmd_len > HONDA_MAX_DATASIZE)
-    cmd->cmd_len = HONDA_MAX_DATASIZE;
-  memcpy(cmd->cmd, msg->Data + 2, cmd->cmd_len);
-  return br;
-} //..decode_packet
-
-/**
- * @brief convert binary to hex string
- *
- * @param ptr - binary data
- * @param size - size of the data
- * @return const char* string with hex
- */
-const char *hextostr(uint8_t *ptr, int size) {
-  char szHex[5];
-  szOut[0] = 0;
-  for (unsigned int i = 0; i < size; i++) {
-    sprintf(szHex, "%02X ", ptr[i]);
-    strcat(szOut, szHex);
-  } //..for
-  // szOut[size] = 0;
-  return szOut;
-} //..hextostr
-
-int mask_compare(const char *s1, const char *s2) {
-  for (int i = 0; i < strlen(s1); i++) {
-    if (i > strlen(s2))
-      return 1;
-    if ('x' == s1[i]) // any symbol
-      continue;
-    if (s1[i] != s2[i])
-      return s1[i] - s2[i];
-  } //..for
-  return 0;
-} //..mask_compare
-
-const char *get_dtc_descr(const char* dtc_str) {
-  for (int i = 0; i < sizeof(g_Known_DTCs) / sizeof(DTC_struct); i++) {
-    if (0 == mask_compare(g_Known_DTCs[i].szCode, dtc_str)) {
-      return g_Known_DTCs[i].szDescr;
-    }
-  } //..for
-  return "Unknown DTC";
-} //..get_dtc_descr
-
-/**
- * @brief get DTC from HONDA_PACKET structure
- *
- * @param hp - HONDA_PACKET structure pointer
- * @return const char* DTC in text format `53-89`
- */
-const char *dtc_fromdata(HONDA_PACKET *hp) {
-  sprintf(szOut, "%02X-%02X", hp->cmd[0], hp->cmd[1]);
-  return szOut;
-} //..dtc_fromdata
-
-bool get_serial_num(char *serial) {
+bool get_serial_num(HD_SESSION *s, char *serial) {
   struct {
     unsigned int length;
     unsigned int svcid;
@@ -230,7 +135,7 @@ bool get_serial_num(char *serial) {
 
   outbuf.length = sizeof(outbuf.data);
 
-  if (j2534.PassThruIoctl(devID, TX_IOCTL_APP_SERVICE, &inbuf, &outbuf)) {
+  if (j2534.PassThruIoctl(s->devID, TX_IOCTL_APP_SERVICE, &inbuf, &outbuf)) {
     serial[0] = 0;
     return false;
   }
@@ -240,30 +145,73 @@ bool get_serial_num(char *serial) {
   return true;
 }
 
-/** receive HONDA_PACKET from k-line
+/** receive the reply to txmsg from k-line
+ * @param s - session
  * @param hp - HONDA_PACKET var pointer
- * @return 1 on message received, 0 on no messages received
+ * @param txmsg - request sent, skipped if the interface echoes it
+ * @param rxmsg - bytes received so far (the FAST_INIT answer), completed here
+ * @param deadline - give up waiting for the rest at this time
+ * @return TXN_OK as soon as a complete reply with a good checksum is in,
+ * TXN_BAD_CHECKSUM, or TXN_NO_REPLY after the deadline
+ * @remark the reply is cut at its length byte, it may come in several
+ * messages or together with trailing bytes
  */
-int receivemsg(HONDA_PACKET *hp) {
-  unsigned long numRxMsg;
-  int nResult = 0;
-  PASSTHRU_MSG rxmsg;
-  memset(&rxmsg, 0, sizeof(rxmsg));
-  time_t last_status_update = time(NULL);
-  numRxMsg = 1;
-  while (time(NULL) - last_status_update < 5) {
-    if (0 == j2534.PassThruReadMsgs(chanID, &rxmsg, &numRxMsg, 1000)) {
-      if (numRxMsg && rxmsg.DataSize) {
-#ifdef DEBUG_MESSAGES
-        dump_msg(&rxmsg); // debug
-#endif
-        decode_packet(&rxmsg, hp);
-        nResult = 1;
-        break;
+int receivemsg(HD_SESSION *s, HONDA_PACKET *hp, const PASSTHRU_MSG *txmsg,
+               PASSTHRU_MSG *rxmsg, clk::time_point deadline) {
+  PASSTHRU_MSG msg;
+  bool echoChecked = false;
+  s->rxChunks = rxmsg->DataSize ? 1 : 0;
+  for (;;) {
+    if (!echoChecked) {
+      size_t n = rxmsg->DataSize < txmsg->DataSize ? rxmsg->DataSize
+                                                   : txmsg->DataSize;
+      if (memcmp(rxmsg->Data, txmsg->Data, n) == 0) {
+        if (rxmsg->DataSize >= txmsg->DataSize) {
+          rxmsg->DataSize -= txmsg->DataSize;
+          memmove(rxmsg->Data, rxmsg->Data + txmsg->DataSize,
+                  rxmsg->DataSize);
+          echoChecked = true;
+        }
+      } else
+        echoChecked = true;
+    }
+    if (echoChecked && rxmsg->DataSize) {
+      KFRAME_INFO info;
+      int r = kframe_decode(KFRAME_HONDA, rxmsg->Data, rxmsg->DataSize, &info);
+      if (r != 0) {
+        s->nextTx = clk::now() + std::chrono::milliseconds(s->timing.p3Min);
+        if (r != 1)
+          return TXN_BAD_CHECKSUM;
+        rxmsg->DataSize = info.size;
+        decode_packet(rxmsg, hp);
+        s->rxTimestamp = rxmsg->Timestamp;
+        return TXN_OK;
       }
     }
+
+    clk::time_point now = clk::now();
+    if (now >= deadline)
+      return TXN_NO_REPLY;
+    unsigned long left = (unsigned long)std::chrono::duration_cast<
+                             std::chrono::milliseconds>(deadline - now)
+                             .count() +
+                         1;
+    unsigned long numRxMsg = 1;
+    if (j2534.PassThruReadMsgs(s->chanID, &msg, &numRxMsg, left) || !numRxMsg)
+      continue;
+    if (msg.RxStatus & (START_OF_MESSAGE | TX_MSG_TYPE))
+      continue;
+#ifdef DEBUG_MESSAGES
+    dump_msg(&msg); // debug
+#endif
+    unsigned long size = msg.DataSize;
+    if (size > PASSTHRU_MSG_DATA_SIZE - rxmsg->DataSize)
+      size = PASSTHRU_MSG_DATA_SIZE - rxmsg->DataSize;
+    memcpy(rxmsg->Data + rxmsg->DataSize, msg.Data, size);
+    rxmsg->DataSize += size;
+    rxmsg->Timestamp = msg.Timestamp;
+    s->rxChunks++;
   }
-  return nResult;
 } //..receivemsg
 
 /*
@@ -282,236 +230,722 @@ A pulse of 70 ms similar to the Fast Init of ISO14230 is sent to wake up the ECU
 before communication starts.
 */
 
-int sendmsg(const HONDA_PACKET *hp) {
-  PASSTHRU_MSG txmsg, rxmsg;
+/** send one request, the first one with the wake up pulse
+ * @param s - session
+ * @param txmsg - request
+ * @param rxmsg - receives the answer to the wake up, DataSize 0 otherwise
+ * @return J2534 status
+ */
+int sendmsg(HD_SESSION *s, PASSTHRU_MSG *txmsg, PASSTHRU_MSG *rxmsg) {
   unsigned long NumMsgs = 1;
-
-  txmsg.ProtocolID = ISO9141_K;
-  txmsg.RxStatus = 0;
-  txmsg.TxFlags = 0;
-  txmsg.Timestamp = time(NULL);
-  txmsg.DataSize = 0;
-  txmsg.ExtraDataIndex = 0;
-  make_packet(hp, &txmsg);
+  rxmsg->DataSize = 0;
+  rxmsg->Timestamp = 0;
 #ifdef DEBUG_MESSAGES
-  dump_msg(&txmsg); // debug
+  dump_msg(txmsg); // debug
 #endif
-  if (g_FirstMessage) {
-    g_FirstMessage = 0;
-    if (j2534.PassThruIoctl(chanID, FAST_INIT, &txmsg, &rxmsg)) {
-      // printf("Error sending hello message\n");
-      //   return 0;
-    }
-  } else
-    return j2534.PassThruWriteMsgs(chanID, &txmsg, &NumMsgs, 0);
-  return 0;
+  if (s->firstMessage) {
+    long r = j2534.PassThruIoctl(s->chanID, FAST_INIT, txmsg, rxmsg);
+    if (r)
+      rxmsg->DataSize = 0;
+    return r;
+  }
+  return j2534.PassThruWriteMsgs(s->chanID, txmsg, &NumMsgs, 0);
 } //..sendmsg
 
-/** checks if the crash data inside reply: */
-int check_crash(const HONDA_PACKET *hp) {
-  for (int i = 0; i < hp->cmd_len; i++) {
-    if (hp->cmd[i]) {
-      return 1;
+/** one request / reply exchange
+ * @param s - session
+ * @param req - request
+ * @param hp - reply
+ * @return TXN_OK, or the failure of the last attempt
+ * @remark the request goes out as soon as the ECU's P3 gap after the
+ * previous reply has passed; a reply with a bad checksum, or none within
+ * P2, is asked for again up to s->timing.retries times; the keep-alive
+ * is held meanwhile
+ */
+int transact(HD_SESSION *s, const HONDA_PACKET *req, HONDA_PACKET *hp) {
+  PASSTHRU_MSG txmsg, rxmsg;
+  passthru_init(&txmsg, ISO9141_K, 0);
+  make_packet(req, &txmsg);
+
+  int result = TXN_NO_REPLY;
+  s->keepAlive.hold();
+  for (int attempt = 0; attempt <= s->timing.retries; attempt++) {
+    if (attempt) {
+      s->retries++;
+      // drop the rest of a garbled reply before asking again
+      j2534.PassThruIoctl(s->chanID, CLEAR_RX_BUFFER, NULL, NULL);
+    }
+    std::this_thread::sleep_until(s->nextTx);
+    if (sendmsg(s, &txmsg, &rxmsg))
+      continue;
+    // the request itself takes about 1 ms per byte on the wire
+    clk::time_point deadline =
+        clk::now() +
+        std::chrono::milliseconds(s->timing.p2Max + txmsg.DataSize);
+    result = receivemsg(s, hp, &txmsg, &rxmsg, deadline);
+    if (result == TXN_OK) {
+      s->firstMessage = 0;
+      break;
     }
   }
-  return 0;
-} //..check_crash
+  s->keepAlive.release();
+  return result;
+} //..transact
 
-int _tmain(int argc, _TCHAR *argv[]) {
-  char *outfile = NULL;
+/** let the interface keep the ECU awake while the session is idle
+ * @remark the first keep-alive goes out timing.keepAlive ms after the
+ * last hold is released
+ */
+void start_keep_alive(HD_SESSION *s) {
+  if (s->timing.keepAlive <= 0)
+    return;
+  PASSTHRU_MSG msg;
+  passthru_init(&msg, ISO9141_K, 0);
+  make_packet(&KEEP_ALIVE, &msg);
+  if (!s->keepAlive.start(&j2534, s->chanID, &msg, s->timing.keepAlive,
+                          s->timing.p2Max) &&
+      s->interactive)
+    reportJ2534Error();
+} //..start_keep_alive
+
+/** report a failed J2534 call of open_session()
+ * @return what, the session's error
+ */
+const char *j2534_failed(HD_SESSION *s, const char *what) {
+  if (s->interactive)
+    reportJ2534Error();
+  return what;
+} //..j2534_failed
+
+/** open the adapter and set up its K-line channel
+ * @param s - session, name set
+ * @return NULL on success, the error otherwise (nothing is left open)
+ */
+const char *open_session(HD_SESSION *s) {
   unsigned int protocol = ISO9141_K;
   unsigned int baudrate = 10400;
   unsigned int parity = NO_PARITY;
-  unsigned int timeout = 50;
 
-  usage();
-
-  if (!j2534.init()) {
-    printf("can't connect to J2534 DLL.\n");
-    return 0;
-  }
-
-  if (j2534.PassThruOpen(NULL, &devID)) {
-    reportJ2534Error();
-    return 0;
-  }
+  if (j2534.PassThruOpen(s->name, &s->devID))
+    return j2534_failed(s, "can't open J2534 device");
 
   char strApiVersion[256];
   char strDllVersion[256];
   char strFirmwareVersion[256];
-  char strSerial[256];
 
   if (j2534.PassThruReadVersion(strApiVersion, strDllVersion,
-                                strFirmwareVersion, devID)) {
-    reportJ2534Error();
-    return false;
-  }
-
-  if (!get_serial_num(strSerial)) {
-    reportJ2534Error();
-    return false;
+                                strFirmwareVersion, s->devID) ||
+      !get_serial_num(s, s->adapterSerial)) {
+    const char *err = j2534_failed(s, "can't read J2534 device version");
+    j2534.PassThruClose(s->devID);
+    return err;
   }
 
   // printf("J2534 API Version: %s\n", strApiVersion);
   // printf("J2534 DLL Version: %s\n", strDllVersion);
   // printf("Device Firmware Version: %s\n", strFirmwareVersion);
-  // printf("Device Serial Number: %s\n", strSerial);
+  // printf("Device Serial Number: %s\n", s->adapterSerial);
 
   // use ISO9141_NO_CHECKSUM to disable checksumming on both tx and rx
   // messages
-  if (j2534.PassThruConnect(devID, protocol,
+  if (j2534.PassThruConnect(s->devID, protocol,
                             ISO9141_K_LINE_ONLY | ISO9141_NO_CHECKSUM, baudrate,
-                            &chanID)) {
-    reportJ2534Error();
-    return 0;
+                            &s->chanID)) {
+    const char *err = j2534_failed(s, "can't connect K-line channel");
+    j2534.PassThruClose(s->devID);
+    return err;
   }
 
   // set timing, honda specific parameters
   SCONFIG_LIST scl;
   SCONFIG scp[4] = {{P1_MAX, 0}, {PARITY, 0}, {TWUP, 50}, {TINIL, 25}};
   scl.NumOfParams = 4;
-  scp[0].Value = timeout * 2;
+  scp[0].Value = s->timing.p1Max * 2; // 0.5 ms units
   scp[1].Value = parity;
-  scp[2].Value = HONDA_PROPRIETARY_TWUP;
-  scp[3].Value = HONDA_PROPRIETARY_TINIL;
+  scp[2].Value = s->timing.twup;
+  scp[3].Value = s->timing.tinil;
   scl.ConfigPtr = scp;
-  if (j2534.PassThruIoctl(chanID, SET_CONFIG, &scl, NULL)) {
+  if (j2534.PassThruIoctl(s->chanID, SET_CONFIG, &scl, NULL) && s->interactive) {
     reportJ2534Error();
   }
   // printf("Configured successfully...\n");
 
-  PASSTHRU_MSG txmsg;
-
   // now setup the filter(s)
   PASSTHRU_MSG msgMask, msgPattern;
   unsigned long msgId;
-  unsigned long numRxMsg;
-  HONDA_PACKET hpRec; //!< recieve packet
 
   // simply create a "pass all" filter so that we can see
   // everything unfiltered in the raw stream
-  txmsg.ProtocolID = protocol;
-  txmsg.RxStatus = 0;
-  txmsg.TxFlags = 0;
-  txmsg.Timestamp = 0;
-  txmsg.DataSize = 1;
-  txmsg.ExtraDataIndex = 0;
-  msgMask = msgPattern = txmsg;
-  memset(msgMask.Data, 0, 1);    // mask the first byte to 0
-  memset(msgPattern.Data, 0, 1); // match it with 0 (i.e. pass everything)
-  if (j2534.PassThruStartMsgFilter(chanID, PASS_FILTER, &msgMask, &msgPattern,
-                                   NULL, &msgId)) {
-    reportJ2534Error();
-    return 0;
+  passthru_init(&msgMask, protocol, 1);
+  passthru_init(&msgPattern, protocol, 1);
+  msgMask.Data[0] = 0;    // mask the first byte to 0
+  msgPattern.Data[0] = 0; // match it with 0 (i.e. pass everything)
+  if (j2534.PassThruStartMsgFilter(s->chanID, PASS_FILTER, &msgMask,
+                                   &msgPattern, NULL, &msgId)) {
+    const char *err = j2534_failed(s, "can't set up message filter");
+    j2534.PassThruDisconnect(s->chanID);
+    j2534.PassThruClose(s->devID);
+    return err;
   }
+  return NULL;
+} //..open_session
 
-  printf("Start-up communication...\n");
-  HONDA_PACKET hp = HELLO;
-  sendmsg(&hp);
-  receivemsg(&hpRec);
-#ifndef TESTS
-  printf("Reading ECU information...\n");
-  hp.cmd[1] = 0x0F;
-  sendmsg(&hp);
-  if (!receivemsg(&hpRec)) {
-    ECU_silent();
+/** shut down the channel and close the device
+ * @return 1 on success
+ */
+int close_session(HD_SESSION *s) {
+  s->keepAlive.stop();
+  if (j2534.PassThruDisconnect(s->chanID)) {
+    if (s->interactive)
+      reportJ2534Error();
+    return 0;
   }
-  // get ECU info
-  printf("SOME ID: %s\n", hextostr(hpRec.cmd, hpRec.cmd_len));
-  hp = GET_ECU_INFO;
-  sendmsg(&hp);
-  if (!receivemsg(&hpRec)) {
-    ECU_silent();
+  if (j2534.PassThruClose(s->devID)) {
+    if (s->interactive)
+      reportJ2534Error();
+    return 0;
   }
-  printf("ECU ID: %s\n", hpRec.cmd);
+  return 1;
+} //..close_session
+
+/** hand the interface timing of the session to the channel
+ * @return J2534 status
+ */
+long apply_timing(HD_SESSION *s) {
+  SCONFIG_LIST scl;
+  SCONFIG scp[3] = {{P1_MAX, 0}, {TWUP, 0}, {TINIL, 0}};
+  scp[0].Value = s->timing.p1Max * 2; // 0.5 ms units
+  scp[1].Value = s->timing.twup;
+  scp[2].Value = s->timing.tinil;
+  scl.NumOfParams = 3;
+  scl.ConfigPtr = scp;
+  return j2534.PassThruIoctl(s->chanID, SET_CONFIG, &scl, NULL);
+} //..apply_timing
 
-  hp = GET_ECU_SERIAL;
-  sendmsg(&hp);
-  if (!receivemsg(&hpRec)) {
-    ECU_silent();
+/** send probe count times at the session's timing
+ * @param worst - raised to the longest request to reply time seen, ms
+ * @param chunks - raised to the most messages a reply came in
+ * @return 1 if every probe was answered at the first attempt
+ */
+int probe_timing(HD_SESSION *s, const HONDA_PACKET *probe, int count,
+                 double *worst, unsigned int *chunks) {
+  HONDA_PACKET hpRec;
+  for (int i = 0; i < count; i++) {
+    unsigned int retries = s->retries;
+    clk::time_point start = clk::now();
+    if (start < s->nextTx)
+      start = s->nextTx;
+    if (transact(s, probe, &hpRec) != TXN_OK || s->retries != retries)
+      return 0;
+    double ms =
+        std::chrono::duration<double, std::milli>(clk::now() - start).count();
+    if (ms > *worst)
+      *worst = ms;
+    if (s->rxChunks > *chunks)
+      *chunks = s->rxChunks;
+  }
+  return 1;
+} //..probe_timing
+
+/** find the fastest timing the ECU answers reliably at
+ * @param probe - harmless request the ECU answers
+ * @return 1 if s->timing was tightened, 0 if the ECU doesn't even answer
+ * at the current timing (left as it was)
+ * @remark P3 (gap before the next request) and P1_MAX (end of message at
+ * the interface) are lowered step by step while every probe is answered
+ * at once and every reply still comes in one message. P2 is set from the
+ * slowest reply seen, with headroom. The wake up pulse isn't searched,
+ * each try needs an ECU that left its session; tinil/twup can be edited
+ * in the timing file instead.
+ */
+int calibrate(HD_SESSION *s, const HONDA_PACKET *probe) {
+  static const int gaps[] = {15, 10, 5, 2, 0};
+  static const int eoms[] = {4, 3, 2, 1};
+  unsigned int retries = s->retries;
+  double worst = 0;
+  unsigned int chunks = 0;
+  if (!probe_timing(s, probe, CALIBRATION_PROBES, &worst, &chunks)) {
+    s->retries = retries;
+    return 0;
   }
-  printf("ECU SERIAL: %s\n", hpRec.cmd);
+  for (size_t i = 0; i < sizeof(gaps) / sizeof(gaps[0]); i++) {
+    if (gaps[i] >= s->timing.p3Min)
+      continue;
+    int p3Min = s->timing.p3Min;
+    s->timing.p3Min = gaps[i];
+    if (!probe_timing(s, probe, CALIBRATION_PROBES, &worst, &chunks)) {
+      s->timing.p3Min = p3Min;
+      break;
+    }
+  }
+  for (size_t i = 0; i < sizeof(eoms) / sizeof(eoms[0]); i++) {
+    if (eoms[i] >= s->timing.p1Max)
+      continue;
+    int p1Max = s->timing.p1Max;
+    s->timing.p1Max = eoms[i];
+    unsigned int pieces = 0;
+    if (apply_timing(s) ||
+        !probe_timing(s, probe, CALIBRATION_PROBES, &worst, &pieces) ||
+        pieces > 1) {
+      s->timing.p1Max = p1Max;
+      apply_timing(s);
+      break;
+    }
+  }
+  int p2Max = (int)(worst * 1.5) + 5;
+  if (p2Max < 20)
+    p2Max = 20;
+  if (p2Max < s->timing.p2Max)
+    s->timing.p2Max = p2Max;
+  s->retries = retries; // failed tries are part of the search
+  return 1;
+} //..calibrate
+
+/** calibrate the timing of ecu and save it, or use its saved timing
+ * @param probe - harmless request the ECU answers
+ */
+void tune_timing(HD_SESSION *s, const char *ecu, const HONDA_PACKET *probe) {
+  // the file is keyed by the whole ECU id, blanks and control bytes as _
+  char key[HONDA_MAX_DATASIZE + 1];
+  size_t i;
+  for (i = 0; ecu[i] && i < sizeof(key) - 1; i++)
+    key[i] = ecu[i] > ' ' ? ecu[i] : '_';
+  key[i] = 0;
+  const char *how = NULL;
+  if (s->calibrate) {
+    if (calibrate(s, probe)) {
+      std::lock_guard<std::mutex> lk(timingLock);
+      how = save_timing(HONDA_TIMING_FILE, key, &s->timing)
+                ? "calibrated"
+                : "calibrated, can't save it";
+    }
+  } else {
+    std::lock_guard<std::mutex> lk(timingLock);
+    if (load_timing(HONDA_TIMING_FILE, key, &s->timing)) {
+      apply_timing(s);
+      how = "saved";
+    }
+  }
+  if (how && s->interactive)
+    printf("Timing (%s): P1 %d, P2 %d, P3 %d ms\n", how, s->timing.p1Max,
+           s->timing.p2Max, s->timing.p3Min);
+} //..tune_timing
+
+/** copy a text reply, zero terminated */
+void reply_text(char *dst, const HONDA_PACKET *hp) {
+  memcpy(dst, hp->cmd, hp->cmd_len);
+  dst[hp->cmd_len] = 0;
+} //..reply_text
+
+/** end a session the ECU stopped answering
+ * @return 0
+ */
+int srs_silent(HD_SESSION *s, clk::time_point start) {
+  s->result.error = "no ECU response";
+  s->result.ms =
+      std::chrono::duration<double, std::milli>(clk::now() - start).count();
+  return 0;
+} //..srs_silent
+
+/** identifiers, DTCs and crash data of the SRS ECU, then clear the DTCs
+ * @param s - opened session
+ * @return 1 if the sequence completed, 0 if the ECU stopped answering
+ */
+int run_srs(HD_SESSION *s) {
+  SRS_RESULT *r = &s->result;
+  HONDA_PACKET hpRec; //!< recieve packet
+  clk::time_point start = clk::now();
+
+  if (s->interactive)
+    printf("Start-up communication...\n");
+  HONDA_PACKET hp = HELLO;
+  transact(s, &hp, &hpRec);
+  // back to back requests keep the session up by themselves, the keep-alive
+  // only runs while waiting for the user; close_session() stops it
+  s->keepAlive.hold();
+  start_keep_alive(s);
+  if (s->interactive)
+    printf("Reading ECU information...\n");
+  hp.cmd[1] = 0x0F;
+  if (transact(s, &hp, &r->someId) != TXN_OK)
+    return srs_silent(s, start);
+  // get ECU info
+  if (s->interactive)
+    printf("SOME ID: %s\n", hextostr(r->someId.cmd, r->someId.cmd_len));
+  if (transact(s, &GET_ECU_INFO, &hpRec) != TXN_OK)
+    return srs_silent(s, start);
+  reply_text(r->ecuId, &hpRec);
+  if (s->interactive)
+    printf("ECU ID: %s\n", r->ecuId);
+  tune_timing(s, r->ecuId, &GET_ECU_INFO);
+
+  if (transact(s, &GET_ECU_SERIAL, &hpRec) != TXN_OK)
+    return srs_silent(s, start);
+  reply_text(r->ecuSerial, &hpRec);
+  if (s->interactive)
+    printf("ECU SERIAL: %s\n", r->ecuSerial);
   // read dtc
-  printf("Reading DTC information...\n");
-  int bnoDTC = 1;
+  if (s->interactive)
+    printf("Reading DTC information...\n");
   for (int i = 0; i < 3; i++) {
-    sendmsg(&GET_DTC[i]);
-    if (!receivemsg(&hpRec)) {
-      ECU_silent();
-    }
+    if (transact(s, &GET_DTC[i], &hpRec) != TXN_OK)
+      return srs_silent(s, start);
     if (hpRec.cmd[0] || hpRec.cmd[1]) {
-      const char *szDtc = dtc_fromdata(&hpRec);
-      printf("DTC: %s %s\n", szDtc, get_dtc_descr(szDtc));
-      bnoDTC = 0;
+      uint16_t code = hpRec.cmd[0] << 8 | hpRec.cmd[1];
+      r->dtc[r->numDtc++] = code;
+      if (s->interactive)
+        printf("DTC: %02X-%02X %s\n", hpRec.cmd[0], hpRec.cmd[1],
+               get_dtc_descr_code(code));
     }
   }
   // end session
   // crash can be detected on END_SESSION reply:
-  sendmsg(&END_SESS);
-  receivemsg(&hpRec);
-  if (check_crash(&hpRec)) {
+  if (transact(s, &END_SESS, &r->endSession) != TXN_OK)
+    r->endSession.cmd_len = 0;
+  r->crash = check_crash(&r->endSession);
+  if (r->crash && s->interactive) {
     HONDA_PACKET sp = CLR_ERR;
     printf("Crash inside ECU:\n");
-    for (int i = 0; i < hpRec.cmd_len; i++) {
-      printf("%02X ", hpRec.cmd[i]);
+    for (int i = 0; i < r->endSession.cmd_len; i++) {
+      printf("%02X ", r->endSession.cmd[i]);
     }
     printf("\nClear (Y/N)?");
-    char s[100];    gets(s);
-    if (0 == strcmp("Y", s)) {
+    char str[100] = "";
+    s->keepAlive.release();
+    if (fgets(str, sizeof(str), stdin))
+      str[strcspn(str, "\r\n")] = 0;
+    s->keepAlive.hold();
+    if (0 == strcmp("Y", str)) {
       // clear crash data:
       hp = HELLO;
-      sendmsg(&hp);
-      receivemsg(&hpRec);
+      transact(s, &hp, &hpRec);
       sp.cmd[0] = 2;
-      sendmsg(&sp);
-      receivemsg(&hpRec);
+      r->crashCleared = transact(s, &sp, &hpRec) == TXN_OK;
     } // clear crash
-    sendmsg(&END_SESS);
+    transact(s, &END_SESS, &hpRec);
   } // crash work
 
   // show no dtc message:
-  if (bnoDTC)
+  if (!r->numDtc && s->interactive)
     printf("NO DTC\n");
   // clear dtc:
-  printf("Clearing DTC information...\n");
-  sendmsg(&CLR_ERR);
-  if (!receivemsg(&hpRec)) {
-    ECU_silent();
-  }
-  printf("Clear: %s\n", hextostr(hpRec.cmd, hpRec.cmd_len));
-
-#else
-
+  if (s->interactive)
+    printf("Clearing DTC information...\n");
+  if (transact(s, &CLR_ERR, &hpRec) != TXN_OK)
+    return srs_silent(s, start);
+  r->dtcCleared = 1;
+  if (s->interactive)
+    printf("Clear: %s\n", hextostr(hpRec.cmd, hpRec.cmd_len));
+  r->ms = std::chrono::duration<double, std::milli>(clk::now() - start).count();
+  return 1;
+} //..run_srs
+
+#ifdef TESTS
+/** try the CLR_ERR functions one by one */
+void run_tests(HD_SESSION *s) {
+  HONDA_PACKET hp, hpRec;
   HONDA_PACKET sp = CLR_ERR;
   for (int i = 0x2; i < 0x3; i++) {
     /** reset ECU to clear previous problems!  */
-    g_FirstMessage = 1;
+    s->firstMessage = 1;
     hp = HELLO;
-    sendmsg(&hp);
-    receivemsg(&hpRec);
+    transact(s, &hp, &hpRec);
     sp.cmd[0] = i; // i;    // function
     printf("Sending >");
     dump_hp(&sp);
-    sendmsg(&sp);
-    receivemsg(&hpRec);
+    transact(s, &sp, &hpRec);
     printf("Reply < %s\n", hextostr(hpRec.cmd, hpRec.cmd_len));
-    sendmsg(&END_SESS);
-    receivemsg(&hpRec);
+    transact(s, &END_SESS, &hpRec);
     Sleep(5);
   } //..i
+} //..run_tests
 #endif
 
-  // shut down the channel
+/** poll the engine ECU's data tables until a key is pressed or seconds
+ * have passed
+ * @param s - opened session
+ * @param t - tables in priority order, id is the table number
+ * @param n - number of tables
+ * @param fp - binary capture (klogger /f bin) of every good reply, or NULL
+ * @param seconds - 0 to run until a key is pressed
+ * @return 1 if the ECU answered until the end, 0 if it stopped
+ * @remark requests go out back to back, each as soon as the ECU's P3 gap
+ * after the previous reply has passed
+ */
+int run_datalog(HD_SESSION *s, POLL_ITEM *t, int n, FILE *fp,
+                double seconds) {
+  HONDA_PACKET hpRec;
+  KLOG_STATE st = {};
+  unsigned char buf[KLOG_MAX_RECORD];
+  if (fp) {
+    KLOG_HEADER hdr = {ISO9141_K, 10400, NO_PARITY,
+                       (unsigned long)s->timing.p1Max};
+    fwrite(buf, 1, klog_encode_header(buf, &hdr), fp);
+  }
 
-  if (j2534.PassThruDisconnect(chanID)) {
-    reportJ2534Error();
+  printf("Start-up communication...\n");
+  if (transact(s, &ECU_WAKE_UP, &hpRec) != TXN_OK ||
+      transact(s, &ECU_INIT, &hpRec) != TXN_OK)
     return 0;
+  HONDA_PACKET probe = READ_TABLE;
+  probe.cmd[1] = (uint8_t)t[0].id;
+  tune_timing(s, ENGINE_ECU, &probe);
+  printf("Logging %d table%s, press any key to stop...\n", n,
+         n == 1 ? "" : "s");
+
+  POLL_SCHEDULE ps;
+  poll_start(&ps, t, n);
+  clk::time_point end = ps.start + std::chrono::duration_cast<clk::duration>(
+                                       std::chrono::duration<double>(seconds));
+  int alive = 1;
+  while (ps.active && !(seconds > 0 && clk::now() >= end) && !_kbhit()) {
+    clk::time_point wake;
+    int i = poll_next(&ps, clk::now(), &wake);
+    if (i < 0) {
+      std::this_thread::sleep_until(seconds > 0 && end < wake ? end : wake);
+      continue;
+    }
+    HONDA_PACKET req = READ_TABLE;
+    req.cmd[1] = (uint8_t)t[i].id;
+    int r = transact(s, &req, &hpRec);
+    if (r != TXN_OK || hpRec.cmd_len < 2 || hpRec.cmd[0] != 0x71 ||
+        hpRec.cmd[1] != t[i].id) {
+      // a table the ECU doesn't know goes unanswered, each time costing all
+      // retries, so it is dropped; three tables in a row unanswered, the
+      // ECU is gone
+      if (poll_failed(&ps, i, r != TXN_NO_REPLY))
+        printf("Table %02X dropped after %d errors in a row\n", t[i].id,
+               POLL_DROP_AFTER);
+      if (ps.silent >= 3) {
+        alive = 0;
+        break;
+      }
+      continue;
+    }
+    poll_sampled(&ps, i);
+    if (fp) {
+      PASSTHRU_MSG msg;
+      passthru_init(&msg, ISO9141_K, 0);
+      msg.Timestamp = s->rxTimestamp;
+      make_packet(&hpRec, &msg);
+      KMSG_VIEW v = passthru_view(&msg);
+      fwrite(buf, 1, klog_encode_frame(buf, &st, &v), fp);
+    }
+  }
+  // every table dropped, the last ones unanswered
+  if (!ps.active && ps.silent)
+    alive = 0;
+  if (_kbhit())
+    _getch();
+
+  poll_report(stdout, &ps, "table");
+  printf("%u retries\n", s->retries);
+  return alive;
+} //..run_datalog
+
+/** fleet mode worker: the whole session on one adapter */
+void fleet_worker(HD_SESSION *s) {
+  const char *err = open_session(s);
+  if (err) {
+    s->result.error = err;
+    return;
+  }
+  run_srs(s);
+  close_session(s);
+} //..fleet_worker
+
+/** write str as a JSON string, bytes outside printable ASCII escaped */
+void json_string(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      fprintf(fp, "\\%c", *p);
+    else if (*p < 0x20 || *p > 0x7E)
+      fprintf(fp, "\\u%04x", *p);
+    else
+      fputc(*p, fp);
+  }
+  fputc('"', fp);
+} //..json_string
+
+/** write bytes as a JSON string of hex pairs */
+void json_hex(FILE *fp, const uint8_t *data, int size) {
+  fputc('"', fp);
+  for (int i = 0; i < size; i++)
+    fprintf(fp, i ? " %02X" : "%02X", data[i]);
+  fputc('"', fp);
+} //..json_hex
+
+/** one JSON object per session, in the order the devices were given */
+void write_report(FILE *fp, double totalMs) {
+  fprintf(fp, "{\n  \"total_ms\": %.0f,\n  \"vehicles\": [", totalMs);
+  for (unsigned int i = 0; i < numSessions; i++) {
+    HD_SESSION *s = &sessions[i];
+    SRS_RESULT *r = &s->result;
+    fprintf(fp, "%s\n    {\n      \"device\": ", i ? "," : "");
+    json_string(fp, s->name ? s->name : "");
+    fprintf(fp, ",\n      \"adapter_serial\": ");
+    json_string(fp, s->adapterSerial);
+    fprintf(fp, ",\n      \"ok\": %s,\n      \"error\": ",
+            r->error ? "false" : "true");
+    if (r->error)
+      json_string(fp, r->error);
+    else
+      fprintf(fp, "null");
+    fprintf(fp, ",\n      \"some_id\": ");
+    json_hex(fp, r->someId.cmd, r->someId.cmd_len);
+    fprintf(fp, ",\n      \"ecu_id\": ");
+    json_string(fp, r->ecuId);
+    fprintf(fp, ",\n      \"ecu_serial\": ");
+    json_string(fp, r->ecuSerial);
+    fprintf(fp, ",\n      \"dtcs\": [");
+    for (int d = 0; d < r->numDtc; d++) {
+      char code[8];
+      sprintf(code, "%02X-%02X", r->dtc[d] >> 8, r->dtc[d] & 0xFF);
+      fprintf(fp, "%s{\"code\": \"%s\", \"description\": ", d ? ", " : "",
+              code);
+      json_string(fp, get_dtc_descr_code(r->dtc[d]));
+      fputc('}', fp);
+    }
+    fprintf(fp, "],\n      \"crash\": %s,\n      \"crash_data\": ",
+            r->crash ? "true" : "false");
+    json_hex(fp, r->endSession.cmd, r->endSession.cmd_len);
+    fprintf(fp,
+            ",\n      \"crash_cleared\": %s,\n      \"dtc_cleared\": %s,\n"
+            "      \"retries\": %u,\n      \"session_ms\": %.0f\n    }",
+            r->crashCleared ? "true" : "false",
+            r->dtcCleared ? "true" : "false", s->retries, r->ms);
   }
+  fprintf(fp, "\n  ]\n}\n");
+} //..write_report
 
-  // close the device
+int _tmain(int argc, _TCHAR *argv[]) {
+  const char *reportFile = NULL;
+  POLL_ITEM tables[MAX_TABLES];
+  int numTables = 0;
+  const char *logFile = NULL;
+  double logSeconds = 0;
+  int calibrateAll = 0;
 
-  if (j2534.PassThruClose(devID)) {
-    reportJ2534Error();
+  usage();
+
+  for (int argi = 1; argi < argc; argi++) {
+    if (strcmp(argv[argi], "/o") == 0 || strcmp(argv[argi], "-o") == 0) {
+      if (++argi >= argc)
+        help();
+      for (char *name = strtok(argv[argi], ","); name;
+           name = strtok(NULL, ",")) {
+        if (numSessions >= MAX_DEVICES)
+          help();
+        sessions[numSessions++].name = name;
+      }
+    } else if (strcmp(argv[argi], "/c") == 0 || strcmp(argv[argi], "-c") == 0) {
+      calibrateAll = 1;
+    } else if (strcmp(argv[argi], "/r") == 0 || strcmp(argv[argi], "-r") == 0) {
+      if (++argi >= argc)
+        help();
+      reportFile = argv[argi];
+    } else if (strcmp(argv[argi], "/t") == 0 || strcmp(argv[argi], "-t") == 0) {
+      if (++argi >= argc)
+        help();
+      if ((numTables = poll_parse(tables, MAX_TABLES, argv[argi])) <= 0)
+        help();
+    } else if (strcmp(argv[argi], "/w") == 0 || strcmp(argv[argi], "-w") == 0) {
+      if (++argi >= argc)
+        help();
+      logFile = argv[argi];
+    } else if (strcmp(argv[argi], "/d") == 0 || strcmp(argv[argi], "-d") == 0) {
+      if (++argi >= argc)
+        help();
+      logSeconds = atof(argv[argi]);
+    } else
+      help();
+  }
+  if (numTables && numSessions > 1)
+    help(); // one vehicle is logged at a time
+  if (!numSessions)
+    sessions[numSessions++].name = NULL;
+  for (unsigned int i = 0; i < numSessions; i++) {
+    sessions[i].interactive = numSessions == 1;
+    sessions[i].firstMessage = 1;
+    sessions[i].timing = HONDA_DEFAULT_TIMING;
+    sessions[i].calibrate = calibrateAll;
+  }
+
+  if (!j2534.init()) {
+    printf("can't connect to J2534 DLL.\n");
     return 0;
   }
+  atexit(dump_latency);
+
+  if (numTables) {
+    HD_SESSION *s = &sessions[0];
+    FILE *fp = NULL;
+    if (logFile && !(fp = fopen(logFile, "wb"))) {
+      printf("can't create %s\n", logFile);
+      return 1;
+    }
+    int ok = !open_session(s);
+    if (ok) {
+      ok = run_datalog(s, tables, numTables, fp, logSeconds);
+      if (!ok)
+        printf("Error receiving ECU response\n\n");
+      close_session(s);
+    }
+    if (fp)
+      fclose(fp);
+    return ok ? 0 : 1;
+  }
+
+  clk::time_point start = clk::now();
+  if (numSessions == 1) {
+    HD_SESSION *s = &sessions[0];
+    if (open_session(s))
+      return 0;
+#ifndef TESTS
+    if (!run_srs(s))
+      printf("Error receiving ECU response\n\n");
+    else
+#else
+    run_tests(s);
+#endif
+      printf("Session: %.0f ms, %u retries\n", s->result.ms, s->retries);
+    if (!close_session(s))
+      return 0;
+  } else {
+    // every vehicle gets its own thread, the bay waits only for the slowest
+    get_dtc_descr_code(0); // builds the DTC index before the workers share it
+    std::thread workers[MAX_DEVICES];
+    for (unsigned int i = 0; i < numSessions; i++)
+      workers[i] = std::thread(fleet_worker, &sessions[i]);
+    for (unsigned int i = 0; i < numSessions; i++)
+      workers[i].join();
+    for (unsigned int i = 0; i < numSessions; i++) {
+      HD_SESSION *s = &sessions[i];
+      SRS_RESULT *r = &s->result;
+      printf("%s: ", s->name);
+      if (r->error)
+        printf("%s", r->error);
+      else
+        printf("ECU %s, %d DTC%s%s", r->ecuId, r->numDtc,
+               r->numDtc == 1 ? "" : "s", r->crash ? ", CRASH DATA" : "");
+      printf(" (%.0f ms, %u retries)\n", r->ms, s->retries);
+    }
+  }
+  double totalMs =
+      std::chrono::duration<double, std::milli>(clk::now() - start).count();
+  if (numSessions > 1)
+    printf("%u vehicles in %.0f ms\n", numSessions, totalMs);
+
+  if (reportFile) {
+    FILE *fp = fopen(reportFile, "w");
+    if (!fp) {
+      printf("can't create %s\n", reportFile);
+      return 1;
+    }
+    write_report(fp, totalMs);
+    fclose(fp);
+  } else if (numSessions > 1)
+    write_report(stdout, totalMs);
+  return numSessions == 1 && sessions[0].result.error ? 1 : 0;
 } //..main
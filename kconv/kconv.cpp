@@ -0,0 +1,266 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// kconv - converts klogger captures between binary and text formats
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/klog_format.h"
+#include "../common/lzblock.h"
+#include "../common/trace.h"
+#include "../common/platform.h"
+
+void usage()
+{
+	printf(
+		"converts klogger captures between binary and text formats.\n"
+		"the direction is chosen from the input file: binary is written as text,\n"
+		"text is written as binary, compressed (/z) captures are expanded to text.\n"
+		"J2534 call traces (klogger /d) are printed as text.\n\n"
+		"kconv [infile] [outfile] {switches}\n\n"
+		"    [infile]           capture to read\n"
+		"    [outfile]          capture to write\n"
+		"  header values used when converting text to binary:\n"
+		"    /b [baudrate] baud rate (defaults to 10400)\n"
+		"    /p {none,odd,even} parity (defaults to none)\n"
+		"    /c {k,l,aux} channel (defaults to K)\n"
+		"    /t [timeout] end of message timeout in ms (defaults to 20ms)\n"
+		"  for compressed captures:\n"
+		"    /k [block] start at this block (defaults to 0)\n"
+		);
+	exit(0);
+}
+
+PASSTHRU_MSG msg;
+char line[KLOG_MAX_TEXT_LINE];
+unsigned char rec[KLOG_MAX_RECORD];
+
+/** format a decoded record, keeping the device tag of multi-device captures */
+static size_t format_record(const KLOG_STATE *st)
+{
+	KMSG_VIEW v = passthru_view(&msg);
+	if (st->device)
+		return klog_format_device_text(line,&v,st->device,st->time);
+	return klog_format_tagged_text(line,&v);
+}
+
+int bin_to_text(FILE *fpi, FILE *fpo)
+{
+	KLOG_STATE st = {};
+	int result;
+	unsigned long cnt = 0;
+	while ((result = klog_read_frame(fpi,&st,&msg)) == 1)
+	{
+		fwrite(line,1,format_record(&st),fpo);
+		cnt++;
+	}
+	if (result < 0)
+		printf("corrupt record after %lu messages.\n",cnt);
+	printf("%lu messages converted.\n",cnt);
+	return result < 0;
+}
+
+unsigned char raw[LZB_BLOCK_SIZE + KLOG_MAX_TEXT_LINE];
+
+/**
+ * @brief expand a compressed capture to text
+ * @param firstBlock - block to start at, earlier blocks are skipped without reading them
+ */
+int lz_to_text(FILE *fpi, FILE *fpo, unsigned long firstBlock)
+{
+	unsigned char caphdr[256];
+	size_t caphdrLen;
+	std::vector<LZB_BLOCK> blocks;
+	KLOG_HEADER hdr;
+	unsigned long cnt = 0;
+
+	lzb_read_index(fpi,caphdr,&caphdrLen,blocks);
+	bool binary = klog_decode_header(caphdr,caphdrLen,&hdr) != 0;
+	printf("compressed %s capture, %u blocks\n",binary ? "binary" : "text",(unsigned int)blocks.size());
+
+	for (size_t b = firstBlock; b < blocks.size(); b++)
+	{
+		long n = lzb_read_block(fpi,&blocks[b],raw,sizeof(raw));
+		if (n < 0)
+		{
+			printf("corrupt block %u.\n",(unsigned int)b);
+			return 1;
+		}
+		if (!binary)
+		{
+			fwrite(raw,1,n,fpo);
+			continue;
+		}
+
+		KLOG_STATE st = {blocks[b].tsBase};
+		long pos = 0, r;
+		while (pos < n && (r = klog_decode_frame(raw + pos,n - pos,&st,&msg)) > 0)
+		{
+			fwrite(line,1,format_record(&st),fpo);
+			pos += r;
+			cnt++;
+		}
+		if (pos != n)
+		{
+			printf("corrupt record in block %u.\n",(unsigned int)b);
+			return 1;
+		}
+	}
+	if (binary)
+		printf("%lu messages converted.\n",cnt);
+	return 0;
+}
+
+/** @brief print a J2534 call trace, times relative to the first call */
+int trace_to_text(FILE *fpi, FILE *fpo)
+{
+	TRACE_EVENT ev;
+	uint64_t t0 = 0;
+	unsigned long cnt = 0;
+	if (!trace_read_header(fpi))
+	{
+		printf("trace written by a different build.\n");
+		return 1;
+	}
+	while (trace_read_event(fpi,&ev))
+	{
+		if (!cnt)
+			t0 = ev.start;
+		trace_print(fpo,&ev,t0);
+		cnt++;
+	}
+	printf("%lu calls traced.\n",cnt);
+	return 0;
+}
+
+int text_to_bin(FILE *fpi, FILE *fpo, const KLOG_HEADER *hdr)
+{
+	KLOG_STATE st = {};
+	unsigned long cnt = 0;
+	fwrite(rec,1,klog_encode_header(rec,hdr),fpo);
+	while (fgets(line,sizeof(line),fpi))
+	{
+		KLOG_STATE ln = {0};
+		if (!klog_parse_line(line,&msg,&ln))
+			continue;
+		KMSG_VIEW v = passthru_view(&msg);
+		if (ln.device)
+			fwrite(rec,1,klog_encode_device_frame(rec,&v,ln.device,ln.time),fpo);
+		else
+			fwrite(rec,1,klog_encode_tagged_frame(rec,&st,&v),fpo);
+		cnt++;
+	}
+	printf("%lu messages converted.\n",cnt);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	char* infile = NULL;
+	char* outfile = NULL;
+	KLOG_HEADER hdr = {ISO9141_K,10400,NO_PARITY,20};
+	unsigned long firstBlock = 0;
+
+	for (int argi = 1; argi < argc; argi++)
+	{
+		if (is_switch(argv[argi]))
+		{
+			// looks like a switch
+			char *sw = &argv[argi][1];
+			argi++;
+			if (argi >= argc)
+				usage();
+
+			if (strcmp(sw,"p") == 0)
+			{
+				if (strcmp(argv[argi],"none") == 0)
+					hdr.Parity = NO_PARITY;
+				else if (strcmp(argv[argi],"odd") == 0)
+					hdr.Parity = ODD_PARITY;
+				else if (strcmp(argv[argi],"even") == 0)
+					hdr.Parity = EVEN_PARITY;
+				else
+					usage();
+			}
+			else if (strcmp(sw,"c") == 0)
+			{
+				if (strcmp(argv[argi],"k") == 0)
+					hdr.ProtocolID = ISO9141_K;
+				else if (strcmp(argv[argi],"l") == 0)
+					hdr.ProtocolID = ISO9141_L;
+				else if (strcmp(argv[argi],"aux") == 0)
+					hdr.ProtocolID = ISO9141_INNO;
+				else
+					usage();
+			}
+			else if (strcmp(sw,"b") == 0)
+			{
+				if (sscanf(argv[argi],"%lu",&hdr.Baudrate) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"t") == 0)
+			{
+				if (sscanf(argv[argi],"%lu",&hdr.Timeout) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"k") == 0)
+			{
+				if (sscanf(argv[argi],"%lu",&firstBlock) != 1)
+					usage();
+			}
+			else
+				usage();
+		}
+		else if (!infile)
+			infile = argv[argi];
+		else if (!outfile)
+			outfile = argv[argi];
+		else
+			usage();
+	}
+	if (!outfile)
+		usage();
+
+	FILE *fpi, *fpo;
+	if (NULL == (fpi = fopen(infile,"rb")))
+	{
+		printf("can't open input file.\n");
+		return 1;
+	}
+	if (NULL == (fpo = fopen(outfile,"wb")))
+	{
+		printf("can't open output file.\n");
+		return 1;
+	}
+
+	int result;
+	KLOG_HEADER inhdr;
+	char magic[4];
+	if (fread(magic,1,4,fpi) == 4 && memcmp(magic,LZB_MAGIC,4) == 0)
+	{
+		rewind(fpi);
+		result = lz_to_text(fpi,fpo,firstBlock);
+	}
+	else if (memcmp(magic,TRACE_MAGIC,4) == 0)
+	{
+		rewind(fpi);
+		result = trace_to_text(fpi,fpo);
+	}
+	else if (rewind(fpi), klog_read_header(fpi,&inhdr))
+	{
+		printf("binary capture: protocol %08lX, %lu baud, parity %lu, timeout %lu ms\n",
+			inhdr.ProtocolID,inhdr.Baudrate,inhdr.Parity,inhdr.Timeout);
+		result = bin_to_text(fpi,fpo);
+	}
+	else
+	{
+		rewind(fpi);
+		result = text_to_bin(fpi,fpo,&hdr);
+	}
+
+	fclose(fpi);
+	fclose(fpo);
+	return result;
+}
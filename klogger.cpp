@@ -8,12 +8,37 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <iostream>
-#include <tchar.h>
-#include <windows.h>
-#include <conio.h>
 #include <time.h>
 #include <stdio.h>
-#include "common\J2534.h"
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "common/platform.h"
+#include "common/J2534.h"
+#include "common/spsc_ring.h"
+#include "common/klog_format.h"
+#include "common/seglog.h"
+#include "common/lzblock.h"
+#include "common/clocksync.h"
+#include "common/kline_frame.h"
+#include "common/gaplearn.h"
+#include "common/kmsg.h"
+#include "common/uringlog.h"
+#include "common/capmetrics.h"
+#include "common/trigger.h"
+
+#define MAX_READ_BATCH 64		// upper limit of frames fetched by one PassThruReadMsgs call
+#define READ_LATENCY_MS 100		// how long a batch may wait for frames once the bus is busy
+#define IDLE_READ_TIMEOUT 1000	// read timeout while the bus is quiet
+#define RING_FRAMES 1024		// frames buffered between capture and writer threads
+#define POOL_CHUNKS RING_FRAMES	// every ring frame may be a long K-line frame
+#define OUTBUF_SIZE (256*1024)	// formatted output collected before one fwrite
+#define MAX_DEVICES 4
+#define MAX_CHANNELS (3 * MAX_DEVICES)	// K, L and AUX of every device
+#define MERGE_WINDOW_MS 200		// how late a frame may reach its ring after younger frames of other channels
+#define SPLIT_HOLD_MS 100		// how long the rest of a frame cut by a slow ECU may take
 
 void usage()
 {
@@ -23,16 +48,152 @@ void usage()
 		"    [logfile]          log file to write\n"
 		"    /b [baudrate] baud rate to use\n"
 		"    /p {none,odd,even} parity to use (defaults to none)\n"
-		"    /c {k,l,aux} channel to use (defaults to K)\n"
-		"    /t [timeout] timeout in ms to determine end of message (defaults to 20ms)\n"
+		"    /c {k,l,aux} channel(s) to use, e.g. k,l for both (defaults to K)\n"
+		"    /o [name,...] J2534 device(s) to open, all are captured into one log\n"
+		"    /t [timeout] timeout in ms to determine end of message (defaults to 20ms),\n"
+		"                 auto learns it from the gaps on the bus and notes it in the log\n"
+		"    /s {kwp,honda,auto} split messages into frames by their length byte, mark bad checksums\n"
+		"    /n [frames] max frames per read call, 1 disables batching (defaults to 64)\n"
+		"    /f {text,bin} log file format (defaults to text), see kconv to convert\n"
+		"    /rs [MB] start a new log segment at this size\n"
+		"    /rt [minutes] start a new log segment at this age\n"
+		"    /z compress the log in independent blocks, see kconv to expand\n"
+		"    /w {uring,direct} write the log through io_uring (Linux), direct also bypasses the page cache\n"
+		"    /m [file] write capture metrics for a Prometheus textfile collector every second\n"
+		"    /x [pattern] write only around messages holding these hex bytes, ?? for any, e.g. 7F,??,78\n"
+		"    /xb [seconds] time before a trigger to write (defaults to 5)\n"
+		"    /xa [seconds] time after the last trigger to write (defaults to 5)\n"
+		"    /e [seconds] stop logging after this time instead of waiting for a key\n"
+		"    /d [tracefile] record all J2534 calls, see kconv to print (needs a J2534_TRACE build)\n"
 		);
 	exit(0);
 }
 
 J2534 j2534;
-unsigned long devID;
-unsigned long chanID;
-FILE *fpo;
+SegmentedLog logfile;
+std::atomic<bool> stopCapture(false);
+std::atomic<bool> stopWriter(false);
+bool binaryFormat = false;
+KLOG_STATE klogState;
+unsigned char recbuf[KLOG_HEADER_SIZE];
+char outbuf[OUTBUF_SIZE];
+size_t outlen = 0;
+bool compress = false;
+unsigned char zbuf[LZB_BLOCK_HEADER + LZ_BOUND(OUTBUF_SIZE)];
+unsigned long lastTimestamp = 0;	// of the last message written
+TRIGGER* trigger = NULL;			// /x, NULL if every message is written
+unsigned long blockBase = 0;		// lastTimestamp when outbuf started filling
+std::chrono::steady_clock::time_point blockStart;
+
+/** state of the adaptive batched reader */
+typedef struct
+{
+	unsigned long maxBatch;	// batch size limit from the command line
+	unsigned long batch;	// frames requested by the next read
+	unsigned long timeout;	// timeout of the next read, ms
+	double rate;			// smoothed bus rate, frames per second
+} READ_BATCH;
+
+/** one opened J2534 device */
+typedef struct
+{
+	const char* name;		// PassThruOpen name, NULL for the default device
+	unsigned long devID;
+	ClockSync clock;		// device timestamps to host time
+} DEVICE;
+
+/**
+ * @brief /t auto framing of one channel
+ * @remark the interface ends a message at a short probe timeout, so every
+ * silence longer than that is seen. The writer joins the fragments again
+ * when the silence between them is shorter than the learned timeout and the
+ * bytes so far aren't a complete frame already.
+ */
+typedef struct
+{
+	GAP_LEARNER learn;
+	unsigned long byteUs;		// one character on the wire
+	KMSG_VIEW join;				// message being joined, Timestamp of its end, Data is joinData
+	unsigned char joinData[PASSTHRU_MSG_DATA_SIZE];
+	bool pending;				// join holds bytes
+	unsigned long long joinTime;	// merge time of its end
+	unsigned long long joinHost;	// host_us() when it last grew
+	bool started;				// a START_OF_MESSAGE indication gave startTime
+	unsigned long long startTime;	// merge time of the next fragment's first byte
+	bool ended;					// lastEnd is valid
+	unsigned long long lastEnd;	// merge time of the end of the previous fragment
+	unsigned long fragments;
+	unsigned long messages;
+} FRAMING;
+
+/** one captured channel, read by its own thread into its own ring */
+typedef struct
+{
+	DEVICE* dev;
+	unsigned int device;	// number of dev, from 1
+	char label[16];			// channel (and device) tag for the status line
+	unsigned long protocol;
+	unsigned long chanID;
+	SpscRing<KMSG>* ring;
+	KMsgPool* pool;			// overflow chunks of long ring frames
+	unsigned long long* times;	// merge time of every ring slot, us
+	unsigned long long lastTime;
+	PASSTHRU_MSG rxmsgs[MAX_READ_BATCH]; // frames of one read, compacted into the ring
+	READ_BATCH rb;
+	KFRAME_SPLITTER* splitter;	// /s, NULL if messages are written as read
+	unsigned long splitTimestamp;	// Timestamp of the message last fed to the splitter
+	unsigned long long splitTime;	// its merge time
+	unsigned long long prevSplitTime;	// merge time of the one before
+	FRAMING* framing;			// /t auto, NULL for a fixed timeout
+	std::atomic<unsigned long> timeoutUs;	// framing->learn.timeoutUs, for the status line
+	std::atomic<unsigned long long> newest;	// merge time of the last frame read
+	std::atomic<bool> seen;				// newest is valid
+	std::atomic<double> rate;			// rb.rate, for the status line
+	std::atomic<unsigned long> batch;	// rb.batch, for the status line
+	std::atomic<unsigned int> readCnt;
+	std::atomic<unsigned int> overflowCnt;
+	CAPTURE_COUNTERS counters;	// messages, bytes, gaps and checksums for the metrics
+	unsigned long byteUs;		// one character on the wire
+	bool ended;					// lastEnd is valid
+	unsigned long long lastEnd;	// merge time of the last message read
+	RATE_WINDOW window;			// of counters, main thread
+} CHANNEL;
+
+DEVICE devices[MAX_DEVICES];
+unsigned int numDevices = 0;
+CHANNEL channels[MAX_CHANNELS];
+unsigned int numChannels = 0;
+std::chrono::steady_clock::time_point captureStart;
+unsigned long lateCnt = 0;	// frames written after a younger frame of another channel
+unsigned char writerData[PASSTHRU_MSG_DATA_SIZE];	// data of a ring frame in several chunks, gathered
+
+/**
+ * @brief adapt the batch size and read timeout to the observed bus rate
+ * @param rb - reader state
+ * @param numRead - frames returned by the last read
+ * @param elapsed - seconds since the previous read returned
+ */
+void adapt_batch(READ_BATCH* rb, unsigned long numRead, double elapsed)
+{
+	if (elapsed > 0)
+	{
+		double rate = numRead / elapsed;
+		rb->rate = rb->rate * 0.75 + rate * 0.25;
+	}
+
+	unsigned long batch = (unsigned long)(rb->rate * READ_LATENCY_MS / 1000);
+	if (numRead == rb->batch && batch <= rb->batch)
+		batch = rb->batch * 2; // device is buffering faster than we drain, catch up
+	if (batch < 1)
+		batch = 1;
+	if (batch > rb->maxBatch)
+		batch = rb->maxBatch;
+
+	rb->batch = batch;
+	// a single frame returns as soon as it arrives, a batch must not hold
+	// frames back longer than the latency budget
+	rb->timeout = (batch > 1) ? READ_LATENCY_MS : IDLE_READ_TIMEOUT;
+}
 
 void reportJ2534Error()
 {
@@ -41,19 +202,576 @@ void reportJ2534Error()
 	printf("J2534 error [%s].",err);
 }
 
-void dump_msg(PASSTHRU_MSG* msg)
+/** write formatted messages collected in outbuf in one go */
+void flush_output()
+{
+	if (outlen)
+	{
+		if (compress)
+			logfile.write(zbuf,lzb_encode_block(zbuf,(unsigned char*)outbuf,outlen,blockBase));
+		else
+			logfile.write(outbuf,outlen);
+		outlen = 0;
+	}
+}
+
+/**
+ * @brief format one message into outbuf
+ * @param device - device number for a log of several devices, 0 otherwise
+ * @param time - aligned time of the message if device is set
+ */
+void log_msg(const KMSG_VIEW* msg, unsigned int device, unsigned long long time)
+{
+	if (logfile.due(outlen))
+	{
+		// each segment starts fresh so it can be read on its own
+		flush_output();
+		if (!logfile.rotate())
+			printf("\ncan't create next log segment.\n");
+		memset(&klogState,0,sizeof(klogState));
+		lastTimestamp = 0;
+	}
+	if (outlen + KLOG_MAX_TEXT_LINE > OUTBUF_SIZE || (compress && outlen >= LZB_BLOCK_SIZE))
+		flush_output();
+	if (!outlen)
+	{
+		blockBase = lastTimestamp;
+		blockStart = std::chrono::steady_clock::now();
+	}
+	// a log of several channels tags every frame with its channel, a log of
+	// several devices with its device and aligned time as well
+	if (binaryFormat && device)
+		outlen += klog_encode_device_frame((unsigned char*)outbuf + outlen,msg,device,time);
+	else if (device)
+		outlen += klog_format_device_text(outbuf + outlen,msg,device,time);
+	else if (binaryFormat && numChannels > 1)
+		outlen += klog_encode_tagged_frame((unsigned char*)outbuf + outlen,&klogState,msg);
+	else if (binaryFormat)
+		outlen += klog_encode_frame((unsigned char*)outbuf + outlen,&klogState,msg);
+	else if (numChannels > 1)
+		outlen += klog_format_tagged_text(outbuf + outlen,msg);
+	else
+		outlen += klog_format_text(outbuf + outlen,msg);
+	lastTimestamp = msg->Timestamp;
+}
+
+/** trigger window output */
+void log_triggered(const KMSG_VIEW* msg, unsigned int device, unsigned long long time, void* ctx)
+{
+	(void)ctx;
+	log_msg(msg,device,time);
+}
+
+/**
+ * @brief write one message, or with /x leave it to the trigger
+ * @param device - device number for a log of several devices, 0 otherwise
+ * @param time - merge time of the message
+ */
+void dump_msg(const KMSG_VIEW* msg, unsigned int device, unsigned long long time)
 {
 	if (msg->RxStatus & START_OF_MESSAGE)
 		return; // skip
 
-	fprintf(fpo,"[%u] ",msg->Timestamp);
-	for (unsigned int i = 0; i < msg->DataSize; i++)
-		fprintf(fpo,"%02X ",msg->Data[i]);
-	fprintf(fpo,"\n");
+	if (trigger)
+		trigger_feed(trigger,msg,device,time);
+	else
+		log_msg(msg,device,time);
+}
+
+/** splitter output of a channel, written as a received message */
+void dump_frame(const KMSG_VIEW* frame, void* ctx)
+{
+	CHANNEL* ch = (CHANNEL*)ctx;
+	ch->counters.frames++;
+	if ((frame->RxStatus & KFRAME_FRAMED) && !(frame->RxStatus & KFRAME_CHECKSUM_OK))
+		ch->counters.badChecksums++;
+	// frames carry the timestamp of the message that completed them, the
+	// rest of a frame given up on that of the message before
+	unsigned long long t = ch->splitTime;
+	if (frame->Timestamp != ch->splitTimestamp)
+		t = ch->prevSplitTime;
+	dump_msg(frame,numDevices > 1 ? ch->device : 0,t);
+}
+
+/** pass a finished message on to the splitter or the log */
+void write_msg(CHANNEL* ch, const KMSG_VIEW* msg, unsigned long long t)
+{
+	if (ch->splitter)
+	{
+		ch->prevSplitTime = ch->splitTime;
+		ch->splitTime = t;
+		ch->splitTimestamp = msg->Timestamp;
+		kframe_feed(ch->splitter,msg);
+	}
+	else
+		dump_msg(msg,numDevices > 1 ? ch->device : 0,t);
+}
+
+/** write the message a channel's framing holds */
+void release_join(CHANNEL* ch)
+{
+	FRAMING* fr = ch->framing;
+	if (!fr->pending)
+		return;
+	fr->pending = false;
+	fr->messages++;
+	write_msg(ch,&fr->join,fr->joinTime);
+}
+
+/** microseconds since the capture started */
+unsigned long long host_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - captureStart).count();
+}
+
+/** merge time of the oldest frame in a channel's ring */
+unsigned long long front_time(CHANNEL* ch)
+{
+	return ch->times[ch->ring->index(ch->ring->front())];
+}
+
+/**
+ * @brief /t auto: learn from the silence before a fragment and join it to
+ * the message held if that silence is short
+ * @param t - merge time of the fragment's end
+ */
+void frame_msg(CHANNEL* ch, const KMSG_VIEW* msg, unsigned long long t)
+{
+	FRAMING* fr = ch->framing;
+	if (msg->RxStatus & START_OF_MESSAGE)
+	{
+		fr->started = true;
+		fr->startTime = t;
+		return;
+	}
+	fr->fragments++;
+	// bytes of a fragment follow each other closely, so without an
+	// indication its first byte ended (size - 1) characters before its end
+	unsigned long long first = fr->started ? fr->startTime : t;
+	if (!fr->started && msg->DataSize > 1)
+	{
+		unsigned long long d = (unsigned long long)(msg->DataSize - 1) * fr->byteUs;
+		first = d < t ? t - d : 0;
+	}
+	fr->started = false;
+	unsigned long long gap = GAP_IDLE_US;
+	if (fr->ended)
+		gap = first > fr->lastEnd + fr->byteUs ? first - fr->lastEnd - fr->byteUs : 0;
+	fr->ended = true;
+	fr->lastEnd = t;
+
+	KFRAME_INFO info;
+	bool frame = fr->pending &&
+		kframe_decode(KFRAME_KWP | KFRAME_HONDA,fr->joinData,fr->join.DataSize,&info) == 1 &&
+		info.size == fr->join.DataSize;
+	if (fr->pending && !frame && gap < fr->learn.timeoutUs &&
+		fr->join.DataSize + msg->DataSize <= PASSTHRU_MSG_DATA_SIZE)
+	{
+		memcpy(fr->joinData + fr->join.DataSize,msg->Data,msg->DataSize);
+		fr->join.DataSize += msg->DataSize;
+		fr->join.Timestamp = msg->Timestamp;
+		fr->join.RxStatus |= msg->RxStatus;
+	}
+	else
+	{
+		release_join(ch);
+		fr->join = *msg;
+		memcpy(fr->joinData,msg->Data,msg->DataSize);
+		fr->join.Data = fr->joinData;
+		fr->pending = true;
+	}
+	fr->joinTime = t;
+	fr->joinHost = host_us();
+
+	if (gap_add(&fr->learn,(unsigned long)gap,frame))
+	{
+		KMSG_VIEW note;
+		unsigned char data[4];
+		klog_timeout_note(&note,data,msg->Timestamp,fr->learn.timeoutUs);
+		note.ProtocolID = ch->protocol;
+		dump_msg(&note,numDevices > 1 ? ch->device : 0,t);
+		ch->timeoutUs.store(fr->learn.timeoutUs,std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief channel holding the next frame in merge time order
+ * @remark merge times are the unwrapped device timestamps, or host aligned
+ * times when several devices are captured. Every channel's frames reach its
+ * ring in order, so the oldest ring front is next once all other channels
+ * have a frame queued as well. While a channel's ring is empty, its reader
+ * may still be about to deliver an older frame; the oldest front is then held
+ * until another channel has read a frame MERGE_WINDOW_MS younger, or until
+ * it is older than releaseTime.
+ * @param all - ignore empty channels (all readers have stopped)
+ * @param releaseTime - frames up to this time may be written, NULL if none
+ * @param newest - receives the youngest merge time read on any channel
+ * @return NULL if no frame may be written yet, *newest is only set if a
+ * frame is queued
+ */
+CHANNEL* next_channel(bool all, const unsigned long long* releaseTime, unsigned long long* newest)
+{
+	CHANNEL* best = NULL;
+	unsigned long long bestTime = 0;
+	bool allQueued = true;
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		if (!channels[i].ring->front())
+		{
+			allQueued = false;
+			continue;
+		}
+		unsigned long long t = front_time(&channels[i]);
+		if (!best || t < bestTime)
+		{
+			best = &channels[i];
+			bestTime = t;
+		}
+	}
+	if (!best)
+		return NULL;
+
+	*newest = bestTime;
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		if (!channels[i].seen.load(std::memory_order_acquire))
+			continue;
+		unsigned long long t = channels[i].newest.load(std::memory_order_relaxed);
+		if (t > *newest)
+			*newest = t;
+	}
+	if (all || allQueued || *newest - bestTime >= MERGE_WINDOW_MS * 1000ULL || (releaseTime && bestTime <= *releaseTime))
+		return best;
+	return NULL;
+}
+
+/**
+ * @brief writer thread: merges the channel rings into the log file
+ * @remark all file I/O happens here, so a slow disk or console never delays
+ * PassThruReadMsgs. Frames held for the merge wait in their rings, readers
+ * never wait for the writer. Exits once stopWriter is set and the rings are
+ * empty; set it only after the readers have stopped.
+ */
+void writer_thread()
+{
+	bool stalled = false;
+	bool release = false;
+	unsigned long long releaseTime = 0;
+	bool written = false;
+	unsigned long long lastWritten = 0;
+	std::chrono::steady_clock::time_point stallStart;
+	for (;;)
+	{
+		bool stopping = stopWriter.load();
+		unsigned long long newest = 0;
+		CHANNEL* ch = next_channel(stopping,release ? &releaseTime : NULL,&newest);
+		if (ch)
+		{
+			KMSG* km = ch->ring->front();
+			unsigned long long t = front_time(ch);
+			KMSG_VIEW msg = kmsg_view(km,writerData);
+			msg.ProtocolID = ch->protocol;
+			if (written && t < lastWritten)
+				lateCnt++;
+			written = true;
+			lastWritten = t;
+			// a message held for joining is complete once the bus went on
+			// past its timeout
+			for (unsigned int i = 0; i < numChannels; i++)
+			{
+				FRAMING* fr = channels[i].framing;
+				if (&channels[i] != ch && fr && fr->pending && fr->joinTime + fr->learn.timeoutUs < t)
+					release_join(&channels[i]);
+			}
+			if (ch->framing)
+				frame_msg(ch,&msg,t);
+			else
+				write_msg(ch,&msg,t);
+			kmsg_release(km,ch->pool);
+			ch->ring->pop();
+			stalled = false;
+			continue;
+		}
+		if (stopping)
+			break;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		// nothing more of a held message after its timeout and the longest
+		// a read holds frames back
+		for (unsigned int i = 0; i < numChannels; i++)
+		{
+			FRAMING* fr = channels[i].framing;
+			if (fr && fr->pending && host_us() - fr->joinHost > READ_LATENCY_MS * 1000ULL + fr->learn.timeoutUs)
+				release_join(&channels[i]);
+		}
+		bool pending = false;
+		for (unsigned int i = 0; i < numChannels; i++)
+			pending = pending || channels[i].ring->front() != NULL;
+		if (!pending)
+			release = false;
+		else if (!stalled)
+		{
+			stalled = true;
+			stallStart = now;
+		}
+		else if (now - stallStart > std::chrono::milliseconds(MERGE_WINDOW_MS))
+		{
+			// the other channels stayed quiet, nothing older is coming
+			release = true;
+			releaseTime = newest;
+		}
+		// compressed blocks are worth filling up, but not beyond a second
+		if (!compress || now - blockStart > std::chrono::seconds(1))
+			flush_output();
+		logfile.flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		if (channels[i].framing)
+			release_join(&channels[i]);
+		if (channels[i].splitter)
+			kframe_flush(channels[i].splitter);
+	}
+	flush_output();
+}
+
+/**
+ * @brief capture thread of one channel: reads a batch of frames and
+ * compacts it into free ring slots until stopCapture is set
+ */
+void capture_thread(CHANNEL* ch)
+{
+	std::chrono::steady_clock::time_point last_read = std::chrono::steady_clock::now();
+	while (!stopCapture.load(std::memory_order_relaxed))
+	{
+		unsigned long numRxMsg = ch->rb.batch;
+		PASSTHRU_MSG* slots = ch->rxmsgs;
+		if (j2534.PassThruReadMsgs(ch->chanID,slots,&numRxMsg,ch->rb.timeout) == ERR_BUFFER_OVERFLOW)
+			ch->overflowCnt++;
+		ch->readCnt++;
+		unsigned int bytes = 0;
+		unsigned long long host = host_us();
+		if (numRxMsg)
+		{
+			// the last frame is the one read with the least delay
+			PASSTHRU_MSG* last = &slots[numRxMsg - 1];
+			ch->dev->clock.sample(ch->dev->clock.extend(last->Timestamp,host),host);
+		}
+		// each frame goes into its ring slot while it is in the cache from
+		// the read. If the writer fell behind, frames that don't fit are
+		// dropped, the device is still drained so its buffer doesn't overflow
+		KMSG* room = NULL;
+		unsigned long avail = 0;	// reserved slots from room on
+		unsigned long filled = 0;	// slots filled since the last commit
+		unsigned long dropped = 0;
+		for (unsigned long i = 0; i < numRxMsg; i++)
+		{
+			bytes += slots[i].DataSize;
+			unsigned long long t = ch->dev->clock.extend(slots[i].Timestamp,host);
+			if (numDevices > 1)
+			{
+				long long aligned = ch->dev->clock.toHost(t);
+				t = aligned > 0 ? aligned : 0;
+			}
+			// a new clock estimate must not reorder the channel's own frames
+			if (t < ch->lastTime)
+				t = ch->lastTime;
+			ch->lastTime = t;
+			if (!(slots[i].RxStatus & START_OF_MESSAGE))
+			{
+				// the bytes of a message follow each other closely, its
+				// first one started DataSize characters before its end
+				unsigned long long d = (unsigned long long)slots[i].DataSize * ch->byteUs;
+				unsigned long long first = d < t ? t - d : 0;
+				if (ch->ended)
+					counters_gap(&ch->counters,first > ch->lastEnd ? first - ch->lastEnd : 0);
+				ch->ended = true;
+				ch->lastEnd = t;
+			}
+
+			if (!avail && !dropped)
+			{
+				// the free slots may wrap around the end of the ring
+				if (filled)
+					ch->ring->commit(filled);
+				filled = 0;
+				avail = numRxMsg - i;
+				room = ch->ring->reserve(&avail);
+			}
+			if (!avail)
+			{
+				dropped++;
+				continue;
+			}
+			kmsg_from_passthru(room,&slots[i],ch->pool);
+			ch->times[ch->ring->index(room)] = t;
+			room++;
+			avail--;
+			filled++;
+		}
+		if (filled)
+			ch->ring->commit(filled);
+		if (dropped)
+			ch->ring->overrun(dropped);
+		if (numRxMsg)
+		{
+			ch->newest.store(ch->lastTime,std::memory_order_relaxed);
+			ch->seen.store(true,std::memory_order_release);
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		adapt_batch(&ch->rb,numRxMsg,std::chrono::duration<double>(now - last_read).count());
+		last_read = now;
+		ch->counters.messages += numRxMsg;
+		ch->counters.bytes += bytes;
+		ch->rate.store(ch->rb.rate,std::memory_order_relaxed);
+		ch->batch.store(ch->rb.batch,std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief connect one channel on the open device, set its timing and a pass
+ * all filter
+ * @param p1Max - end of message timeout, 0.5 ms
+ * @return false on J2534 error
+ */
+bool open_channel(CHANNEL* ch, unsigned int baudrate, unsigned int parity, unsigned int p1Max)
+{
+	// use ISO9141_NO_CHECKSUM to disable checksumming on both tx and rx messages
+	if (j2534.PassThruConnect(ch->dev->devID,ch->protocol,ISO9141_NO_CHECKSUM,baudrate,&ch->chanID))
+		return false;
+
+	// set timing
+
+	SCONFIG_LIST scl;
+	SCONFIG scp[2] = {{P1_MAX,0},{PARITY,0}};
+	scl.NumOfParams = 2;
+	scp[0].Value = p1Max;
+	scp[1].Value = parity;
+	scl.ConfigPtr = scp;
+	if (j2534.PassThruIoctl(ch->chanID,SET_CONFIG,&scl,NULL))
+		return false;
+
+	// now setup the filter(s)
+	PASSTHRU_MSG msgMask,msgPattern;
+	unsigned long msgId;
+
+	// simply create a "pass all" filter so that we can see
+	// everything unfiltered in the raw stream
+
+	passthru_init(&msgMask,ch->protocol,1);
+	passthru_init(&msgPattern,ch->protocol,1);
+	msgMask.Data[0] = 0; // mask the first byte to 0
+	msgPattern.Data[0] = 0; // match it with 0 (i.e. pass everything)
+	if (j2534.PassThruStartMsgFilter(ch->chanID,PASS_FILTER,&msgMask,&msgPattern,NULL,&msgId))
+		return false;
+
+	ch->ring = new SpscRing<KMSG>(RING_FRAMES);
+	ch->pool = new KMsgPool(POOL_CHUNKS,true);
+	ch->times = new unsigned long long[ch->ring->capacity()];
+	return true;
+}
+
+void print_status()
+{
+	unsigned long long msgCnt = 0;
+	unsigned long long byteCnt = 0;
+	unsigned int ringMax = 0;
+	unsigned long lost = 0;
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		msgCnt += channels[i].counters.messages;
+		byteCnt += channels[i].counters.bytes;
+		if (channels[i].ring->highWater() > ringMax)
+			ringMax = (unsigned int)channels[i].ring->highWater();
+		lost += channels[i].ring->overruns();
+	}
+	printf("messages received: %llu total bytes: %llu",msgCnt,byteCnt);
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		if (numChannels > 1)
+			printf(" %s:",channels[i].label);
+		printf(" rate: %.0f msg/s batch: %lu",channels[i].rate.load(),channels[i].batch.load());
+		if (channels[i].framing)
+			printf(" timeout: %.1f ms",channels[i].timeoutUs.load() / 1000.0);
+	}
+	printf(" ring max: %u lost: %lu \r",ringMax,lost);
 }
 
+/** one value per channel */
+void metric_each(PROM_FILE* pf, const char* name, const char* type, const char* help, double (*value)(const CHANNEL*))
+{
+	prom_family(pf,name,type,help);
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		char labels[64];
+		sprintf(labels,"channel=\"%s\",device=\"%u\"",klog_channel_name(channels[i].protocol),channels[i].device);
+		prom_value(pf,name,labels,value(&channels[i]));
+	}
+}
 
-bool get_serial_num(char* serial)
+/**
+ * @brief update the rolling windows and write the metrics of every channel
+ * in the Prometheus text format
+ * @return false if the file can't be written
+ */
+bool write_metrics(const char* path)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - captureStart).count();
+	for (unsigned int i = 0; i < numChannels; i++)
+		window_update(&channels[i].window,&channels[i].counters,seconds);
+
+	PROM_FILE pf;
+	if (!prom_begin(&pf,path))
+		return false;
+	metric_each(&pf,"klogger_messages_total","counter","Messages read from the interface.",
+		[](const CHANNEL* ch) { return (double)ch->counters.messages.load(); });
+	metric_each(&pf,"klogger_bytes_total","counter","Data bytes read from the interface.",
+		[](const CHANNEL* ch) { return (double)ch->counters.bytes.load(); });
+	metric_each(&pf,"klogger_messages_per_second","gauge","Messages read per second, rolling window.",
+		[](const CHANNEL* ch) { return ch->window.msgRate; });
+	metric_each(&pf,"klogger_bytes_per_second","gauge","Data bytes read per second, rolling window.",
+		[](const CHANNEL* ch) { return ch->window.byteRate; });
+	metric_each(&pf,"klogger_bus_utilization_ratio","gauge","Share of the bus time taken by the bytes read, at the configured baud rate and parity.",
+		[](const CHANNEL* ch) { return ch->window.byteRate * ch->byteUs / 1e6; });
+
+	const char* gap = "klogger_message_gap_seconds";
+	prom_family(&pf,gap,"summary","Silence before a message, quantiles over the rolling window.");
+	for (unsigned int i = 0; i < numChannels; i++)
+	{
+		CHANNEL* ch = &channels[i];
+		static const int quantiles[] = {50,90,99};
+		char labels[96];
+		for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+		{
+			sprintf(labels,"channel=\"%s\",device=\"%u\",quantile=\"%g\"",
+				klog_channel_name(ch->protocol),ch->device,quantiles[q] / 100.0);
+			prom_value(&pf,gap,labels,window_gap_percentile(&ch->window,quantiles[q]));
+		}
+		sprintf(labels,"channel=\"%s\",device=\"%u\"",klog_channel_name(ch->protocol),ch->device);
+		prom_value(&pf,"klogger_message_gap_seconds_sum",labels,ch->counters.gapSumUs / 1e6);
+		prom_value(&pf,"klogger_message_gap_seconds_count",labels,(double)ch->counters.gapCount.load());
+	}
+
+	metric_each(&pf,"klogger_buffer_overflows_total","counter","Reads that found the interface buffer overflowed.",
+		[](const CHANNEL* ch) { return (double)ch->overflowCnt.load(); });
+	metric_each(&pf,"klogger_ring_lost_frames_total","counter","Frames dropped because the log writer fell behind.",
+		[](const CHANNEL* ch) { return (double)ch->ring->overruns(); });
+	if (channels[0].splitter)
+	{
+		metric_each(&pf,"klogger_frames_total","counter","Frames split from the messages (/s).",
+			[](const CHANNEL* ch) { return (double)ch->counters.frames.load(); });
+		metric_each(&pf,"klogger_checksum_failures_total","counter","Split frames with a bad checksum.",
+			[](const CHANNEL* ch) { return (double)ch->counters.badChecksums.load(); });
+	}
+	if (channels[0].framing)
+		metric_each(&pf,"klogger_end_of_message_timeout_seconds","gauge","Learned end of message timeout (/t auto).",
+			[](const CHANNEL* ch) { return ch->timeoutUs.load() / 1e6; });
+	return prom_end(&pf);
+}
+
+bool get_serial_num(unsigned long devID, char* serial)
 {
 	struct
 	{
@@ -93,10 +811,23 @@ int _tmain(int argc, _TCHAR* argv[])
 	unsigned int baudrate = 10400;
 	unsigned int parity = NO_PARITY;
 	unsigned int timeout = 20;
+	unsigned int maxBatch = MAX_READ_BATCH;
+	unsigned int rotateMB = 0;
+	unsigned int rotateMinutes = 0;
+	unsigned int exitSeconds = 0;
+	unsigned int protocols[3] = {ISO9141_K};
+	unsigned int numProtocols = 1;
+	int splitProtocols = 0;
+	bool autoTimeout = false;
+	const char* metricsFile = NULL;
+	const char* triggerPattern = NULL;
+	unsigned int preSeconds = 5;
+	unsigned int postSeconds = 5;
+	int uringMode = 0;	// 1 - io_uring, 2 - io_uring with O_DIRECT
 
 	for (int argi = 1; argi < argc; argi++)
 	{
-		if (argv[argi][0] == '/' || argv[argi][0] == '-')
+		if (is_switch(argv[argi]))
 		{
 			// looks like a switch
 			char *sw = &argv[argi][1];
@@ -121,12 +852,52 @@ int _tmain(int argc, _TCHAR* argv[])
 				if (argi >= argc)
 					usage();
 
-				if (strcmp(argv[argi],"k") == 0)
-					protocol = ISO9141_K;
-				else if (strcmp(argv[argi],"l") == 0)
-					protocol = ISO9141_L;
-				else if (strcmp(argv[argi],"aux") == 0)
-					protocol = ISO9141_INNO;
+				numProtocols = 0;
+				for (char *name = strtok(argv[argi],","); name; name = strtok(NULL,","))
+				{
+					if (strcmp(name,"k") == 0)
+						protocol = ISO9141_K;
+					else if (strcmp(name,"l") == 0)
+						protocol = ISO9141_L;
+					else if (strcmp(name,"aux") == 0)
+						protocol = ISO9141_INNO;
+					else
+						usage();
+					for (unsigned int i = 0; i < numProtocols; i++)
+						if (protocols[i] == protocol)
+							usage();
+					protocols[numProtocols++] = protocol;
+				}
+				if (!numProtocols)
+					usage();
+			}
+			else if (strcmp(sw,"o") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				numDevices = 0;
+				for (char *name = strtok(argv[argi],","); name; name = strtok(NULL,","))
+				{
+					if (numDevices == MAX_DEVICES)
+						usage();
+					devices[numDevices++].name = name;
+				}
+				if (!numDevices)
+					usage();
+			}
+			else if (strcmp(sw,"s") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+				if (strcmp(argv[argi],"kwp") == 0)
+					splitProtocols = KFRAME_KWP;
+				else if (strcmp(argv[argi],"honda") == 0)
+					splitProtocols = KFRAME_HONDA;
+				else if (strcmp(argv[argi],"auto") == 0)
+					splitProtocols = KFRAME_KWP | KFRAME_HONDA;
 				else
 					usage();
 			}
@@ -136,7 +907,7 @@ int _tmain(int argc, _TCHAR* argv[])
 				if (argi >= argc)
 					usage();
 
-				if (sscanf(argv[argi],"%d",&baudrate) != 1)
+				if (sscanf(argv[argi],"%d",&baudrate) != 1 || !baudrate)
 					usage();
 			}
 			else if (strcmp(sw,"t") == 0)
@@ -145,9 +916,118 @@ int _tmain(int argc, _TCHAR* argv[])
 				if (argi >= argc)
 					usage();
 
-				if (sscanf(argv[argi],"%d",&timeout) != 1)
+				if (strcmp(argv[argi],"auto") == 0)
+					autoTimeout = true;
+				else if (sscanf(argv[argi],"%d",&timeout) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"n") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&maxBatch) != 1 || maxBatch < 1 || maxBatch > MAX_READ_BATCH)
+					usage();
+			}
+			else if (strcmp(sw,"f") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (strcmp(argv[argi],"text") == 0)
+					binaryFormat = false;
+				else if (strcmp(argv[argi],"bin") == 0)
+					binaryFormat = true;
+				else
+					usage();
+			}
+			else if (strcmp(sw,"z") == 0)
+				compress = true;
+			else if (strcmp(sw,"w") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (strcmp(argv[argi],"uring") == 0)
+					uringMode = 1;
+				else if (strcmp(argv[argi],"direct") == 0)
+					uringMode = 2;
+				else
+					usage();
+			}
+			else if (strcmp(sw,"rs") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&rotateMB) != 1)
 					usage();
 			}
+			else if (strcmp(sw,"rt") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&rotateMinutes) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"m") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				metricsFile = argv[argi];
+			}
+			else if (strcmp(sw,"x") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				triggerPattern = argv[argi];
+			}
+			else if (strcmp(sw,"xb") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&preSeconds) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"xa") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&postSeconds) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"e") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (sscanf(argv[argi],"%u",&exitSeconds) != 1)
+					usage();
+			}
+			else if (strcmp(sw,"d") == 0)
+			{
+				argi++;
+				if (argi >= argc)
+					usage();
+
+				if (!j2534.trace(argv[argi]))
+					printf("tracing not compiled in, rebuild with J2534_TRACE defined.\n");
+			}
 			else
 				usage();
 		}
@@ -161,8 +1041,63 @@ int _tmain(int argc, _TCHAR* argv[])
 	}
 	if (!outfile)
 		usage();
+	if (!numDevices)
+		devices[numDevices++].name = NULL;
+	if (triggerPattern)
+	{
+		trigger = new TRIGGER();
+		if (!trigger_parse(trigger,triggerPattern))
+			usage();
+		trigger_init(trigger,preSeconds * 1000000ULL,postSeconds * 1000000ULL,log_triggered,NULL);
+	}
+	// /t auto: the interface cuts messages at one and a half characters of
+	// silence, the writer joins them by the learned timeout
+	unsigned long byteUs = (parity == NO_PARITY ? 10 : 11) * 1000000UL / baudrate;
+	unsigned long probeUs = (byteUs * 3 / 2 + 499) / 500 * 500;
+	if (probeUs < 1000)
+		probeUs = 1000;
+	for (unsigned int d = 0; d < numDevices; d++)
+	{
+		for (unsigned int i = 0; i < numProtocols; i++)
+		{
+			CHANNEL* ch = &channels[numChannels++];
+			ch->dev = &devices[d];
+			ch->device = d + 1;
+			ch->protocol = protocols[i];
+			ch->byteUs = byteUs;
+			if (numDevices > 1)
+				sprintf(ch->label,"%s@%u",klog_channel_name(ch->protocol),ch->device);
+			else
+				strcpy(ch->label,klog_channel_name(ch->protocol));
+			if (splitProtocols)
+			{
+				ch->splitter = new KFRAME_SPLITTER;
+				kframe_init(ch->splitter,splitProtocols,SPLIT_HOLD_MS * 1000UL,dump_frame,ch);
+			}
+			if (autoTimeout)
+			{
+				ch->framing = new FRAMING();
+				ch->framing->byteUs = byteUs;
+				gap_init(&ch->framing->learn,probeUs,timeout * 1000UL);
+				ch->timeoutUs = ch->framing->learn.timeoutUs;
+			}
+		}
+	}
+	protocol = protocols[0]; // binary header names the first channel
 
-	if (NULL == (fpo = fopen(outfile,"wb")))
+	size_t hdrlen = 0;
+	if (binaryFormat)
+	{
+		KLOG_HEADER hdr = {protocol,baudrate,parity,timeout};
+		hdrlen = klog_encode_header(recbuf,&hdr);
+	}
+	unsigned char zhdr[5 + KLOG_HEADER_SIZE];
+	if (compress)
+		hdrlen = lzb_encode_header(zhdr,recbuf,hdrlen);
+	logfile.setRotation((unsigned long long)rotateMB * 1024 * 1024,rotateMinutes * 60);
+	if (uringMode && !logfile.useUring(uringMode == 2))
+		printf("io_uring not available, writing the log directly.\n");
+	if (!logfile.open(outfile,compress ? zhdr : recbuf,hdrlen))
 	{
 		printf("can't open output file.\n");
 		return 0;
@@ -174,121 +1109,171 @@ int _tmain(int argc, _TCHAR* argv[])
 		return 0;
 	}
 
-	if (j2534.PassThruOpen(NULL,&devID))
-	{
-		reportJ2534Error();
-		return 0;
-	}
-
-	char strApiVersion[256];
-	char strDllVersion[256];
-	char strFirmwareVersion[256];
-	char strSerial[256];
-
-	if (j2534.PassThruReadVersion(strApiVersion,strDllVersion,strFirmwareVersion,devID))
+	for (unsigned int d = 0; d < numDevices; d++)
 	{
-		reportJ2534Error();
-		return false;
-	}
+		DEVICE* dev = &devices[d];
+		if (j2534.PassThruOpen(dev->name,&dev->devID))
+		{
+			reportJ2534Error();
+			return 0;
+		}
 
-	if (!get_serial_num(strSerial))
-	{
-		reportJ2534Error();
-		return false;
-	}
+		char strApiVersion[256];
+		char strDllVersion[256];
+		char strFirmwareVersion[256];
+		char strSerial[256];
 
-	printf("J2534 API Version: %s\n",strApiVersion);
-	printf("J2534 DLL Version: %s\n",strDllVersion);
-	printf("Device Firmware Version: %s\n",strFirmwareVersion);
-	printf("Device Serial Number: %s\n",strSerial);
+		if (j2534.PassThruReadVersion(strApiVersion,strDllVersion,strFirmwareVersion,dev->devID))
+		{
+			reportJ2534Error();
+			return false;
+		}
 
+		if (!get_serial_num(dev->devID,strSerial))
+		{
+			reportJ2534Error();
+			return false;
+		}
 
-	// use ISO9141_NO_CHECKSUM to disable checksumming on both tx and rx messages
-	if (j2534.PassThruConnect(devID,protocol,ISO9141_NO_CHECKSUM,baudrate,&chanID))
-	{
-		reportJ2534Error();
-		return 0;
+		if (numDevices > 1)
+			printf("Device %u: %s\n",d + 1,dev->name);
+		printf("J2534 API Version: %s\n",strApiVersion);
+		printf("J2534 DLL Version: %s\n",strDllVersion);
+		printf("Device Firmware Version: %s\n",strFirmwareVersion);
+		printf("Device Serial Number: %s\n",strSerial);
 	}
 
-	// set timing
-
-	SCONFIG_LIST scl;
-	SCONFIG scp[2] = {{P1_MAX,0},{PARITY,0}};
-	scl.NumOfParams = 2;
-	scp[0].Value = timeout * 2;
-	scp[1].Value = parity;
-	scl.ConfigPtr = scp;
-	if (j2534.PassThruIoctl(chanID,SET_CONFIG,&scl,NULL))
+	for (unsigned int i = 0; i < numChannels; i++)
 	{
-		reportJ2534Error();
-		return 0;
+		CHANNEL* ch = &channels[i];
+		if (!open_channel(ch,baudrate,parity,autoTimeout ? probeUs / 500 : timeout * 2))
+		{
+			reportJ2534Error();
+			return 0;
+		}
+		READ_BATCH rb = {maxBatch,1,IDLE_READ_TIMEOUT,0};
+		ch->rb = rb;
 	}
 
+	// every channel is polled by its own thread, fetching as many frames as
+	// the bus rate justifies in one call. if someone hits a key other than
+	// h (or /e expires), quit.
 
-	// now setup the filter(s)
-	PASSTHRU_MSG rxmsg,txmsg;
-	PASSTHRU_MSG msgMask,msgPattern;
-	unsigned long msgId;
-	unsigned long numRxMsg;
+	time_t last_status_update = time(NULL);
+	bool metricsFailed = false;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	captureStart = start;
 
-	// simply create a "pass all" filter so that we can see
-	// everything unfiltered in the raw stream
+	std::thread writer(writer_thread);
+	std::thread capture[MAX_CHANNELS];
+	for (unsigned int i = 0; i < numChannels; i++)
+		capture[i] = std::thread(capture_thread,&channels[i]);
 
-	txmsg.ProtocolID = protocol;
-	txmsg.RxStatus = 0;
-	txmsg.TxFlags = 0;
-	txmsg.Timestamp = 0;
-	txmsg.DataSize = 1;
-	txmsg.ExtraDataIndex = 0;
-	msgMask = msgPattern  = txmsg;
-	memset(msgMask.Data,0,1); // mask the first 4 byte to 0
-	memset(msgPattern.Data,0,1);// match it with 0 (i.e. pass everything)
-	if (j2534.PassThruStartMsgFilter(chanID,PASS_FILTER,&msgMask,&msgPattern,NULL,&msgId))
-	{
-		reportJ2534Error();
-		return 0;
+	printf("Logging. Press h for J2534 call latencies, any other key to exit...\n");
+	while (!(exitSeconds && std::chrono::steady_clock::now() - start >= std::chrono::seconds(exitSeconds)))
+	{
+		if (_kbhit())
+		{
+			int key = _getch();
+			if (key != 'h' && key != 'H')
+				break;
+			printf("\n");
+			j2534.dumpLatency(stdout);
+		}
+		if (time(NULL) - last_status_update > 0)
+		{
+			last_status_update = time(NULL);
+			print_status();
+			if (metricsFile && !write_metrics(metricsFile) && !metricsFailed)
+			{
+				printf("\ncan't write metrics file %s.\n",metricsFile);
+				metricsFailed = true;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
 	}
 
-	// continuously poll for new messages, waiting up to 1000ms for a new one
-	// if someone hits a key, quit.
+	stopCapture.store(true);
+	for (unsigned int i = 0; i < numChannels; i++)
+		capture[i].join();
+	stopWriter.store(true);
+	writer.join();
+	if (metricsFile)
+		write_metrics(metricsFile); // final totals
 
-	unsigned int msgCnt = 0;
-	unsigned int byteCnt = 0;
-	time_t last_status_update = time(NULL);
-
-	printf("Logging. Press any key to exit...\n");
-	while (!_kbhit())
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\n");
+	for (unsigned int i = 0; i < numChannels; i++)
 	{
-		numRxMsg = 1;
-		j2534.PassThruReadMsgs(chanID,&rxmsg,&numRxMsg,1000);
-		if (numRxMsg)
+		CHANNEL* ch = &channels[i];
+		unsigned int msgCnt = (unsigned int)ch->counters.messages;
+		unsigned int readCnt = ch->readCnt;
+		if (numChannels > 1)
+			printf("%s: ",ch->label);
+		printf("%u messages in %u reads (%.2f per read), %.1f msg/s, %u buffer overflows\n",
+			msgCnt,readCnt,readCnt ? (double)msgCnt / readCnt : 0.0,seconds > 0 ? msgCnt / seconds : 0.0,
+			(unsigned int)ch->overflowCnt);
+		printf("ring high-water mark: %u of %u frames, %lu frames lost to ring overrun\n",
+			(unsigned int)ch->ring->highWater(),(unsigned int)ch->ring->capacity(),ch->ring->overruns());
+		if (ch->pool->misses())
+			printf("%lu overflow chunks for long frames came from the heap\n",ch->pool->misses());
+		if (ch->framing)
 		{
-			dump_msg(&rxmsg);
-			msgCnt++;
-			byteCnt += rxmsg.DataSize;
-			if (time(NULL) - last_status_update > 0)
-			{
-				last_status_update = time(NULL);
-				printf("messages received: %d total bytes: %d\r",msgCnt,byteCnt);
-			}
+			GAP_LEARNER* gl = &ch->framing->learn;
+			printf("end of message timeout %.1f ms after %lu changes, %lu fragments joined into %lu messages\n",
+				gl->timeoutUs / 1000.0,gl->changes,ch->framing->fragments,ch->framing->messages);
+			printf("gaps: 50%% below %.1f ms, 95%% below %.1f ms",
+				gap_percentile(gl->all,gl->allCount,50) / 1000.0,gap_percentile(gl->all,gl->allCount,95) / 1000.0);
+			if (gl->frameCount)
+				printf(", after a frame 5%% below %.1f ms",gap_percentile(gl->frame,gl->frameCount,5) / 1000.0);
+			printf("\n");
 		}
+		if (ch->splitter)
+			printf("split into %lu frames, %lu with a bad checksum, %lu bytes outside any frame\n",
+				ch->splitter->frames,ch->splitter->badChecksums,ch->splitter->unframed);
 	}
+	if (numChannels > 1)
+		printf("%lu frames merged out of timestamp order\n",lateCnt);
+	if (trigger)
+	{
+		printf("trigger matched %lu times in %lu windows, %llu messages written, %llu discarded\n",
+			trigger->triggers,trigger->windows,trigger->written,trigger->dropped + trigger->count);
+		if (trigger->pool->misses())
+			printf("trigger ring ran out of overflow chunks %lu times, %llu messages dropped early\n",
+				trigger->pool->misses(),trigger->evicted);
+		trigger_free(trigger);
+	}
+	if (numDevices > 1)
+		for (unsigned int d = 0; d < numDevices; d++)
+			printf("device %u clock: host - device %.0f us, drift %.1f ppm\n",
+				d + 1,devices[d].clock.offset(),devices[d].clock.drift());
 
-	fclose(fpo);
+	logfile.close();
+	printf("%llu bytes written to %u log segment(s)\n",logfile.totalBytes(),logfile.segment());
+	if (logfile.uringWriter())
+		printf("%llu io_uring writes, %lu waits for a free buffer\n",
+			logfile.uringWriter()->submits(),logfile.uringWriter()->waits());
+	j2534.dumpLatency(stdout);
 
-	// shut down the channel
+	// shut down the channels
 
-	if (j2534.PassThruDisconnect(chanID))
+	for (unsigned int i = 0; i < numChannels; i++)
 	{
-		reportJ2534Error();
-		return 0;
+		if (j2534.PassThruDisconnect(channels[i].chanID))
+		{
+			reportJ2534Error();
+			return 0;
+		}
 	}
 
-	// close the device
+	// close the devices
 
-	if (j2534.PassThruClose(devID))
+	for (unsigned int d = 0; d < numDevices; d++)
 	{
-		reportJ2534Error();
-		return 0;
+		if (j2534.PassThruClose(devices[d].devID))
+		{
+			reportJ2534Error();
+			return 0;
+		}
 	}
 }
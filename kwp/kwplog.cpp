@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// kwplog - KWP2000 (ISO 14230) datalogger, polls local identifiers of one
+// ECU as fast as the ECU's timing allows
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "../common/J2534.h"
+#include "../common/kwp2000.h"
+#include "../common/klog_format.h"
+#include "../common/pollsched.h"
+#include "../common/platform.h"
+
+#define MAX_LIDS 32	// local identifiers polled at once
+
+void usage()
+{
+	printf(
+		"KWP2000 (ISO 14230) datalogger.\n"
+		"polls local identifiers (readDataByLocalIdentifier, 21 xx) of one ECU.\n\n"
+		"kwplog /l [lid[:rate],...] {switches}\n\n"
+		"    /l [lid[:rate],...] local identifiers (hex), rate in samples/s, in priority order;\n"
+		"                        identifiers without a rate share what the bus has left\n"
+		"    /o [name] J2534 device to use (defaults to the first one)\n"
+		"    /a [address] ECU address, hex (defaults to 10)\n"
+		"    /i {fast,5baud} init (defaults to fast)\n"
+		"    /n keep the normal timing, don't ask the ECU for faster\n"
+		"    /w [file] write the replies as a binary capture (klogger /f bin)\n"
+		"    /d [seconds] stop after this time, not at a key press\n"
+		);
+	exit(0);
+}
+
+J2534 j2534;
+POLL_ITEM lids[MAX_LIDS];
+unsigned char record[KWP_MAX_DATA];
+unsigned char rec[KLOG_MAX_RECORD];
+
+void reportJ2534Error(const char *what)
+{
+	char err[512];
+	j2534.PassThruGetLastError(err);
+	printf("%s: J2534 error [%s]\n",what,err);
+}
+
+const char *result_text(int result)
+{
+	switch (result)
+	{
+	case KWP_OK: return "ok";
+	case KWP_NO_REPLY: return "no reply";
+	case KWP_BAD_CHECKSUM: return "bad checksum";
+	case KWP_NEGATIVE: return "negative response";
+	default: return "failed";
+	}
+}
+
+/**
+ * @brief poll the local identifiers until a key is pressed or seconds have passed
+ * @param fp - binary capture of every good reply, or NULL
+ * @return 1 if the ECU answered until the end, 0 if it stopped
+ */
+int run_log(Kwp2000 *kwp, int numLids, FILE *fp, double seconds)
+{
+	KLOG_STATE st = {};
+	if (fp)
+	{
+		KLOG_HEADER hdr = {ISO14230,10400,NO_PARITY,20};
+		fwrite(rec,1,klog_encode_header(rec,&hdr),fp);
+	}
+	printf("Logging %d local identifier%s, press any key to stop...\n",numLids,numLids == 1 ? "" : "s");
+
+	// back to back requests keep the session up by themselves
+	kwp->keepAlive.hold();
+	POLL_SCHEDULE ps;
+	poll_start(&ps,lids,numLids);
+	std::chrono::steady_clock::time_point end = ps.start +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+	unsigned long requests = kwp->requests;
+	int alive = 1;
+	while (ps.active && !(seconds > 0 && std::chrono::steady_clock::now() >= end) && !_kbhit())
+	{
+		std::chrono::steady_clock::time_point wake;
+		int i = poll_next(&ps,std::chrono::steady_clock::now(),&wake);
+		if (i < 0)
+		{
+			std::this_thread::sleep_until(seconds > 0 && end < wake ? end : wake);
+			continue;
+		}
+		size_t size;
+		int r = kwp->readLocalId((unsigned char)lids[i].id,record,&size);
+		if (r != KWP_OK)
+		{
+			// an identifier the ECU keeps rejecting or ignoring only costs bus
+			// time, three different ones in a row unanswered, the ECU is gone
+			if (poll_failed(&ps,i,r != KWP_NO_REPLY))
+				printf("LID %02X dropped after %d errors in a row\n",lids[i].id,POLL_DROP_AFTER);
+			if (ps.silent >= 3)
+			{
+				alive = 0;
+				break;
+			}
+			continue;
+		}
+		poll_sampled(&ps,i);
+		if (fp)
+		{
+			KMSG_VIEW v = passthru_view(&kwp->reply);
+			fwrite(rec,1,klog_encode_frame(rec,&st,&v),fp);
+		}
+	}
+	// every identifier dropped, the last ones unanswered
+	if (!ps.active && ps.silent)
+		alive = 0;
+	if (_kbhit())
+		_getch();
+	kwp->keepAlive.release();
+
+	poll_report(stdout,&ps,"LID");
+	requests = kwp->requests - requests;
+	unsigned long samples = 0;
+	for (int i = 0; i < numLids; i++)
+		samples += lids[i].samples;
+	printf("%lu requests, %lu answered\n",requests,samples);
+	return alive;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	const char *name = NULL;
+	unsigned char address = 0x10;
+	int initMode = KWP_FAST_INIT;
+	bool tune = true;
+	const char *logFile = NULL;
+	double seconds = 0;
+	int numLids = 0;
+
+	for (int argi = 1; argi < argc; argi++)
+	{
+		const char *sw = argv[argi];
+		if (sw[0] != '/' && sw[0] != '-')
+			usage();
+		if (sw[1] == 'n' && !sw[2])
+		{
+			tune = false;
+			continue;
+		}
+		if (!sw[1] || sw[2] || ++argi >= argc)
+			usage();
+		char *arg = argv[argi];
+		switch (sw[1])
+		{
+		case 'l':
+			if ((numLids = poll_parse(lids,MAX_LIDS,arg)) <= 0)
+				usage();
+			break;
+		case 'o':
+			name = arg;
+			break;
+		case 'a':
+			address = (unsigned char)strtoul(arg,NULL,16);
+			break;
+		case 'i':
+			if (strcmp(arg,"fast") == 0)
+				initMode = KWP_FAST_INIT;
+			else if (strcmp(arg,"5baud") == 0)
+				initMode = KWP_FIVE_BAUD_INIT;
+			else
+				usage();
+			break;
+		case 'w':
+			logFile = arg;
+			break;
+		case 'd':
+			seconds = atof(arg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!numLids)
+		usage();
+
+	if (!j2534.init())
+	{
+		printf("can't connect to J2534 DLL.\n");
+		return 1;
+	}
+	unsigned long devID;
+	if (j2534.PassThruOpen(name,&devID))
+	{
+		reportJ2534Error("can't open J2534 device");
+		return 1;
+	}
+	FILE *fp = NULL;
+	if (logFile && !(fp = fopen(logFile,"wb")))
+	{
+		printf("can't create %s\n",logFile);
+		j2534.PassThruClose(devID);
+		return 1;
+	}
+
+	int ok = 0;
+	Kwp2000 kwp(&j2534);
+	if (kwp.connect(devID,address,KWP_TESTER_ADDRESS))
+		reportJ2534Error("can't connect K-line channel");
+	else
+	{
+		int r = kwp.init(initMode);
+		if (r != KWP_OK)
+			printf("init of ECU %02X: %s\n",address,result_text(r));
+		else
+		{
+			printf("ECU %02X, key bytes %02X %02X\n",address,kwp.keyBytes[0],kwp.keyBytes[1]);
+			if (tune && (r = kwp.tuneTiming()) != KWP_OK)
+				printf("timing stays normal: %s\n",result_text(r));
+			printf("P2max %lu ms, P3min %.1f ms\n",kwp.timing.p2Max / 1000,kwp.timing.p3Min / 1000.0);
+			ok = run_log(&kwp,numLids,fp,seconds);
+			if (!ok)
+				printf("ECU stopped answering\n");
+		}
+	}
+	kwp.disconnect();
+	j2534.PassThruClose(devID);
+	if (fp)
+		fclose(fp);
+	printf("\n");
+	j2534.dumpLatency(stdout);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,848 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// j2534replay - J2534 library that replays a klogger capture instead of
+// talking to an OpenPort, so klogger and hd can be run and measured
+// without the hardware
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../common/j2534_tactrix.h"
+#include "../common/klog_format.h"
+#include "../common/lzblock.h"
+
+/*
+REPLAY CONFIGURATION (environment)
+
+    J2534_REPLAY_FILE   capture to replay: text, binary (/f bin) or
+                        compressed (/z). A non-empty PassThruOpen() name
+                        overrides it, so every device opened can replay
+                        its own capture.
+    J2534_REPLAY_SPEED  1 - recorded timing (default), N - N times faster,
+                        0 - as fast as the caller reads
+    J2534_REPLAY_LOOPS  times the capture is played, 0 - endless (default 1)
+    J2534_REPLAY_MODE   stream  - every channel plays the capture from its
+                                  PassThruConnect() on (default). Messages
+                                  of a multi-channel capture are played only
+                                  on a channel of their protocol
+                        respond - nothing is played by itself, a written
+                                  message (or FAST_INIT) is looked up in the
+                                  capture and the recorded answer is returned
+
+    J2534_REPLAY_CLOCK  device clocks, comma separated start:ppm per device
+                        in PassThruOpen() order, e.g. 4294000000:0,0:80.
+                        A device with a clock stamps every message with it
+                        (starting at start when opened, running ppm fast)
+                        instead of the recorded timestamps
+
+    Up to REPLAY_MAX_DEVICES devices can be open at once. Messages of a
+    multi-device capture are played only on the device with their number.
+
+    Reads honour pass/block filters, SET_CONFIG values are kept for
+    GET_CONFIG and LOOPBACK echoes written messages. In both modes FAST_INIT
+    returns the recorded answer to the init message in pOutput.
+
+    Periodic messages are sent like written ones, the first one interval
+    after PassThruStartPeriodicMsg(); in respond mode the answers to them
+    are looked up without moving on in the recorded conversation.
+    CLEAR_RX_BUFFER drops only messages already received, an answer still
+    on its way arrives after it.
+*/
+
+#define REPLAY_MAX_DEVICES 4
+#define REPLAY_MAX_CHANNELS 12
+#define REPLAY_MAX_FILTERS 10
+#define REPLAY_MAX_PERIODIC 10
+#define REPLAY_FILTER_SIZE 12
+#define REPLAY_MAX_PARAM 0x30
+#define REPLAY_LOOP_GAP 100000ULL	// us of silence between two loops of the capture
+
+/** message of the loaded capture */
+typedef struct
+{
+	unsigned long long time;	// us since the first message
+	unsigned long Timestamp;	// as recorded
+	unsigned long ProtocolID;	// channel of a multi-channel capture, 0 - any channel
+	unsigned int device;		// device of a multi-device capture, 0 - any device
+	unsigned long RxStatus;
+	size_t offset;				// data position in replayData
+	unsigned long DataSize;
+} REPLAY_FRAME;
+
+typedef struct
+{
+	unsigned long id;			// 0 - free
+	unsigned long type;
+	unsigned long size;
+	unsigned char mask[REPLAY_FILTER_SIZE];
+	unsigned char pattern[REPLAY_FILTER_SIZE];
+} REPLAY_FILTER;
+
+/** TX_IOCTL_APP_SERVICE output, length is the buffer size on input */
+typedef struct
+{
+	unsigned int length;
+	unsigned char data[1];
+} REPLAY_APP_OUTPUT;
+
+/** periodic message of a channel */
+typedef struct
+{
+	unsigned long interval;		// ms, 0 - free
+	std::chrono::steady_clock::time_point next;
+	PASSTHRU_MSG msg;
+} REPLAY_PERIODIC;
+
+/** message waiting to be read: loopback echo or response */
+typedef struct
+{
+	std::chrono::steady_clock::time_point due;
+	PASSTHRU_MSG msg;
+} REPLAY_PENDING;
+
+typedef struct
+{
+	bool open;
+	std::vector<REPLAY_FRAME> frames;
+	std::vector<unsigned char> replayData;
+	std::chrono::steady_clock::time_point start;
+	bool clock;					// stamp messages with the device clock
+	unsigned long clockStart;	// device clock when opened, us
+	double clockRate;			// device us per host us
+} REPLAY_DEVICE;
+
+typedef struct
+{
+	bool open;
+	REPLAY_DEVICE *dev;
+	unsigned long protocol;
+	unsigned long config[REPLAY_MAX_PARAM];
+	REPLAY_FILTER filters[REPLAY_MAX_FILTERS];
+	REPLAY_PERIODIC periodic[REPLAY_MAX_PERIODIC];
+
+	std::chrono::steady_clock::time_point start;
+	size_t pos;					// next capture message to stream
+	unsigned long loop;			// current pass over the capture
+	size_t cursor;				// respond mode search position
+	std::deque<REPLAY_PENDING> pending;
+
+	std::mutex lock;
+	std::condition_variable arrived;
+} REPLAY_CHANNEL;
+
+REPLAY_DEVICE devices[REPLAY_MAX_DEVICES];
+REPLAY_CHANNEL channels[REPLAY_MAX_CHANNELS];
+std::mutex deviceLock;
+double speed = 1.0;
+unsigned long loops = 1;
+bool respondMode = false;
+char lastError[256] = "";
+
+static long fail(long code, const char *text)
+{
+	strncpy(lastError,text,sizeof(lastError) - 1);
+	return code;
+}
+
+static void add_frame(REPLAY_DEVICE *dev, const PASSTHRU_MSG *msg, unsigned int device)
+{
+	if (msg->RxStatus & KLOG_TIMEOUT_NOTE)
+		return; // klogger's note, not bus traffic
+	std::vector<REPLAY_FRAME> &frames = dev->frames;
+	REPLAY_FRAME f;
+	// timestamps wrap every 71 minutes, deltas are taken modulo 2^32
+	f.time = frames.empty() ? 0 : frames.back().time + (unsigned long)(msg->Timestamp - frames.back().Timestamp);
+	f.Timestamp = msg->Timestamp;
+	f.ProtocolID = msg->ProtocolID;
+	f.device = device;
+	f.RxStatus = msg->RxStatus;
+	f.offset = dev->replayData.size();
+	f.DataSize = msg->DataSize;
+	dev->replayData.insert(dev->replayData.end(),msg->Data,msg->Data + msg->DataSize);
+	frames.push_back(f);
+}
+
+static void add_text(REPLAY_DEVICE *dev, const unsigned char *raw, size_t len, PASSTHRU_MSG *msg)
+{
+	KLOG_STATE st;
+	std::vector<char> line;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (raw[i] != '\n')
+		{
+			line.push_back(raw[i]);
+			continue;
+		}
+		line.push_back(0);
+		if (klog_parse_line(&line[0],msg,&st))
+			add_frame(dev,msg,st.device);
+		line.clear();
+	}
+}
+
+/**
+ * @brief load a capture in any klogger format
+ * @return false if the file can't be read or holds no messages
+ */
+static bool load_capture(REPLAY_DEVICE *dev, const char *path)
+{
+	FILE *fp = fopen(path,"rb");
+	if (!fp)
+		return false;
+	dev->frames.clear();
+	dev->replayData.clear();
+
+	static PASSTHRU_MSG msg;
+	char magic[4] = {0};
+	size_t got = fread(magic,1,4,fp);
+	rewind(fp);
+	if (got == 4 && memcmp(magic,LZB_MAGIC,4) == 0)
+	{
+		unsigned char caphdr[256];
+		size_t caphdrLen;
+		std::vector<LZB_BLOCK> blocks;
+		KLOG_HEADER hdr;
+		lzb_read_index(fp,caphdr,&caphdrLen,blocks);
+		bool binary = klog_decode_header(caphdr,caphdrLen,&hdr) != 0;
+		std::vector<unsigned char> raw(LZB_BLOCK_SIZE + KLOG_MAX_TEXT_LINE);
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			long n = lzb_read_block(fp,&blocks[b],&raw[0],raw.size());
+			if (n < 0)
+				break;
+			if (!binary)
+			{
+				add_text(dev,&raw[0],n,&msg);
+				continue;
+			}
+			KLOG_STATE st = {blocks[b].tsBase};
+			long pos = 0, r;
+			while (pos < n && (r = klog_decode_frame(&raw[pos],n - pos,&st,&msg)) > 0)
+			{
+				add_frame(dev,&msg,st.device);
+				pos += r;
+			}
+		}
+	}
+	else if (got == 4 && memcmp(magic,KLOG_MAGIC,4) == 0)
+	{
+		KLOG_HEADER hdr;
+		KLOG_STATE st = {};
+		if (klog_read_header(fp,&hdr))
+			while (klog_read_frame(fp,&st,&msg) == 1)
+				add_frame(dev,&msg,st.device);
+	}
+	else
+	{
+		static char line[KLOG_MAX_TEXT_LINE];
+		KLOG_STATE st;
+		while (fgets(line,sizeof(line),fp))
+			if (klog_parse_line(line,&msg,&st))
+				add_frame(dev,&msg,st.device);
+	}
+	fclose(fp);
+	return !dev->frames.empty();
+}
+
+static REPLAY_CHANNEL *get_channel(unsigned long ChannelID)
+{
+	if (ChannelID < 1 || ChannelID > REPLAY_MAX_CHANNELS || !channels[ChannelID - 1].open)
+		return NULL;
+	return &channels[ChannelID - 1];
+}
+
+static REPLAY_DEVICE *get_device(unsigned long DeviceID)
+{
+	if (DeviceID < 1 || DeviceID > REPLAY_MAX_DEVICES || !devices[DeviceID - 1].open)
+		return NULL;
+	return &devices[DeviceID - 1];
+}
+
+/** device clock in us at the given host time, wraps like a real one */
+static unsigned long device_time(const REPLAY_DEVICE *dev, std::chrono::steady_clock::time_point at)
+{
+	double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(at - dev->start).count();
+	if (!dev->clock)
+		return (unsigned long)(long long)us;
+	return (unsigned long)((dev->clockStart + (unsigned long long)(us * dev->clockRate)) & 0xFFFFFFFFULL);
+}
+
+/** device clock now, used to stamp echoes and responses */
+static unsigned long device_time(const REPLAY_DEVICE *dev)
+{
+	return device_time(dev,std::chrono::steady_clock::now());
+}
+
+static std::chrono::steady_clock::time_point replay_time(std::chrono::steady_clock::time_point base, unsigned long long us)
+{
+	if (speed <= 0)
+		return base;
+	return base + std::chrono::microseconds((unsigned long long)(us / speed));
+}
+
+/** true if the message gets through the channel's filters */
+static bool filter_pass(const REPLAY_CHANNEL *ch, const unsigned char *data, unsigned long size)
+{
+	bool pass = false;
+	for (int i = 0; i < REPLAY_MAX_FILTERS; i++)
+	{
+		const REPLAY_FILTER *f = &ch->filters[i];
+		if (!f->id || f->size > size)
+			continue;
+		unsigned long j;
+		for (j = 0; j < f->size; j++)
+			if ((data[j] & f->mask[j]) != (f->pattern[j] & f->mask[j]))
+				break;
+		if (j < f->size)
+			continue;
+		if (f->type == BLOCK_FILTER)
+			return false;
+		pass = true;
+	}
+	return pass;
+}
+
+static void fill_msg(PASSTHRU_MSG *msg, unsigned long protocol, unsigned long rxstatus, unsigned long ts,
+					 const unsigned char *data, unsigned long size)
+{
+	msg->ProtocolID = protocol;
+	msg->RxStatus = rxstatus;
+	msg->TxFlags = 0;
+	msg->Timestamp = ts;
+	msg->DataSize = size;
+	msg->ExtraDataIndex = size;
+	memcpy(msg->Data,data,size);
+}
+
+/**
+ * @brief when the next capture message of a stream channel is due
+ * @return false when the capture is played out
+ */
+static bool stream_next(REPLAY_CHANNEL *ch, std::chrono::steady_clock::time_point *due)
+{
+	const std::vector<REPLAY_FRAME> &frames = ch->dev->frames;
+	unsigned int device = (unsigned int)(ch->dev - devices) + 1;
+	if (respondMode)
+		return false;
+	for (size_t skipped = 0;; skipped++)
+	{
+		if (skipped > frames.size())
+			return false; // nothing for this channel
+		if (ch->pos >= frames.size())
+		{
+			if (loops && ch->loop + 1 >= loops)
+				return false;
+			ch->pos = 0;
+			ch->loop++;
+		}
+		// frames tagged with another channel or device are played there
+		const REPLAY_FRAME *f = &frames[ch->pos];
+		if ((!f->ProtocolID || f->ProtocolID == ch->protocol) && (!f->device || f->device == device))
+			break;
+		ch->pos++;
+	}
+	unsigned long long span = frames.back().time + REPLAY_LOOP_GAP;
+	*due = replay_time(ch->start,ch->loop * span + frames[ch->pos].time);
+	return true;
+}
+
+/**
+ * @brief look up the recorded answer to a request, searching on from the
+ * previous match. The answer is either the rest of a message that starts
+ * with the request (echo and answer framed together) or the message that
+ * follows an exact copy of it.
+ * @param delay - receives the recorded delay of the answer, us
+ * @return false if the capture holds no answer
+ */
+static bool find_response(REPLAY_CHANNEL *ch, const PASSTHRU_MSG *req, PASSTHRU_MSG *resp, unsigned long long *delay)
+{
+	const std::vector<REPLAY_FRAME> &frames = ch->dev->frames;
+	const std::vector<unsigned char> &replayData = ch->dev->replayData;
+	size_t n = frames.size();
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = (ch->cursor + k) % n;
+		const REPLAY_FRAME *f = &frames[i];
+		if (f->DataSize < req->DataSize || memcmp(&replayData[f->offset],req->Data,req->DataSize))
+			continue;
+		if (f->DataSize > req->DataSize)
+		{
+			fill_msg(resp,ch->protocol,0,0,&replayData[f->offset + req->DataSize],f->DataSize - req->DataSize);
+			*delay = 0;
+			ch->cursor = i + 1;
+			return true;
+		}
+		if (i + 1 < n)
+		{
+			const REPLAY_FRAME *r = &frames[i + 1];
+			fill_msg(resp,ch->protocol,r->RxStatus,0,&replayData[r->offset],r->DataSize);
+			*delay = r->time - f->time;
+			ch->cursor = i + 2;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void queue_msg(REPLAY_CHANNEL *ch, const PASSTHRU_MSG *msg, std::chrono::steady_clock::time_point due)
+{
+	REPLAY_PENDING p;
+	p.due = due;
+	p.msg = *msg;
+	// keep the queue ordered, a response may be due after a later echo
+	std::deque<REPLAY_PENDING>::iterator it = ch->pending.end();
+	while (it != ch->pending.begin() && (it - 1)->due > due)
+		--it;
+	ch->pending.insert(it,p);
+	ch->arrived.notify_all();
+}
+
+/** the device sends msg at the given time: echo and, in respond mode, the answer */
+static void transmit(REPLAY_CHANNEL *ch, const PASSTHRU_MSG *msg, std::chrono::steady_clock::time_point at)
+{
+	PASSTHRU_MSG m;
+	if (ch->config[LOOPBACK])
+	{
+		fill_msg(&m,ch->protocol,TX_MSG_TYPE,device_time(ch->dev,at),msg->Data,msg->DataSize);
+		queue_msg(ch,&m,at);
+	}
+	unsigned long long delay;
+	if (respondMode && find_response(ch,msg,&m,&delay))
+	{
+		std::chrono::steady_clock::time_point due = replay_time(at,delay);
+		m.Timestamp = device_time(ch->dev,due);
+		queue_msg(ch,&m,due);
+	}
+}
+
+/** send the periodic messages that fell due by now, ch->lock held */
+static void run_periodic(REPLAY_CHANNEL *ch, std::chrono::steady_clock::time_point now)
+{
+	for (int i = 0; i < REPLAY_MAX_PERIODIC; i++)
+	{
+		REPLAY_PERIODIC *p = &ch->periodic[i];
+		// the device sent them on time even if nobody was reading
+		for (; p->interval && p->next <= now; p->next += std::chrono::milliseconds(p->interval))
+		{
+			// a keep-alive must not move the conversation on
+			size_t cursor = ch->cursor;
+			transmit(ch,&p->msg,p->next);
+			ch->cursor = cursor;
+		}
+	}
+}
+
+/** earliest periodic message due, deadline if none is due before it */
+static std::chrono::steady_clock::time_point next_periodic(const REPLAY_CHANNEL *ch, std::chrono::steady_clock::time_point deadline)
+{
+	for (int i = 0; i < REPLAY_MAX_PERIODIC; i++)
+		if (ch->periodic[i].interval && ch->periodic[i].next < deadline)
+			deadline = ch->periodic[i].next;
+	return deadline;
+}
+
+static void clear_periodic(REPLAY_CHANNEL *ch)
+{
+	for (int i = 0; i < REPLAY_MAX_PERIODIC; i++)
+		ch->periodic[i].interval = 0;
+}
+
+PT_API long PT_CALL PassThruOpen(const void *pName, unsigned long *pDeviceID)
+{
+	std::lock_guard<std::mutex> lk(deviceLock);
+	if (!pDeviceID)
+		return fail(ERR_NULL_PARAMETER,"pDeviceID is NULL");
+	int d;
+	for (d = 0; d < REPLAY_MAX_DEVICES && devices[d].open; d++)
+		;
+	if (d == REPLAY_MAX_DEVICES)
+		return fail(ERR_DEVICE_IN_USE,"all replay devices in use");
+	REPLAY_DEVICE *dev = &devices[d];
+
+	const char *path = (const char *)pName;
+	if (!path || !*path)
+		path = getenv("J2534_REPLAY_FILE");
+	if (!path)
+		return fail(ERR_DEVICE_NOT_CONNECTED,"J2534_REPLAY_FILE not set");
+	if (!load_capture(dev,path))
+		return fail(ERR_DEVICE_NOT_CONNECTED,"can't load replay capture");
+
+	const char *env;
+	speed = (env = getenv("J2534_REPLAY_SPEED")) ? atof(env) : 1.0;
+	loops = (env = getenv("J2534_REPLAY_LOOPS")) ? strtoul(env,NULL,10) : 1;
+	respondMode = (env = getenv("J2534_REPLAY_MODE")) && strcmp(env,"respond") == 0;
+
+	// start:ppm of this device in the J2534_REPLAY_CLOCK list
+	dev->clock = false;
+	if ((env = getenv("J2534_REPLAY_CLOCK")))
+	{
+		for (int i = 0; i < d && env; i++)
+			if ((env = strchr(env,',')))
+				env++;
+		char *end;
+		if (env && *env && *env != ',')
+		{
+			dev->clock = true;
+			dev->clockStart = strtoul(env,&end,10);
+			dev->clockRate = 1.0 + (*end == ':' ? atof(end + 1) : 0.0) / 1e6;
+		}
+	}
+
+	dev->open = true;
+	dev->start = std::chrono::steady_clock::now();
+	*pDeviceID = d + 1;
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruClose(unsigned long DeviceID)
+{
+	std::lock_guard<std::mutex> lk(deviceLock);
+	REPLAY_DEVICE *dev = get_device(DeviceID);
+	if (!dev)
+		return fail(ERR_INVALID_DEVICE_ID,"invalid device ID");
+	for (int i = 0; i < REPLAY_MAX_CHANNELS; i++)
+		if (channels[i].dev == dev)
+			channels[i].open = false;
+	dev->open = false;
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruConnect(unsigned long DeviceID, unsigned long ProtocolID, unsigned long Flags, unsigned long Baudrate, unsigned long *pChannelID)
+{
+	(void)Flags;
+	std::lock_guard<std::mutex> lk(deviceLock);
+	REPLAY_DEVICE *dev = get_device(DeviceID);
+	if (!dev)
+		return fail(ERR_INVALID_DEVICE_ID,"invalid device ID");
+	if (!pChannelID)
+		return fail(ERR_NULL_PARAMETER,"pChannelID is NULL");
+
+	for (int i = 0; i < REPLAY_MAX_CHANNELS; i++)
+	{
+		REPLAY_CHANNEL *ch = &channels[i];
+		if (ch->open)
+			continue;
+		std::lock_guard<std::mutex> clk(ch->lock);
+		ch->dev = dev;
+		ch->protocol = ProtocolID;
+		memset(ch->config,0,sizeof(ch->config));
+		ch->config[DATA_RATE] = Baudrate;
+		ch->config[P1_MAX] = 40;
+		memset(ch->filters,0,sizeof(ch->filters));
+		clear_periodic(ch);
+		ch->start = std::chrono::steady_clock::now();
+		ch->pos = 0;
+		ch->loop = 0;
+		ch->cursor = 0;
+		ch->pending.clear();
+		ch->open = true;
+		*pChannelID = i + 1;
+		return ERR_SUCCESS;
+	}
+	return fail(ERR_CHANNEL_IN_USE,"all replay channels in use");
+}
+
+PT_API long PT_CALL PassThruDisconnect(unsigned long ChannelID)
+{
+	std::lock_guard<std::mutex> lk(deviceLock);
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	std::lock_guard<std::mutex> clk(ch->lock);
+	ch->open = false;
+	ch->pending.clear();
+	return ERR_SUCCESS;
+}
+
+/**
+ * @brief read up to *pNumMsgs messages, waiting at most Timeout ms for all of them
+ * @return ERR_SUCCESS if all were read, ERR_TIMEOUT if only some,
+ * ERR_BUFFER_EMPTY if none
+ */
+PT_API long PT_CALL PassThruReadMsgs(unsigned long ChannelID, void *pMsg, unsigned long *pNumMsgs, unsigned long Timeout)
+{
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	if (!pMsg || !pNumMsgs)
+		return fail(ERR_NULL_PARAMETER,"NULL parameter");
+
+	PASSTHRU_MSG *out = (PASSTHRU_MSG *)pMsg;
+	unsigned long want = *pNumMsgs;
+	unsigned long count = 0;
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Timeout);
+	std::unique_lock<std::mutex> lk(ch->lock);
+	for (;;)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		run_periodic(ch,now);
+		while (count < want && !ch->pending.empty() && ch->pending.front().due <= now)
+		{
+			const PASSTHRU_MSG *m = &ch->pending.front().msg;
+			if (filter_pass(ch,m->Data,m->DataSize))
+				out[count++] = *m;
+			ch->pending.pop_front();
+		}
+
+		std::chrono::steady_clock::time_point due;
+		bool more = false;
+		while (count < want && (more = stream_next(ch,&due)) && due <= now)
+		{
+			const REPLAY_FRAME *f = &ch->dev->frames[ch->pos++];
+			const unsigned char *data = &ch->dev->replayData[f->offset];
+			if (filter_pass(ch,data,f->DataSize))
+			{
+				unsigned long long span = ch->dev->frames.back().time + REPLAY_LOOP_GAP;
+				unsigned long ts = ch->dev->clock ? device_time(ch->dev,due) : (unsigned long)(f->Timestamp + ch->loop * span);
+				fill_msg(&out[count++],ch->protocol,f->RxStatus,ts,data,f->DataSize);
+			}
+		}
+		if (count == want || now >= deadline)
+			break;
+
+		// sleep until the next message is due, a write may queue one earlier
+		std::chrono::steady_clock::time_point wake = next_periodic(ch,deadline);
+		if (more && due < wake)
+			wake = due;
+		if (!ch->pending.empty() && ch->pending.front().due < wake)
+			wake = ch->pending.front().due;
+		ch->arrived.wait_until(lk,wake);
+	}
+
+	*pNumMsgs = count;
+	if (count == want)
+		return ERR_SUCCESS;
+	return count ? ERR_TIMEOUT : ERR_BUFFER_EMPTY;
+}
+
+PT_API long PT_CALL PassThruWriteMsgs(unsigned long ChannelID, const void *pMsg, unsigned long *pNumMsgs, unsigned long Timeout)
+{
+	(void)Timeout;
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	if (!pMsg || !pNumMsgs)
+		return fail(ERR_NULL_PARAMETER,"NULL parameter");
+
+	const PASSTHRU_MSG *msgs = (const PASSTHRU_MSG *)pMsg;
+	std::lock_guard<std::mutex> lk(ch->lock);
+	for (unsigned long i = 0; i < *pNumMsgs; i++)
+	{
+		if (msgs[i].ProtocolID != ch->protocol)
+		{
+			*pNumMsgs = i;
+			return fail(ERR_MSG_PROTOCOL_ID,"message protocol doesn't match the channel");
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		run_periodic(ch,now);
+		transmit(ch,&msgs[i],now);
+	}
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruStartPeriodicMsg(unsigned long ChannelID, const void *pMsg, unsigned long *pMsgID, unsigned long TimeInterval)
+{
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	if (!pMsg || !pMsgID)
+		return fail(ERR_NULL_PARAMETER,"NULL parameter");
+	if (TimeInterval < 5 || TimeInterval > 65535)
+		return fail(ERR_INVALID_TIME_INTERVAL,"invalid time interval");
+
+	const PASSTHRU_MSG *msg = (const PASSTHRU_MSG *)pMsg;
+	if (msg->ProtocolID != ch->protocol)
+		return fail(ERR_MSG_PROTOCOL_ID,"message protocol doesn't match the channel");
+	std::lock_guard<std::mutex> lk(ch->lock);
+	for (int i = 0; i < REPLAY_MAX_PERIODIC; i++)
+		if (!ch->periodic[i].interval)
+		{
+			REPLAY_PERIODIC *p = &ch->periodic[i];
+			p->interval = TimeInterval;
+			p->next = std::chrono::steady_clock::now() + std::chrono::milliseconds(TimeInterval);
+			p->msg = *msg;
+			ch->arrived.notify_all(); // a reader may sleep past the first one
+			*pMsgID = i + 1;
+			return ERR_SUCCESS;
+		}
+	return fail(ERR_EXCEEDED_LIMIT,"too many periodic messages");
+}
+
+PT_API long PT_CALL PassThruStopPeriodicMsg(unsigned long ChannelID, unsigned long MsgID)
+{
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	std::lock_guard<std::mutex> lk(ch->lock);
+	if (MsgID < 1 || MsgID > REPLAY_MAX_PERIODIC || !ch->periodic[MsgID - 1].interval)
+		return fail(ERR_INVALID_MSG_ID,"invalid periodic message ID");
+	run_periodic(ch,std::chrono::steady_clock::now()); // those sent before it stopped
+	ch->periodic[MsgID - 1].interval = 0;
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruStartMsgFilter(unsigned long ChannelID, unsigned long FilterType, const void *pMaskMsg, const void *pPatternMsg, const void *pFlowControlMsg, unsigned long *pMsgID)
+{
+	(void)pFlowControlMsg;
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	if (!pMaskMsg || !pPatternMsg || !pMsgID)
+		return fail(ERR_NULL_PARAMETER,"NULL parameter");
+	if (FilterType != PASS_FILTER && FilterType != BLOCK_FILTER)
+		return fail(ERR_NOT_SUPPORTED,"only pass and block filters are supported");
+
+	const PASSTHRU_MSG *mask = (const PASSTHRU_MSG *)pMaskMsg;
+	const PASSTHRU_MSG *pattern = (const PASSTHRU_MSG *)pPatternMsg;
+	if (mask->DataSize > REPLAY_FILTER_SIZE || mask->DataSize != pattern->DataSize)
+		return fail(ERR_INVALID_MSG,"invalid filter size");
+
+	std::lock_guard<std::mutex> lk(ch->lock);
+	for (int i = 0; i < REPLAY_MAX_FILTERS; i++)
+	{
+		REPLAY_FILTER *f = &ch->filters[i];
+		if (f->id)
+			continue;
+		f->id = i + 1;
+		f->type = FilterType;
+		f->size = mask->DataSize;
+		memcpy(f->mask,mask->Data,f->size);
+		memcpy(f->pattern,pattern->Data,f->size);
+		*pMsgID = f->id;
+		return ERR_SUCCESS;
+	}
+	return fail(ERR_EXCEEDED_LIMIT,"too many filters");
+}
+
+PT_API long PT_CALL PassThruStopMsgFilter(unsigned long ChannelID, unsigned long MsgID)
+{
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	std::lock_guard<std::mutex> lk(ch->lock);
+	if (MsgID < 1 || MsgID > REPLAY_MAX_FILTERS || !ch->filters[MsgID - 1].id)
+		return fail(ERR_INVALID_FILTER_ID,"invalid filter ID");
+	ch->filters[MsgID - 1].id = 0;
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruSetProgrammingVoltage(unsigned long DeviceID, unsigned long Pin, unsigned long Voltage)
+{
+	(void)Pin;
+	(void)Voltage;
+	if (!get_device(DeviceID))
+		return fail(ERR_INVALID_DEVICE_ID,"invalid device ID");
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruReadVersion(unsigned long DeviceID, char *pFirmwareVersion, char *pDllVersion, char *pApiVersion)
+{
+	REPLAY_DEVICE *dev = get_device(DeviceID);
+	if (!dev)
+		return fail(ERR_INVALID_DEVICE_ID,"invalid device ID");
+	if (!pFirmwareVersion || !pDllVersion || !pApiVersion)
+		return fail(ERR_NULL_PARAMETER,"NULL parameter");
+	sprintf(pFirmwareVersion,"replay, %u messages",(unsigned int)dev->frames.size());
+	strcpy(pDllVersion,"j2534replay 1.0");
+	strcpy(pApiVersion,"04.04");
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruGetLastError(char *pErrorDescription)
+{
+	if (!pErrorDescription)
+		return ERR_NULL_PARAMETER;
+	strcpy(pErrorDescription,lastError);
+	return ERR_SUCCESS;
+}
+
+PT_API long PT_CALL PassThruIoctl(unsigned long ChannelID, unsigned long IoctlID, const void *pInput, void *pOutput)
+{
+	if (IoctlID == READ_VBATT)
+	{
+		if (!pOutput)
+			return fail(ERR_NULL_PARAMETER,"NULL parameter");
+		*(unsigned long *)pOutput = 12000; // mV
+		return ERR_SUCCESS;
+	}
+	if (IoctlID == TX_IOCTL_APP_SERVICE)
+	{
+		// device info service, only the serial number is answered. The
+		// service is sent to the device ID, further devices get a suffix
+		REPLAY_APP_OUTPUT *out = (REPLAY_APP_OUTPUT *)pOutput;
+		char serial[32] = "REPLAY"; // room for a 64-bit ChannelID
+		if (ChannelID > 1)
+			snprintf(serial,sizeof(serial),"REPLAY%lu",ChannelID);
+		size_t len = strlen(serial);
+		if (!pInput || !out)
+			return fail(ERR_NULL_PARAMETER,"NULL parameter");
+		if (out->length < len)
+			return fail(ERR_BUFFER_OVERFLOW,"output buffer too small");
+		memcpy(out->data,serial,len);
+		out->length = (unsigned int)len;
+		return ERR_SUCCESS;
+	}
+
+	REPLAY_CHANNEL *ch = get_channel(ChannelID);
+	if (!ch)
+		return fail(ERR_INVALID_CHANNEL_ID,"invalid channel ID");
+	std::lock_guard<std::mutex> lk(ch->lock);
+	switch (IoctlID)
+	{
+	case GET_CONFIG:
+	case SET_CONFIG:
+	{
+		const SCONFIG_LIST *scl = (const SCONFIG_LIST *)pInput;
+		if (!scl || (scl->NumOfParams && !scl->ConfigPtr))
+			return fail(ERR_NULL_PARAMETER,"NULL parameter");
+		for (unsigned long i = 0; i < scl->NumOfParams; i++)
+		{
+			SCONFIG *sc = &scl->ConfigPtr[i];
+			if (sc->Parameter >= REPLAY_MAX_PARAM)
+				return fail(ERR_NOT_SUPPORTED,"unsupported parameter");
+			if (IoctlID == SET_CONFIG)
+				ch->config[sc->Parameter] = sc->Value;
+			else
+				sc->Value = ch->config[sc->Parameter];
+		}
+		return ERR_SUCCESS;
+	}
+	case FAST_INIT:
+	{
+		const PASSTHRU_MSG *req = (const PASSTHRU_MSG *)pInput;
+		PASSTHRU_MSG *resp = (PASSTHRU_MSG *)pOutput;
+		unsigned long long delay;
+		if (!req || !resp)
+			return fail(ERR_NULL_PARAMETER,"NULL parameter");
+		if (!find_response(ch,req,resp,&delay))
+			return fail(ERR_TIMEOUT,"no answer to the init message in the capture");
+		resp->Timestamp = device_time(ch->dev);
+		return ERR_SUCCESS;
+	}
+	case CLEAR_TX_BUFFER:
+		return ERR_SUCCESS;
+	case CLEAR_PERIODIC_MSGS:
+		clear_periodic(ch);
+		return ERR_SUCCESS;
+	case CLEAR_RX_BUFFER:
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		run_periodic(ch,now);
+		while (!ch->pending.empty() && ch->pending.front().due <= now)
+			ch->pending.pop_front();
+		return ERR_SUCCESS;
+	}
+	case CLEAR_MSG_FILTERS:
+		memset(ch->filters,0,sizeof(ch->filters));
+		return ERR_SUCCESS;
+	default:
+		return fail(ERR_INVALID_IOCTL_ID,"unsupported ioctl");
+	}
+}